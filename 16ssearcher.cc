@@ -166,10 +166,11 @@ int main(int argc, char** argv)
   {
     int score;
     Search16S::Entry entry;
-    vector<FastQRead> reads;
+    ReadBatch reads;
   };
   vector<Candidate> candidates;
   Candidate candidate;
+  ReadBatch matches;
   while(s16.get(&candidate.entry)) {
     candidate.reads.clear();
     vector<int> qscores(candidate.entry.nucs.size());
@@ -177,12 +178,14 @@ int main(int argc, char** argv)
 
     for( n=0; n < candidate.entry.nucs.size()-35; ++n) {
       string part=candidate.entry.nucs.substr(n);
-      for(const auto& match : getConsensusMatches(part, fhpos, 35)) {
-	if(dnaDiff(match.d_nucleotides, part) < 2 ) {
-	  candidate.reads.push_back(match);
-	  for(string::size_type pos = 0 ; pos < match.d_nucleotides.length() && n+pos < qscores.size(); ++pos) {
-	    if(match.d_nucleotides[pos] == candidate.entry.nucs[n+pos])
-	      qscores[n+pos]+=match.d_quality[pos];
+      getConsensusMatches(part, fhpos, 35, &matches);
+      for(size_t i = 0; i < matches.size(); ++i) {
+	auto match = matches[i];
+	if(dnaDiff(match.getNucleotides(), part) < 2 ) {
+	  candidate.reads.add(match);
+	  for(string::size_type pos = 0 ; pos < match.len && n+pos < qscores.size(); ++pos) {
+	    if(match.nucleotides[pos] == candidate.entry.nucs[n+pos])
+	      qscores[n+pos]+=match.quality[pos];
 	  }
 	  break;
         }
@@ -228,9 +231,10 @@ int main(int argc, char** argv)
        });
   
   cerr<<"Done sorting"<<endl;
-  set<FastQRead> allReads;
+  set<ReadBatch::View> allReads; // points into candidates, which stay put from here on
   for(const auto& c : candidates) {
-    allReads.insert(c.reads.begin(), c.reads.end());
+    for(size_t i = 0; i < c.reads.size(); ++i)
+      allReads.insert(c.reads[i]);
   }
   cout<<"Total reads contributing to 16S matches: "<<allReads.size()<<endl;
   for(auto iter = candidates.rbegin(); iter != candidates.rend(); ++iter) {
@@ -0,0 +1,179 @@
+#include "aligner.hh"
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+
+using namespace std;
+
+string cigarString(const Cigar& cigar, unsigned int readLength)
+{
+  if(cigar.empty())
+    return boost::lexical_cast<string>(readLength)+"M";
+  string ret;
+  for(auto op : cigar) {
+    ret += boost::lexical_cast<string>(op >> 4);
+    ret.append(1, "MID"[op & 0xf]);
+  }
+  return ret;
+}
+
+unsigned int cigarReferenceLength(const Cigar& cigar, unsigned int readLength)
+{
+  if(cigar.empty())
+    return readLength;
+  unsigned int ret = 0;
+  for(auto op : cigar)
+    if((op & 0xf) != CigarInsert)
+      ret += op >> 4;
+  return ret;
+}
+
+static inline int nucleotideCode(char c)
+{
+  switch(c) {
+  case 'A': return 0;
+  case 'C': return 1;
+  case 'G': return 2;
+  case 'T': return 3;
+  default: return -1;
+  }
+}
+
+//! one 64 row block of a column, hin is the change along the row above it. Returns the change along its bottom row
+static inline int advanceBlock(uint64_t* pv, uint64_t* mv, uint64_t eq, int hin)
+{
+  uint64_t hinIsNeg = hin < 0 ? 1 : 0;
+  uint64_t Pv = *pv, Mv = *mv;
+  uint64_t Xv = eq | Mv;
+  eq |= hinIsNeg;
+  uint64_t Xh = (((eq & Pv) + Pv) ^ Pv) | eq;
+  uint64_t Ph = Mv | ~(Xh | Pv);
+  uint64_t Mh = Pv & Xh;
+  int hout = (int)(Ph >> 63) - (int)(Mh >> 63);
+  Ph <<= 1;
+  Mh <<= 1;
+  Mh |= hinIsNeg;
+  Ph |= hin > 0 ? 1 : 0;
+  *pv = Mh | ~(Xv | Ph);
+  *mv = Ph & Xv;
+  return hout;
+}
+
+int BandedAligner::score(unsigned int row, unsigned int column) const
+{
+  const uint64_t* pv = &d_pv[column * d_words];
+  const uint64_t* mv = &d_mv[column * d_words];
+  int ret = 0;
+  unsigned int w = 0;
+  for(; (w + 1) * 64 <= row; ++w)
+    ret += __builtin_popcountll(pv[w]) - __builtin_popcountll(mv[w]);
+  if(row % 64) {
+    uint64_t mask = (1ULL << (row % 64)) - 1;
+    ret += __builtin_popcountll(pv[w] & mask) - __builtin_popcountll(mv[w] & mask);
+  }
+  return ret;
+}
+
+const Alignment& BandedAligner::align(const char* read, unsigned int readLen, const char* ref, unsigned int refLen, unsigned int expectedStart)
+{
+  Alignment& ret = d_alignment;
+  ret.cigar.clear();
+  ret.refStart = min(expectedStart, refLen);
+  ret.refLength = ret.distance = ret.mismatches = ret.indels = 0;
+  if(!readLen)
+    return ret;
+
+  d_words = (readLen + 63) / 64;
+  d_peq.assign(4 * d_words, 0);
+  for(unsigned int i = 0; i < readLen; ++i) {
+    int code = nucleotideCode(read[i]);
+    if(code >= 0) // anything else matches nothing
+      d_peq[code * d_words + i / 64] |= 1ULL << (i % 64);
+  }
+  if(d_pv.size() < (refLen + 1) * d_words) {
+    d_pv.resize((refLen + 1) * d_words);
+    d_mv.resize((refLen + 1) * d_words);
+  }
+
+  // column 0 is before any reference, there the distance is the number of read nucleotides
+  fill(d_pv.begin(), d_pv.begin() + d_words, ~0ULL);
+  fill(d_mv.begin(), d_mv.begin() + d_words, 0ULL);
+  for(unsigned int j = 1; j <= refLen; ++j) {
+    int code = nucleotideCode(ref[j - 1]);
+    const uint64_t* pvIn = &d_pv[(j - 1) * d_words];
+    const uint64_t* mvIn = &d_mv[(j - 1) * d_words];
+    uint64_t* pv = &d_pv[j * d_words];
+    uint64_t* mv = &d_mv[j * d_words];
+    int h = 0; // the read may start anywhere in the reference for free
+    for(unsigned int w = 0; w < d_words; ++w) {
+      pv[w] = pvIn[w];
+      mv[w] = mvIn[w];
+      h = advanceBlock(pv + w, mv + w, code >= 0 ? d_peq[code * d_words + w] : 0, h);
+    }
+  }
+
+  // the read may also end anywhere
+  unsigned int expectedEnd = min(expectedStart + readLen, refLen);
+  unsigned int bestColumn = 0;
+  int best = readLen + 1;
+  for(unsigned int j = 0; j <= refLen; ++j) {
+    int s = score(readLen, j);
+    if(s < best || (s == best && abs((int)j - (int)expectedEnd) < abs((int)bestColumn - (int)expectedEnd))) {
+      best = s;
+      bestColumn = j;
+    }
+  }
+
+  // back from there, preferring matches over inserts over deletes, but carrying on with an insert or delete we are in
+  unsigned int i = readLen, j = bestColumn;
+  int last = -1;
+  auto addOp = [&ret, &last](CigarOp op) { // ops come out in reverse
+    if(last == op)
+      ret.cigar.back() += 1 << 4;
+    else {
+      ret.cigar.push_back((1 << 4) | op);
+      if(op != CigarMatch)
+	ret.indels++;
+    }
+    last = op;
+  };
+  int here = best;
+  while(i > 0) {
+    bool canInsert = score(i - 1, j) + 1 == here;
+    bool canDelete = j > 0 && score(i, j - 1) + 1 == here;
+    if(last == CigarInsert && canInsert) {
+      addOp(CigarInsert);
+      here = score(--i, j);
+      continue;
+    }
+    if(last == CigarDelete && canDelete) {
+      addOp(CigarDelete);
+      here = score(i, --j);
+      continue;
+    }
+    if(j > 0) {
+      int diag = score(i - 1, j - 1);
+      bool same = nucleotideCode(read[i - 1]) >= 0 && read[i - 1] == ref[j - 1];
+      if(diag + (same ? 0 : 1) == here) {
+	if(!same)
+	  ret.mismatches++;
+	addOp(CigarMatch);
+	--i;
+	--j;
+	here = diag;
+	continue;
+      }
+    }
+    if(canInsert) {
+      addOp(CigarInsert);
+      here = score(--i, j);
+      continue;
+    }
+    addOp(CigarDelete); // has to be possible if nothing else is
+    here = score(i, --j);
+  }
+  reverse(ret.cigar.begin(), ret.cigar.end());
+  ret.refStart = j;
+  ret.refLength = bestColumn - j;
+  ret.distance = best;
+  return ret;
+}
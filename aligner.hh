@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+//! CIGAR operations the way BAM stores them, length << 4 | op. We only use M, I and D
+typedef std::vector<uint32_t> Cigar;
+enum CigarOp { CigarMatch = 0, CigarInsert = 1, CigarDelete = 2 };
+
+//! as in a SAM file, an empty cigar means all readLength nucleotides match straight
+std::string cigarString(const Cigar& cigar, unsigned int readLength);
+//! how many reference nucleotides a read with this cigar covers
+unsigned int cigarReferenceLength(const Cigar& cigar, unsigned int readLength);
+
+//! How all of a read aligns to a part of a reference
+struct Alignment
+{
+  unsigned int refStart; //!< where in the reference the read starts
+  unsigned int refLength; //!< how much of the reference it covers
+  unsigned int distance; //!< mismatched, inserted and deleted nucleotides
+  unsigned int mismatches;
+  unsigned int indels; //!< number of I and D operations, not nucleotides
+  Cigar cigar;
+};
+
+/** Edit distance alignment of a read to a stretch of reference, bit-parallel after Myers and Hyyro: every column of
+    the reference costs a few word operations per 64 nucleotides of read. The reference should be the region the read
+    is expected at plus a band on either side, so that band bounds the indels we can find. The column vectors are kept
+    for the traceback into a cigar. Buffers are kept between calls, so have one per thread */
+class BandedAligner
+{
+public:
+  /** aligns all of read to part of ref, with the lowest edit distance. Of equally good ones, the one ending closest to
+      expectedStart + readLen. Returns a reference to our own Alignment, valid until the next call */
+  const Alignment& align(const char* read, unsigned int readLen, const char* ref, unsigned int refLen, unsigned int expectedStart);
+private:
+  int score(unsigned int row, unsigned int column) const; //!< edit distance of the first row read nucleotides, ending at column
+  unsigned int d_words;
+  std::vector<uint64_t> d_peq; //!< per nucleotide, the read positions that have it
+  std::vector<uint64_t> d_pv, d_mv; //!< per column, which rows go up and down by one from the row above
+  Alignment d_alignment;
+};
@@ -15,10 +15,13 @@
 #include <string>
 #include <string.h>
 #include <stdexcept>
-#include <forward_list>
 #include <inttypes.h>
 #include <algorithm>
 #include <numeric>
+#include <random>
+#include <thread>
+#include <exception>
+#include <atomic>
 
 #include <errno.h>
 #include <math.h>
@@ -36,13 +39,18 @@
 #include "zstuff.hh"
 #include "geneannotated.hh"
 #include "misc.hh"
+#include "dnakernels.hh"
 #include "fastq.hh"
-#include <mba/diff.h>
-#include <mba/msgno.h>
 #include "antonie.hh"
 #include "saminfra.hh"
 #include "refgenome.hh"
+#include "seeding.hh"
+#include "pairing.hh"
+#include "readsearch.hh"
+#include "mappingworker.hh"
+#include "aligner.hh"
 #include "compat.hh"
+#include "reportwriter.hh"
 
 extern "C" {
 #include "hash.h"
@@ -65,80 +73,27 @@ typedef io::stream< TeeDevice > TeeStream;
 TeeStream* g_log;
 string g_name;
 
-void ReferenceGenome::printCoverage(FILE* jsfp, const std::string& histoName)
+void ReferenceGenome::printCoverage(ReportWriter& js, const std::string& histoName, unsigned int numThreads)
 {
-  uint64_t totCoverage=0, noCoverages=0;
-  unsigned int cov;
-
-  bool wasNul=true;
-  string::size_type prevNulpos=0;
-
-  vector<unsigned int> covhisto;
-  covhisto.resize(1000);
-  VarMeanEstimator vmeDepth;
-  d_unmRegions.clear();
-  //  ofstream covfile("coverage");
-  //  int prevcov = d_mapping[0].coverage;
-
-  map<double, VarMeanEstimator> gcCoverage;
-
-  for(string::size_type pos = 0; pos < d_mapping.size(); ++pos) {
-    cov = d_mapping[pos].coverage;
-    string gcsnip=snippet((pos > 20) ? (pos - 20) : 1, pos+20);
-    double gc=getGCContent(gcsnip); // 1 based!
-    
-    if(gcsnip.length()==40) {// we get strange results otherwise
-      gcCoverage[gc](cov);
-    }
-    else {
-      // cout <<"Odd gcsnip length: "<<gcsnip.length()<<", pos = "<<pos<<endl;
-      
-    }
-
-    //    covfile << pos << '\t' << cov << '\t' << ((int)cov)-prevcov << '\t' << gc  <<'\t' << getGCContent(snippet(pos > 7 ? pos-7 : 1, pos+8)) << '\n';
-    // prevcov=cov;
-
-    vmeDepth(cov);
-
-    bool noCov = cov < 5;
-    if(cov >= covhisto.size()) {
-      covhisto.resize(2*cov+1);
-    }
-
-    covhisto[cov]++;
-    
-    totCoverage += cov;
-
-    if(noCov) {
-      noCoverages++;
-    }
-    
-    if(!noCov && wasNul) {
-      if(prevNulpos > 40 && pos + 40 < d_genome.length()) {
-	Unmatched unm;
-	unm.left = d_genome.substr(prevNulpos-40, 40);
-	unm.right = d_genome.substr(pos, 40);
-	unm.unmatched = d_genome.substr(prevNulpos, pos-prevNulpos);
-	unm.pos = prevNulpos;
-	d_unmRegions.push_back(unm);
-      }
-      wasNul=false;
-    }
-    else if(noCov && !wasNul) {
-      wasNul=true;
-      prevNulpos = pos;
-    }
-  }
+  CoverageStats stats = getCoverageStats(numThreads);
+  auto& covhisto = stats.histo;
+  d_unmRegions = stats.lowRuns;
 
   ofstream gcv("gccoverage");
   vector<pair<double, double> > gc, gclo, gchi;
-  for(const auto& ent : gcCoverage) {
+  for(const auto& ent : stats.gcTable()) {
     gc.push_back({ent.first, mean(ent.second)});
     gclo.push_back({ent.first, mean(ent.second) - sqrt(variance(ent.second))});
     gchi.push_back({ent.first, mean(ent.second) + sqrt(variance(ent.second))});
     gcv << ent.first << '\t' << mean(ent.second) << '\t' << sqrt(variance(ent.second))<<endl;
   }
-  fprintf(jsfp, "var gccov=%s;\nvar gccovlo=%s;\nvar gccovhi=%s;\n", jsonVectorPair(gc).c_str(), jsonVectorPair(gclo).c_str(), jsonVectorPair(gchi).c_str());
+  js << "var gccov=";
+  writeJSONPairs(js, gc);
+  js << ";\nvar gccovlo=";
+  writeJSONPairs(js, gclo);
+  js << ";\nvar gccovhi=";
+  writeJSONPairs(js, gchi);
+  js << ";\n";
   
   Clusterer<Unmatched> cl(100);
   
@@ -146,10 +101,10 @@ void ReferenceGenome::printCoverage(FILE* jsfp, const std::string& histoName)
     cl.feed(unm);
   }
 
-  (*g_log) << (boost::format("Average depth: %|40t|    %10.2f +- %.2f\n") % mean(vmeDepth) % sqrt(variance(vmeDepth))).str();
+  (*g_log) << (boost::format("Average depth: %|40t|    %10.2f +- %.2f\n") % mean(stats.depth) % sqrt(variance(stats.depth))).str();
 
   double expected=-1; // size()*(1-erf(mean(vmeDepth)/(sqrt(variance(vmeDepth))*sqrt(2))));
-  (*g_log) << (boost::format("Undercovered nucleotides: %|40t| %10d (%.2f%%), %d ranges, %.1f could be expected\n") % noCoverages % (noCoverages*100.0/d_mapping.size()) % cl.d_clusters.size() %expected).str();
+  (*g_log) << (boost::format("Undercovered nucleotides: %|40t| %10d (%.2f%%), %d ranges, %.1f could be expected\n") % stats.undercovered % (stats.undercovered*100.0/d_coverage.size()) % cl.d_clusters.size() %expected).str();
   
   uint64_t total = std::accumulate(covhisto.begin(), covhisto.end(), 0), cumul=0;
 
@@ -162,233 +117,45 @@ void ReferenceGenome::printCoverage(FILE* jsfp, const std::string& histoName)
     }
   }
 
-  fputs(jsonVector(covhisto, histoName, [&total](dnapos_t dp) { return 1.0*dp/total; }).c_str(), jsfp);
+  writeJSONVector(js, histoName, covhisto, [&total](dnapos_t dp) { return 1.0*dp/total; });
 }
 
 
-//! 0 if nothing interesting, positive if our read has insert at that position, negative if we have a delete at that position
-int MBADiff(dnapos_t pos, const FastQRead& fqr, const string& reference, unsigned int* amount=0)
-{
-  string::size_type n, m;
-  int d,  sn;
-  struct varray *ses = varray_new(sizeof(struct diff_edit), NULL);
-  
-  n = reference.length();
-  m = fqr.d_nucleotides.length();
-  if ((d = diff(fqr.d_nucleotides.c_str(), 0, m, reference.c_str(), 0, n, NULL, NULL, NULL, 0, ses, &sn, NULL)) == -1) {
-    MMNO(errno);
-    printf("Error\n");
-    return EXIT_FAILURE;
-  }
-  int ret=0;
-
-  if(sn > 3 && sn < 10) {
-    auto *match1 = (struct diff_edit*)varray_get(ses, 0),
-      *change1=(struct diff_edit*)varray_get(ses, 1), 
-      *match2=(struct diff_edit*)varray_get(ses, 2);
-
-    int totMatch = match1->len + match2->len;
-    if(match1->op == DIFF_MATCH && totMatch > 10*change1->len &&  match1->len > 10 && match2->len > 10 &&
-       match2->op == DIFF_MATCH && (d - 2*change1->len) < 4) {
-      if(0 && amount )
-		printf("pos %u, d=%u (%d) sn=%d, rpos=%u, calling '%s' of %d bases\nUS:  %s\nREF: %s\n", pos, d, d - 2*change1->len, 
-	     sn, pos+change1->off, change1->op==DIFF_INSERT ? "Delete" : "Insert", change1->len, fqr.d_nucleotides.c_str(), reference.c_str());
-      
-      if(amount)
-	*amount=change1->len;
-
-      if(change1->op == DIFF_INSERT) 
-	ret=-change1->off;
-      else
-	ret=change1->off;
-#if 0
-      for (int i = 0; i < sn; i++) {
-	struct diff_edit *e = (struct diff_edit*)varray_get(ses, i);
-	
-	switch (e->op) {
-	case DIFF_MATCH:
-	  printf("MAT: ");
-	  fwrite(fqr.d_nucleotides.c_str() + e->off, 1, e->len, stdout);
-	  break;
-	case DIFF_INSERT:
-	  printf("INS: ");
-	  fwrite(reference.c_str() + e->off, 1, e->len, stdout);
-	  break;
-	case DIFF_DELETE:
-	  printf("DEL: ");
-	  fwrite(fqr.d_nucleotides.c_str() + e->off, 1, e->len, stdout);
-	  break;
-	}
-	printf("\n");
-      }
-#endif
-    }
-  }
-
-  varray_del(ses);
-
-  return ret;
-}
-
-unsigned int diffScore(ReferenceGenome& rg, dnapos_t pos, const FastQRead& fqfrag, int qlimit)
-{
-  unsigned int diffcount=0;
-  string reference = rg.snippet(pos, pos + fqfrag.d_nucleotides.length());
-  for(string::size_type i = 0; i < fqfrag.d_nucleotides.size() && i < reference.size();++i) {
-    if(fqfrag.d_nucleotides[i] != reference[i] && fqfrag.d_quality[i] > qlimit) 
-      diffcount++;
-  }
 
-  if(diffcount >= 5) { // bit too different, try mbadiff!
-    int res=MBADiff(pos, fqfrag, reference);
-    if(res < 0 || res > 0)
-      return 1;
-  }
-
-  return diffcount;
-}
-
-vector<dnapos_t> getTriplets(const vector<pair<dnapos_t, char>>& together, unsigned int interval, unsigned int shift) 
+void printCorrectMappings(ReportWriter& js, const ReferenceGenome& rg, const std::string& name)
 {
-  vector<dnapos_t> ret;
-
-  for(unsigned int i = 0; i < together.size() - 2; ++i) {
-    if(together[i].second=='L' && together[i+1].second=='M' && together[i+2].second=='R' && 
-       together[i+1].first - together[i].first < 1.2*interval && together[i+2].first - together[i+1].first < 1.2*interval) {
-      dnapos_t lpos;
-      lpos=together[i].first; 
-
-      if(lpos < shift)
-        continue;
-      
-      ret.push_back(lpos-shift);
-    }
-  }         
-  return ret;
-}
-
-void printCorrectMappings(FILE* jsfp, const ReferenceGenome& rg, const std::string& name)
-{
-  fprintf(jsfp, "%s=[", name.c_str());
+  js << name << "=[";
   for(unsigned int i=0; i < rg.d_correctMappings.size() ;++i) {
     if(!rg.d_correctMappings[i] || !rg.d_wrongMappings[i])
       continue;
     double total=rg.d_correctMappings[i] + rg.d_wrongMappings[i];
     double error= rg.d_wrongMappings[i]/total;
     double qscore=-10*log10(error);
-    fprintf(jsfp, "%s[%d,%.2f]", i ? "," : "", i, qscore);
+    js << (i ? "," : "") << '[' << i << ',' << fixed(qscore, 2) << ']';
     //    cout<<"total "<<total<<", error: "<<error<<", qscore: "<<qscore<<endl;
   }
-  fprintf(jsfp,"];\n");
+  js << "];\n";
 }
 
 
-//! Keeps a tally of correct and incorrect mappings
-struct qtally
-{
-  qtally() : correct{0}, incorrect{0}{}
-  uint64_t correct;
-  uint64_t incorrect;
-};
-
-int MapToReference(ReferenceGenome& rg, dnapos_t pos, FastQRead fqfrag, int qlimit, BAMWriter* sbw, vector<qtally>* qqcounts, int* outIndel=0)
+//! the a, c, g, t and x probability graphs of a region starting at start
+static void writeProbabilities(ReportWriter& js, dnapos_t start, const vector<double>& aProb, const vector<double>& cProb,
+			       const vector<double>& gProb, const vector<double>& tProb, const vector<double>& xProb)
 {
-  if(pos > rg.size()) // can happen because of inserts or circular genomes
-    return false;
-  if(outIndel)
-    *outIndel=0;
-  string reference = rg.snippet(pos, pos + fqfrag.d_nucleotides.length());
-
-  double diffcount=0;
-  for(string::size_type i = 0; i < fqfrag.d_nucleotides.size() && i < reference.size();++i) {
-    if(fqfrag.d_nucleotides[i] != reference[i]) {
-      if(fqfrag.d_quality[i] > qlimit) 
-	diffcount++;
-      else
-	diffcount+=0.5;
-    }
-  }
-  bool didMap=false;
-
-  if(diffcount < 5) {
-    didMap=true;
-    rg.mapFastQ(pos, fqfrag);
-    if(sbw)
-      sbw->qwrite(pos, fqfrag);
-  }
-  else {
-    unsigned int amount=0;
-    int indel=MBADiff(pos, fqfrag, reference, &amount);
-    if(outIndel)
-      *outIndel=indel;
-
-    if(indel) {
-      rg.mapFastQ(pos, fqfrag, indel);
-      if(sbw)
-	sbw->qwrite(pos, fqfrag, indel);
-      didMap=true;
-
-      diffcount=1; // makes sure we get mapped anyhow
-      if(indel > 0) { // our read has an insert at this position
-	//	cout<<"Mapping an insert: "<<pos+indel<<" of "<<amount<<" codons, "<<fqfrag.d_nucleotides.substr(indel, amount)<<endl;
-
-	// down below, everything will match, so we need to locimap here
-        rg.d_locimap[pos+indel].samples.push_back({fqfrag.d_nucleotides[indel], fqfrag.d_quality[indel], 
-	      (bool)(fqfrag.reversed ^ ((unsigned int)indel > fqfrag.d_nucleotides.length()/2)),      // head or tail
-	      fqfrag.d_nucleotides.substr(indel, amount)});
-
-        fqfrag.d_nucleotides.erase(indel, amount); // this makes things align again
-        fqfrag.d_quality.erase(indel, amount); 
-        rg.d_insertCounts[pos+indel]++; 
-      } else {      // our read has an erase at this position
-	//	cout<<"Mapping a delete at "<<pos-indel<<" of " <<amount<<" codons"<<endl;
-        fqfrag.d_nucleotides.insert(-indel, amount, 'X');
-	//	cout<<"REF: "<<reference<<endl<<"US:  "<<fqfrag.d_nucleotides<<endl;
-        fqfrag.d_quality.insert(-indel, amount, 40);
-      }
-    }
-  }
-
-  unsigned int readMapPos;
-  for(string::size_type i = 0; i < fqfrag.d_nucleotides.size() && i < reference.size();++i) {
-    readMapPos = fqfrag.reversed ? ((reference.length()- 1) - i) : i; // d_nucleotides might have an insert
-      
-    char c =  fqfrag.d_nucleotides[i];
-
-    if(c != reference[i]) {
-      //      diff.append(1, fqfrag.d_quality[i] > qlimit ? '!' : '^');
-      //      cout<<"Have diff at "<<pos+i<<", diffCount="<<diffcount<<", qfilt="<< (fqfrag.d_quality[i] > qlimit)<<endl;
-      if(fqfrag.d_quality[i] > qlimit && diffcount < 5) 
-        rg.d_locimap[pos+i].samples.push_back({fqfrag.d_nucleotides[i], fqfrag.d_quality[i], 
-	      (bool)(fqfrag.reversed ^ (i > fqfrag.d_nucleotides.length()/2))}); // head or tail
-      
-      if(diffcount < 5) {
-	unsigned int q = (unsigned int)fqfrag.d_quality[i];
-	(*qqcounts)[q].incorrect++;
-	rg.d_wrongMappings[readMapPos]++;
-      }
-    }
-    else {
-      // diff.append(1, ' ');
-      rg.cover(pos+i,fqfrag.d_quality[i], qlimit);
-      if(diffcount < 5) {
-	(*qqcounts)[(unsigned int)fqfrag.d_quality[i]].correct++;
-	rg.d_correctMappings[readMapPos]++;
-      }
-    }
-  }
-  //  if(diffcount > 5) {
-  //  cout<<"US:  "<<fqfrag.d_nucleotides<<endl<<"DIF: ";
-  //  cout<<diff<<endl<<"REF: "<<reference<<endl;
-  //  cout<<"QUA: "<<fqfrag.d_quality<<endl;
-  //  cout<<endl;
-  //}
-  //return diff;
-  return didMap;
+  auto offset = [start](int i){return i+start;};
+  js << "aProb: ";
+  writeJSONPairs(js, aProb, offset);
+  js << ", cProb: ";
+  writeJSONPairs(js, cProb, offset);
+  js << ", gProb: ";
+  writeJSONPairs(js, gProb, offset);
+  js << ", tProb: ";
+  writeJSONPairs(js, tProb, offset);
+  js << ", xProb: ";
+  writeJSONPairs(js, xProb, offset);
 }
 
-
-void emitRegion(FILE*fp, ReferenceGenome& rg, StereoFASTQReader& fastq, const string& name, unsigned int index, dnapos_t start, 
+void emitRegion(ReportWriter& js, ReferenceGenome& rg, StereoFASTQReader& fastq, const string& name, unsigned int index, dnapos_t start, 
 		dnapos_t stop, const std::string& report_="", int maxVarcount=-1)
 {
   if(stop > rg.size())
@@ -396,74 +163,61 @@ void emitRegion(FILE*fp, ReferenceGenome& rg, StereoFASTQReader& fastq, const st
   if(start > rg.size())
     start=1;
   dnapos_t dnapos = (start+stop)/2;
-  fprintf(fp, "region[%d]={reference: '%s', name:'%s', pos: %d, depth: [",  index, rg.d_name.c_str(), name.c_str(), dnapos);
+  js << "region[" << index << "]={reference: '" << rg.d_name << "', name:'" << name << "', pos: " << dnapos << ", depth: [";
   for(dnapos_t pos = start; pos < stop; ++pos) {
     if(pos != start) 
-      fprintf(fp, ",");
-    fprintf(fp, "[%d,%d]", pos, rg.d_mapping[pos].coverage);
+      js << ',';
+    js << '[' << pos << ',' << rg.d_coverage[pos] << ']';
   }
-  fprintf(fp, "], ");
+  js << "], ";
   vector<double> aProb(stop-start), cProb(stop-start), gProb(stop-start), tProb(stop-start), xProb(stop-start);
   for(dnapos_t pos = start; pos < stop; ++pos) {
-    if(rg.d_locimap.count(pos)) {
-      for(const auto& locus: rg.d_locimap[pos].samples) {
-	acgtxDo(locus.nucleotide, 
-		[&]() { aProb[pos-start]+= locus.quality/30.0; }, 
-		[&]() { cProb[pos-start]+= locus.quality/30.0; }, 
-		[&]() { gProb[pos-start]+= locus.quality/30.0; }, 
-		[&]() { tProb[pos-start]+= locus.quality/30.0; },
-		[&]() { xProb[pos-start]+= locus.quality/30.0; });
-      }
+    auto iter = rg.d_locimap.find(pos);
+    if(iter != rg.d_locimap.end()) {
+      typedef ReferenceGenome::LociStats LS;
+      aProb[pos-start] = iter->second.qualities[LS::A]/30.0;
+      cProb[pos-start] = iter->second.qualities[LS::C]/30.0;
+      gProb[pos-start] = iter->second.qualities[LS::G]/30.0;
+      tProb[pos-start] = iter->second.qualities[LS::T]/30.0;
+      xProb[pos-start] = iter->second.qualities[LS::X]/30.0;
     }
   }
   
-  fprintf(fp, "aProb: %s, cProb: %s, gProb: %s, tProb: %s, xProb: %s",
-	  jsonVectorX(aProb, [start](int i){return i+start;}).c_str(), 
-	  jsonVectorX(cProb, [start](int i){return i+start;}).c_str(), 
-	  jsonVectorX(gProb, [start](int i){return i+start;}).c_str(), 
-	  jsonVectorX(tProb, [start](int i){return i+start;}).c_str(),
-	  jsonVectorX(xProb, [start](int i){return i+start;}).c_str());
+  writeProbabilities(js, start, aProb, cProb, gProb, tProb, xProb);
 
   string picture; // =rg.getMatchingFastQs(start, stop, fastq);
-  string snippet=rg.snippet(start, dnapos) + " | " +rg.snippet(dnapos, stop);
+  auto before = rg.view(start, dnapos), after = rg.view(dnapos, stop);
   replace_all(picture, "\n", "\\n");
   string report = replace_all_copy(report_, "\n", "\\n");
 
   string annotations;
   int gene=0;
   if(rg.d_gar) {
-    auto gas=rg.d_gar->lookup(dnapos);
+    vector<const GeneAnnotation*> gas;
+    rg.d_gar->lookup(dnapos, &gas);
     for(auto ga : gas) {
-      replace_all(ga.tag, "'", "\\'");
-      annotations += ga.name+" [" + ga.tag  + "], ";
-      if(ga.gene)
+      annotations += ga->name+" [" + replace_all_copy(ga->tag, "'", "\\'")  + "], ";
+      if(ga->gene)
 	gene=1;
     }
   }
   replace_all(report, "'", "\\'");
-  fprintf(fp,"picture: '%s', snippet: '%s', maxVarcount: %d, gene: %d, annotations: '%s', report: '%s'};\n", "", snippet.c_str(), maxVarcount, gene, annotations.c_str(), report.c_str());
-  
-  fputs("\n", fp);
-  fflush(fp);
+  js << "picture: '', snippet: '" << before << " | " << after << "', maxVarcount: " << maxVarcount << ", gene: " << gene;
+  js << ", annotations: '" << annotations << "', report: '" << report << "'};\n\n";
 }
 
-void emitRegion(FILE*fp, ReferenceGenome& rg, StereoFASTQReader& fastq, const string& name, unsigned int index, dnapos_t start, const std::string& report="")
+void emitRegion(ReportWriter& js, ReferenceGenome& rg, StereoFASTQReader& fastq, const string& name, unsigned int index, dnapos_t start, const std::string& report="")
 {
-  emitRegion(fp, rg, fastq, name, index, start > 200 ? start-200 : 1, (start +200) < rg.size() ? (start + 200) : rg.size(), report);
+  emitRegion(js, rg, fastq, name, index, start > 200 ? start-200 : 1, (start +200) < rg.size() ? (start + 200) : rg.size(), report);
 }
 
 unsigned int variabilityCount(const ReferenceGenome& rg, dnapos_t position, const ReferenceGenome::LociStats& lc, double* fraction)
 {
   vector<int> counts(256);
-  counts[rg.snippet(position, position+1)[0]]+=rg.d_mapping[position].coverage;
+  counts[rg.nucleotide(position)]+=rg.d_coverage[position];
   
-  int forwardCount=0;
-
-  for(const auto& j : lc.samples) {
-    counts[j.nucleotide]++;
-    if(j.headOrTail)
-      forwardCount++;
-  }
+  for(int n = 0; n < ReferenceGenome::LociStats::Kinds; ++n)
+    counts["ACGTXN"[n]] += lc.counts[n];
   sort(counts.begin(), counts.end());
   unsigned int nonDom=0;
   for(unsigned int i=0; i < 255; ++i) {
@@ -473,7 +227,7 @@ unsigned int variabilityCount(const ReferenceGenome& rg, dnapos_t position, cons
   if(nonDom + counts[255] < 20) // depth
     return 0;
 
-  *fraction = 1.0*forwardCount / (1.0*lc.samples.size());
+  *fraction = 1.0*lc.totalHeads() / (1.0*lc.total());
   if(*fraction < 0.05 || *fraction > 0.95)
     return 0;
 
@@ -481,77 +235,6 @@ unsigned int variabilityCount(const ReferenceGenome& rg, dnapos_t position, cons
 }
 
 
-vector<ReferenceGenome::MatchDescriptor> fuzzyFind(FastQRead* fqfrag, ReferenceGenome& rg, unsigned int keylen, int qlimit)
-{
-  vector<ReferenceGenome::MatchDescriptor> ret;
-
-  string left, middle, right;
-  typedef pair<dnapos_t, char> tpos;
-  vector<dnapos_t> lpositions, mpositions, rpositions;
-
-  if(fqfrag->d_nucleotides.length() < 3*keylen) // too short
-    return ret;
-
-  unsigned int interval=(fqfrag->d_nucleotides.length() - 3*keylen)/3;
-
-  for(unsigned int attempts=0; attempts < interval; attempts += 3) {
-    for(int tries = 0; tries < 2; ++tries) {
-      if(tries)
-	fqfrag->reverse();
-      left=fqfrag->d_nucleotides.substr(attempts, keylen);   
-      middle=fqfrag->d_nucleotides.substr(interval+attempts, keylen); 
-      right=fqfrag->d_nucleotides.substr(2*interval+attempts, keylen);
-      lpositions=rg.getReadPositions(left); 
-
-      if(lpositions.empty())
-	continue;
-      mpositions=rg.getReadPositions(middle); 
-      if(mpositions.empty())
-	continue;
-      rpositions=rg.getReadPositions(right);
-      
-      if(lpositions.size() + mpositions.size() + rpositions.size() < 3)
-	continue;
-      vector<tpos> together;
-      for(auto fpos: lpositions) { together.push_back(make_pair(fpos, 'L')); }        
-      for(auto fpos: mpositions) { together.push_back(make_pair(fpos, 'M')); }
-      for(auto fpos: rpositions) { together.push_back(make_pair(fpos, 'R')); }
-      
-      sort(together.begin(), together.end());
-      
-      auto matches=getTriplets(together, interval, attempts);
-      //	random_shuffle(matches.begin(), matches.end()); // should prevent pileup because if 'score==0' shortcut below
-      int score;
-      for(auto match : matches) {
-	if(std::find_if(ret.begin(), ret.end(), 
-			[&match](const ReferenceGenome::MatchDescriptor& md){ return md.pos==match;}) != ret.end())
-	  continue;
-	
-	score = diffScore(rg, match, *fqfrag, qlimit);
-        
-	ret.push_back({&rg, match, fqfrag->reversed, score});
-	if(score==0) // won't get any better than this
-	  return ret;
-      }
-    }
-  }
-  return ret;
-}
-
-vector<ReferenceGenome::MatchDescriptor> fuzzyFind(FastQRead* fqfrag, vector<unique_ptr<ReferenceGenome> >& refs, int keylen, int qlimit)
-{
-  vector<ReferenceGenome::MatchDescriptor> ret;
-  for(auto& rg : refs) {
-    auto inter = fuzzyFind(fqfrag, *rg, keylen, qlimit);
-    for(auto& i : inter)
-      ret.push_back(i); // XXX must be a better way
-  }
-  return ret;
-}
-
-
-typedef vector<VarMeanEstimator> qstats_t;
-
 void writeUnmatchedReads(const vector<uint64_t>& unfoundReads, StereoFASTQReader& fastq)
 {
   FILE *fp=fopen("unfound.fastq", "w");
@@ -573,33 +256,34 @@ struct ClusterLocus
   }
 };
 
-string makeAminoReport(ReferenceGenome& rg, dnapos_t pos, const vector<GeneAnnotation>& gas, 
+string makeAminoReport(ReferenceGenome& rg, dnapos_t pos, const vector<const GeneAnnotation*>& gas, 
 		       const ReferenceGenome::LociStats& locistat, string* headline, string* body)
 { 
   string origCodon{"XXX"}, newCodon;
-  string gene;
+  unsigned int geneLength=0;
   int nucOffset=0;
   bool orfSense=0;
   int aminoNum=0;
   string fmt2("                  ");
 
   int aCount{0}, cCount{0}, gCount{0}, tCount{0};
-  char c=rg.snippet(pos, pos+1)[0];
+  char c=rg.nucleotide(pos);
   acgtDo(c, 
-	 [&](){aCount += rg.d_mapping[pos].coverage;},
-	 [&](){cCount += rg.d_mapping[pos].coverage;},
-	 [&](){gCount += rg.d_mapping[pos].coverage;},
-	 [&](){tCount += rg.d_mapping[pos].coverage;}
+	 [&](){aCount += rg.d_coverage[pos];},
+	 [&](){cCount += rg.d_coverage[pos];},
+	 [&](){gCount += rg.d_coverage[pos];},
+	 [&](){tCount += rg.d_coverage[pos];}
 	 );
   
-  for(auto j = locistat.samples.begin(); 
-      j != locistat.samples.end(); ++j) {
-    c=j->nucleotide;
-    acgtDo(c, [&](){ aCount++; }, [&](){ cCount++; }, [&](){ gCount++; }, [&](){ tCount++; } );
-  }
-  for(const auto& ga : gas) {
+  aCount += locistat.counts[locistat.A];
+  cCount += locistat.counts[locistat.C];
+  gCount += locistat.counts[locistat.G];
+  tCount += locistat.counts[locistat.T];
+  for(auto annotation : gas) {
+    const auto& ga = *annotation;
     if(ga.gene) {
-      gene = rg.snippet(ga.startPos, ga.stopPos+1);
+      auto gene = rg.view(ga.startPos, ga.stopPos+1);
+      geneLength = gene.size();
       orfSense = ga.strand;
       if(ga.strand) {
 	aminoNum = (pos - ga.startPos) / 3;
@@ -608,14 +292,19 @@ string makeAminoReport(ReferenceGenome& rg, dnapos_t pos, const vector<GeneAnnot
       else {
 	aminoNum = (ga.stopPos - pos) / 3;
 	nucOffset = (ga.stopPos - pos) % 3;
-	reverseNucleotides(&gene);
       }
-      if((unsigned int)(aminoNum*3 + 3) < gene.size())
-	origCodon = gene.substr(aminoNum*3, 3);
+      if((unsigned int)(aminoNum*3 + 3) < gene.size()) {
+	if(ga.strand)
+	  origCodon.assign(gene.data() + aminoNum*3, 3);
+	else { // the codon as the reverse complement of the gene has it
+	  origCodon.assign(gene.data() + gene.size() - aminoNum*3 - 3, 3);
+	  reverseNucleotides(&origCodon);
+	}
+      }
     }
   }
   ostringstream ret;
-  string residueString = lexical_cast<string>(1+aminoNum) + '/'+lexical_cast<string>(gene.size()/3);
+  string residueString = lexical_cast<string>(1+aminoNum) + '/'+lexical_cast<string>(geneLength/3);
   ret<<"Original codon: "<<origCodon<<", amino acid: "<<AminoAcidName(DNAToAminoAcid(origCodon.c_str()))<<", Residue "<<residueString<<", offset in codon "<<nucOffset<<", strand "<<(orfSense ? '+' : '-');
   if(headline)
     *headline=ret.str();
@@ -652,7 +341,7 @@ string makeAminoReport(ReferenceGenome& rg, dnapos_t pos, const vector<GeneAnnot
   return ret2.str();
 }
 
-string makeReport(ReferenceGenome& rg, dnapos_t pos, ReferenceGenome::LociStats locistat, double fraction, string* summary=0)
+string makeReport(ReferenceGenome& rg, dnapos_t pos, const ReferenceGenome::LociStats& locistat, double fraction, string* summary=0)
 {
   ostringstream report;
   if(summary)
@@ -661,42 +350,33 @@ string makeReport(ReferenceGenome& rg, dnapos_t pos, ReferenceGenome::LociStats
   string fmt2("                  ");
   int aCount, cCount, tCount, gCount, xCount;
 
-  vector<GeneAnnotation> gas;
+  vector<const GeneAnnotation*> gas;
   if(rg.d_gar)
-    gas= rg.d_gar->lookup(pos);
+    rg.d_gar->lookup(pos, &gas);
 
-  char c=rg.snippet(pos, pos+1)[0];
+  char c=rg.nucleotide(pos);
   aCount = cCount = tCount = gCount = xCount = 0;
   
   acgtxDo(c, 
-	 [&](){aCount += rg.d_mapping[pos].coverage;},
-	 [&](){cCount += rg.d_mapping[pos].coverage;},
-	 [&](){gCount += rg.d_mapping[pos].coverage;},
-	  [&](){tCount += rg.d_mapping[pos].coverage;},
-	  [&](){xCount += rg.d_mapping[pos].coverage;}
+	 [&](){aCount += rg.d_coverage[pos];},
+	 [&](){cCount += rg.d_coverage[pos];},
+	 [&](){gCount += rg.d_coverage[pos];},
+	  [&](){tCount += rg.d_coverage[pos];},
+	  [&](){xCount += rg.d_coverage[pos];}
 	 );
 
-  char orig = rg.snippet(pos, pos+1)[0];
-  report << (fmt1 % pos % rg.d_mapping[pos].coverage % orig ).str();
-  sort(locistat.samples.begin(), locistat.samples.end());
-  for(auto j = locistat.samples.begin(); 
-      j != locistat.samples.end(); ++j) {
-    c=j->nucleotide;
-    acgtxDo(c, [&](){ aCount++; }, [&](){ cCount++; }, [&](){ gCount++; }, [&](){ tCount++; }, [&](){ xCount++; }  );    
-    report<<c;
-  }
-  report<<endl<<fmt2;
-  for(auto j = locistat.samples.begin(); 
-      j != locistat.samples.end(); ++j) {
-    report<<((char)(j->quality+33));
-  }
-  report << endl << fmt2;
-  for(auto j = locistat.samples.begin(); 
-      j != locistat.samples.end(); ++j) {
-    report << (j->headOrTail ? 'H' : '.');
+  char orig = rg.nucleotide(pos);
+  report << (fmt1 % pos % rg.d_coverage[pos] % orig ).str();
+  // per kind of difference: how many, their mean quality, and how many came from the head of a read
+  for(int n = 0; n < locistat.Kinds; ++n) {
+    if(!locistat.counts[n])
+      continue;
+    c="ACGTXN"[n];
+    acgtxDo(c, [&](){ aCount+=locistat.counts[n]; }, [&](){ cCount+=locistat.counts[n]; }, [&](){ gCount+=locistat.counts[n]; }, 
+	    [&](){ tCount+=locistat.counts[n]; }, [&](){ xCount+=locistat.counts[n]; }  );
+    report<<c<<": "<<locistat.counts[n]<<" (Q"<<locistat.qualities[n]/locistat.counts[n]<<", "<<locistat.heads[n]<<"H) ";
   }
-
-  int tot=locistat.samples.size() + rg.d_mapping[pos].coverage;
+  int tot=locistat.total() + rg.d_coverage[pos];
   report<<endl;
   string aminoHeadline, aminoBody;
   if(!gas.empty())
@@ -705,12 +385,12 @@ string makeReport(ReferenceGenome& rg, dnapos_t pos, ReferenceGenome::LociStats
 
   if(!gas.empty()) {
     report << fmt2 << "Annotation: ";
-    for(auto& ga : gas) {
-      report << ga.name<<" ["<<ga.tag<<"], ";
+    for(auto ga : gas) {
+      report << ga->name<<" ["<<ga->tag<<"], ";
     }
     report << endl;
   }
-  report << fmt2<< "Fraction tail: "<<fraction<<", "<< locistat.samples.size()<<endl;
+  report << fmt2<< "Fraction tail: "<<fraction<<", "<< locistat.total()<<endl;
   report << fmt2<< "A: " << aCount*100/tot <<"%, C: "<<cCount*100/tot<<"%, G: "<<gCount*100/tot<<"%, T: "<<tCount*100/tot<<"%"<<", X: "<<xCount*100/tot<<"%"<<endl;
 
   if(!aminoBody.empty())
@@ -720,20 +400,20 @@ string makeReport(ReferenceGenome& rg, dnapos_t pos, ReferenceGenome::LociStats
   return report.str();
 }
 
-void printQualities(FILE* jsfp, const qstats_t& qstats)
+void printQualities(ReportWriter& js, const qstats_t& qstats)
 {
   int i=0;
 
-  fprintf(jsfp, "qualities=[");
+  js << "qualities=[";
   for(const auto& q : qstats) {
     if(i)
-      fputs(",", jsfp);
+      js << ',';
     if(q.valid()) {
-      fprintf(jsfp, "[%d, %f]", i, -10.0*log10(mean(q)));
+      js << '[' << i << ", " << fixed(-10.0*log10(mean(q))) << ']';
       ++i;
     }
   }
-  fputs("];\n", jsfp);
+  js << "];\n";
 
   vector<double> qlo, qhi;
   for(const auto& q : qstats) {
@@ -743,86 +423,71 @@ void printQualities(FILE* jsfp, const qstats_t& qstats)
     }
   }
 
-  fprintf(jsfp, "var qlo=%s;\nvar qhi=%s;\n", jsonVectorD(qlo).c_str(), jsonVectorD(qhi).c_str());
-
-  fflush(jsfp);
+  auto writeBound = [&js](const char* name, const vector<double>& bound) {
+    js << "var " << name << "=[";
+    for(unsigned int n = 0; n < bound.size(); ++n)
+      js << (n ? "," : "") << '[' << fixed(n) << ',' << bound[n] << ']';
+    js << "];\n";
+  };
+  writeBound("qlo", qlo);
+  writeBound("qhi", qhi);
+  js.flush();
 }
 
-vector<ReferenceGenome::MatchDescriptor> getAllReadPosBoth(vector<unique_ptr<ReferenceGenome> >& refs, const vector<unsigned int>& indexLengths, FastQRead* fqfrag) 
+void emitLociAndCluster(ReportWriter& js, ReferenceGenome* rg, int numRef, 
+			Clusterer<ClusterLocus>& vcl, bool compress)
 {
-  vector<ReferenceGenome::MatchDescriptor> ret;
-  auto iter = indexLengths.begin();
-  for(; iter != indexLengths.end(); ++iter)
-    if(*iter == fqfrag->d_nucleotides.length())
-      break;
-  if(iter == indexLengths.end())
-    return ret;
-
-  for(auto& rg : refs) {
-    auto inter = rg->getAllReadPosBoth(fqfrag);
-    for(auto& i : inter) 
-      ret.push_back(i); // XXX must be better way, back_inserter?
-  }
-  return ret;
-}
-
-void emitLociAndCluster(FILE* jsfp, ReferenceGenome* rg, int numRef, 
-			Clusterer<ClusterLocus>& vcl)
-{
-  ofstream ofs("loci."+lexical_cast<string>(numRef));
-  ofs<<"locus\tnumdiff\tdepth\tA\tAq\tC\tCq\tG\tGq\tT\tTq\tdels\ttotQ\tfracHead"<<endl;
+  ReportWriter ofs("loci."+lexical_cast<string>(numRef), compress);
+  ofs<<"locus\tnumdiff\tdepth\tA\tAq\tC\tCq\tG\tGq\tT\tTq\tdels\ttotQ\tfracHead\n";
   map<dnapos_t, ReferenceGenome::LociStats> slocimap;
 
-  FILE* locifp=fopen(("loci."+lexical_cast<string>(numRef)+".js").c_str(), "w");
+  ReportWriter locijs("loci."+lexical_cast<string>(numRef)+".js", compress);
+  ReportWriter record; // formatted once, then written to js and locijs
     
   for(auto& p : rg->d_locimap) {
     slocimap.insert(p);
   }
 
 
-  fprintf(jsfp, "genomes[%d].loci=[", numRef);
-  fprintf(locifp, "loci[\"%s\"]=[", g_name.c_str());
+  js << "genomes[" << numRef << "].loci=[";
+  locijs << "loci[\"" << g_name << "\"]=[";
 
   bool emitted=false;
   for(auto& p : slocimap) {
-    if(p.second.samples.size()==1) // no variability if only 2
+    if(p.second.total()==1) // no variability if only 2
       continue;
     
-    int aCount=0, cCount=0, gCount=0, tCount=0, xCount=0;
-    int aQual=0, cQual=0, gQual=0, tQual=0;
-    int head=0;
-    map<string, int> insertCounts;
-    for(const auto& c: p.second.samples) {
-      acgtxDo(c.nucleotide, 
-	      [&](){ aCount++; aQual+=c.quality;}, 
-	      [&](){ cCount++; cQual+=c.quality;}, 
-	      [&](){ gCount++; gQual+=c.quality;}, 
-	      [&](){ tCount++; tQual+=c.quality;},
-	      [&](){ xCount++; });
-      if(c.headOrTail)
-	head++;
-      if(!c.insert.empty())
-	insertCounts[c.insert]++;
-    }
+    const auto& ls = p.second;
+    int aCount=ls.counts[ls.A], cCount=ls.counts[ls.C], gCount=ls.counts[ls.G], tCount=ls.counts[ls.T], xCount=ls.counts[ls.X];
+    int aQual=ls.qualities[ls.A], cQual=ls.qualities[ls.C], gQual=ls.qualities[ls.G], tQual=ls.qualities[ls.T];
     
     if(aQual < 90 && cQual < 90 && gQual < 90 && tQual < 90 && xCount < 3)
       continue;
     
+    map<string, int> insertCounts;
+    for(const auto& ic : ls.inserts)
+      if(ic.count)
+	insertCounts[rg->d_inserts[ic.id]] = ic.count;
     string insertReport;
     for(const auto& i : insertCounts) {
       if(!insertReport.empty())
 	insertReport+=", ";
       insertReport += i.first+": "+lexical_cast<string>(i.second);
     }
+    if(ls.otherInserts) {
+      if(!insertReport.empty())
+	insertReport+=", ";
+      insertReport += "other: "+lexical_cast<string>(ls.otherInserts);
+    }
 
-    double fraction =(1.0*head/p.second.samples.size());
+    double fraction =(1.0*ls.totalHeads()/ls.total());
     if(fraction < 0.1 || fraction > 0.9)
       continue;
     
     vcl.feed(ClusterLocus{p.first, p.second});
 
     string summary;
-    char orig = rg->snippet(p.first, p.first+1)[0];
+    char orig = rg->nucleotide(p.first);
     if(aCount && orig!='A') {
       summary.append(1, orig);
       summary.append(">A");
@@ -853,7 +518,7 @@ void emitLociAndCluster(FILE* jsfp, ReferenceGenome* rg, int numRef,
     }
   
 
-    ofs<<p.first<<"\t"<<p.second.samples.size()<<"\t"<<rg->d_mapping[p.first].coverage<<"\t";
+    ofs<<p.first<<"\t"<<p.second.total()<<"\t"<<rg->d_coverage[p.first]<<"\t";
     ofs<<aCount<<"\t"<<aQual<<"\t";
     ofs<<cCount<<"\t"<<cQual<<"\t";
     ofs<<gCount<<"\t"<<gQual<<"\t";
@@ -865,12 +530,13 @@ void emitLociAndCluster(FILE* jsfp, ReferenceGenome* rg, int numRef,
     bool gene=false;
     string aminoReport;
     if(rg->d_gar) {
-      auto gas = rg->d_gar->lookup(p.first);
+      vector<const GeneAnnotation*> gas;
+      rg->d_gar->lookup(p.first, &gas);
       for(auto ga : gas) {
-        replace_all(ga.tag, "\n", "\\n");
-        replace_all(ga.tag, "'", "\\'");
-	annotation+=ga.name +"\t[" + ga.tag + "]\t";
-	if(ga.gene)
+        string tag = replace_all_copy(ga->tag, "\n", "\\n");
+        replace_all(tag, "'", "\\'");
+	annotation+=ga->name +"\t[" + tag + "]\t";
+	if(ga->gene)
 	  gene=1;
 
       }
@@ -880,140 +546,186 @@ void emitLociAndCluster(FILE* jsfp, ReferenceGenome* rg, int numRef,
 	trim_left(aminoReport);
       }
     }
-    ofs<<annotation<<"\t"<<aminoReport<<endl;
+    ofs<<annotation<<"\t"<<aminoReport<<'\n';
 
     if(emitted) {
-      fprintf(jsfp,",\n");
-      fprintf(locifp, ",\n");
+      js << ",\n";
+      locijs << ",\n";
     }
 
-    string graph;
-
-    dnapos_t start = p.first-100, stop = min(p.first+100, (dnapos_t)rg->d_mapping.size());
+    dnapos_t start = p.first-100, stop = min(p.first+100, (dnapos_t)rg->d_coverage.size());
     vector<double> aProb(stop-start), cProb(stop-start), gProb(stop-start), tProb(stop-start), xProb(stop-start);
 
+    record << " { locus: " << p.first << ", numDiff: " << p.second.total() << ", originalBase: '?', depth: " << rg->d_coverage[p.first] << ", ";
+    record << "aCount: " << aCount << ", aQual: " << aQual << ", ";
+    record << "cCount: " << cCount << ", cQual: " << cQual << ", ";
+    record << "gCount: " << gCount << ", gQual: " << gQual << ", ";
+    record << "tCount: " << tCount << ", tQual: " << tQual << ", ";
+    record << "totQual: " << aQual+cQual+gQual+tQual << ", ";
+    record << "xCount: " << xCount << ", ";
+    record << "fraction: " << fixed(fraction) << ", gene: " << (int)gene << ", annotation: '" << annotation << "', aminoReport: '" << aminoReport;
+    record << "', insertReport: '" << insertReport << "', summary: '" << summary << "', graph: [";
+
     for(dnapos_t pos = start; pos < stop; ++pos) {
-      if(!graph.empty()) 
-	graph+=",";
-      graph+="["+to_string(pos)+","+to_string(rg->d_mapping[pos].coverage)+"]";
-
-      if(rg->d_locimap.count(pos)) {
-	for(const auto& locus: rg->d_locimap[pos].samples) {
-	  acgtxDo(locus.nucleotide, 
-		  [&]() { aProb[pos-start]+= locus.quality/30.0; }, 
-		  [&]() { cProb[pos-start]+= locus.quality/30.0; }, 
-		  [&]() { gProb[pos-start]+= locus.quality/30.0; }, 
-		  [&]() { tProb[pos-start]+= locus.quality/30.0; },
-		  [&]() { xProb[pos-start]+= locus.quality/30.0; });
-	}
+      if(pos != start) 
+	record << ',';
+      record << '[' << pos << ',' << rg->d_coverage[pos] << ']';
+
+      auto iter = rg->d_locimap.find(pos);
+      if(iter != rg->d_locimap.end()) {
+	typedef ReferenceGenome::LociStats LS;
+	aProb[pos-start] = iter->second.qualities[LS::A]/30.0;
+	cProb[pos-start] = iter->second.qualities[LS::C]/30.0;
+	gProb[pos-start] = iter->second.qualities[LS::G]/30.0;
+	tProb[pos-start] = iter->second.qualities[LS::T]/30.0;
+	xProb[pos-start] = iter->second.qualities[LS::X]/30.0;
       }
     }
 
 
-    for(int n=0; n < 2; ++n) {
-      fprintf(n ? jsfp : locifp, " { locus: %d, numDiff: %d, originalBase: '%c', depth: %d, "
-	      "aCount: %d, aQual: %d, "
-	      "cCount: %d, cQual: %d, "
-	      "gCount: %d, gQual: %d, "
-	      "tCount: %d, tQual: %d, "
-	      "totQual: %d, "
-	      "xCount: %d, "
-	      "fraction: %f, gene: %d, annotation: '%s', aminoReport: '%s', insertReport: '%s', summary: '%s', graph: [%s], aProb: %s, cProb: %s, gProb: %s, tProb: %s, xProb: %s}", 
-	      p.first, (int)p.second.samples.size(), '?', rg->d_mapping[p.first].coverage, 
-	      aCount, aQual, cCount, cQual, gCount, gQual, tCount, tQual, 
-	      aQual+cQual+gQual+tQual,
-	      xCount, fraction, gene, annotation.c_str(), aminoReport.c_str(), insertReport.c_str(), summary.c_str(), graph.c_str(),
-	      jsonVectorX(aProb, [start](int i){return i+start;}).c_str(), 
-	      jsonVectorX(cProb, [start](int i){return i+start;}).c_str(), 
-	      jsonVectorX(gProb, [start](int i){return i+start;}).c_str(), 
-	      jsonVectorX(tProb, [start](int i){return i+start;}).c_str(),
-	      jsonVectorX(xProb, [start](int i){return i+start;}).c_str());
-    }
+    record << "], ";
+    writeProbabilities(record, start, aProb, cProb, gProb, tProb, xProb);
+    record << '}';
+    js << record.str();
+    locijs << record.str();
+    record.clear();
     emitted=true;
   }
-  fprintf(jsfp, "];\n");
-  fprintf(locifp, "];\n");
-  fclose(locifp);
-  ofs.flush();
+  js << "];\n";
+  locijs << "];\n";
+  locijs.close();
+  ofs.close();
 }
 
 template<typename T>
-void safeIncVec(vector<T>& vec, unsigned int offset) 
+void safeIncVec(vector<T>& vec, unsigned int offset, unsigned int amount=1) 
 {
   if(offset >= vec.size())
     vec.resize(offset+1);
-  vec[offset]++;
+  vec[offset]+=amount;
 }
 
-bool g_pleaseQuit;
+std::atomic<bool> g_pleaseQuit(false);
 void pleaseQuitHandler(int)
 {
   g_pleaseQuit=true;
 }
 
 
-void doInitialReadStatistics(FILE* jsfp, const string& fname, StereoFASTQReader& fastq, vector<unsigned int>* recommendIndex, unsigned int* maxreadlen, unsigned int *recommendBeginSnip=0, unsigned int* recommendEndSnip=0)
+//! adds the distances of the pairs in batch whose reads are each found in exactly one place, on one contig, to ism
+static void learnInsertSizes(const ReferencePanel& panel, const PairBatch& batch, InsertSizeModel* ism)
 {
-  FastQRead fqfrag1, fqfrag2;
-  vector<uint32_t> lengths;
+  FastQRead fqfrag[2];
+  vector<ReferenceGenome::MatchDescriptor> found;
+  vector<dnapos_t> positions;
+  for(size_t i = 0; i < batch.reads[0].size(); ++i) {
+    if(batch.dup[0][i] || batch.dup[1][i])
+      continue;
+    for(unsigned int paircount = 0; paircount < 2; ++paircount)
+      batch.reads[paircount][i].copyTo(&fqfrag[paircount]);
+    int64_t distance = exactPairDistance(panel, &fqfrag[0], &fqfrag[1], &found, &positions);
+    if(distance >= 0)
+      ism->add(distance);
+  }
+}
 
-  vector<vector<uint32_t>> kmerMappings(1024);
-  vector<uint32_t> gcMappings(1024), taMappings(1024);
-  
-  for(auto& kmers : kmerMappings) 
-    kmers.resize(256); // 4^4, corresponds to the '4' below
-  
-  (*g_log)<<"Scanning FASTQ input to determine trim optima and indexation parameters"<<endl;
-  uint64_t totalReads=0;
+/** Per cycle statistics on the nucleotides in reads, from which we recommend index lengths and a begin trim.
+    Reads longer than the statistics go are only partially counted */
+class ReadStatistics
+{
+public:
+  ReadStatistics() : d_totalReads(0), d_kmerMappings(1024), d_gcMappings(1024), d_taMappings(1024)
+  {
+    for(auto& kmers : d_kmerMappings) 
+      kmers.resize(256); // 4^4, corresponds to the '4' below
+  }
+  //! cycleOffset says how much got trimmed from the start of this read
+  void feed(const char* nucleotides, unsigned int len, unsigned int cycleOffset=0);
+  //! copies the statistics of the first cycles over from rhs, for when these got trimmed off our reads
+  void fillCycles(const ReadStatistics& rhs, unsigned int cycles);
+  unsigned int maxReadLength() const
+  {
+    return d_lengths.empty() ? 0 : d_lengths.size() - 1;
+  }
+  vector<unsigned int> recommendIndex() const;
+  //! 0 if there is nothing to trim
+  unsigned int recommendBeginSnip() const;
+  void writeJS(ReportWriter& js) const;
+
+  uint64_t d_totalReads;
+private:
+  vector<double> gcRatios(VarMeanEstimator* ratest) const;
+
+  vector<uint32_t> d_lengths;
+  vector<vector<uint32_t>> d_kmerMappings;
+  vector<uint32_t> d_gcMappings, d_taMappings;
+};
 
-  boost::progress_display show_progress(filesize(fname.c_str()), cerr);
-  unsigned int bytes;
-  unsigned int counter=0;
-  while((bytes=fastq.getReadPair(&fqfrag1, &fqfrag2))) {
-    show_progress+=bytes;
-    if((++counter%11)) 
-      continue;
-    safeIncVec(lengths, fqfrag1.d_nucleotides.length());
-    safeIncVec(lengths, fqfrag2.d_nucleotides.length());
-    totalReads+=2;
-
-    for(int n=0; n < 2; ++n) {
-      FastQRead* fqfrag = n ? &fqfrag1 : &fqfrag2;
-      for(string::size_type i = 0 ; i < fqfrag->d_nucleotides.size(); ++i) {
-	if(fqfrag->d_nucleotides.size() - i > 4)
-	  kmerMappings[i][kmerMapper(fqfrag->d_nucleotides, i, 4)]++;
-
-	char c = fqfrag->d_nucleotides[i];
-	if(c=='G' || c=='C')
-	  gcMappings[i]++;  
-	else
-	  taMappings[i]++;
-      }
-    }
+void ReadStatistics::feed(const char* nucleotides, unsigned int len, unsigned int cycleOffset)
+{
+  safeIncVec(d_lengths, len + cycleOffset);
+  d_totalReads++;
+  for(unsigned int i = 0 ; i < len && i + cycleOffset < d_gcMappings.size(); ++i) {
+    if(len - i > 4)
+      d_kmerMappings[i + cycleOffset][kmerMapper(nucleotides + i, 4)]++;
+
+    char c = nucleotides[i];
+    if(c=='G' || c=='C')
+      d_gcMappings[i + cycleOffset]++;  
+    else
+      d_taMappings[i + cycleOffset]++;
   }
+}
 
-  multimap<uint32_t, uint32_t> lenstats;
-  *maxreadlen=0;
-  for(auto iter = lengths.cbegin(); iter != lengths.cend(); ++iter) {
-    lenstats.insert(make_pair(*iter, iter - lengths.cbegin())); // amount, length
-    *maxreadlen = max(*maxreadlen, (unsigned int)(iter - lengths.cbegin()));
+void ReadStatistics::fillCycles(const ReadStatistics& rhs, unsigned int cycles)
+{
+  for(unsigned int i = 0; i < cycles && i < d_gcMappings.size(); ++i) {
+    d_kmerMappings[i] = rhs.d_kmerMappings[i];
+    d_gcMappings[i] = rhs.d_gcMappings[i];
+    d_taMappings[i] = rhs.d_taMappings[i];
   }
+}
+
+vector<unsigned int> ReadStatistics::recommendIndex() const
+{
+  vector<unsigned int> ret;
+  multimap<uint32_t, uint32_t> lenstats;
+  for(auto iter = d_lengths.cbegin(); iter != d_lengths.cend(); ++iter) 
+    lenstats.insert(make_pair(*iter, iter - d_lengths.cbegin())); // amount, length
 
   uint64_t cumul=0;
   int num=0;
   for(auto iter = lenstats.crbegin(); iter != lenstats.crend() && num < 3; ++iter, ++num) {
     cumul+=iter->first;
-    (*g_log) << cumul*100.0/totalReads<<"% covered after indexing "<<iter->second<<endl;
-    recommendIndex->push_back(iter->second);
-    if(cumul > 0.99*totalReads)
+    (*g_log) << cumul*100.0/d_totalReads<<"% covered after indexing "<<iter->second<<endl;
+    ret.push_back(iter->second);
+    if(cumul > 0.99*d_totalReads)
       break;
   }
-  fastq.seek(0);
+  return ret;
+}
 
-  fprintf(jsfp, "var kmerstats=[");
+vector<double> ReadStatistics::gcRatios(VarMeanEstimator* ratest) const
+{
+  vector<double> ratios;
+  unsigned int maxreadlen = maxReadLength();
+  for(unsigned int i=0; i < maxreadlen ;++i) {
+    double total=0.001+d_gcMappings[i] + d_taMappings[i];
+    double ratio= d_gcMappings[i]/total;
+    
+    ratios.push_back(ratio);
+    if(i > 0.1 * maxreadlen && i < 0.9 * maxreadlen)
+      (*ratest)(ratio);
+  }
+  return ratios;
+}
+
+void ReadStatistics::writeJS(ReportWriter& js) const
+{
+  js << "var kmerstats=[";
   unsigned int readOffset=0;
-  for(const auto& kmer : kmerMappings) {
-    if(readOffset >= kmerMappings.size() - 4)
+  for(const auto& kmer : d_kmerMappings) {
+    if(readOffset >= d_kmerMappings.size() - 4)
       break;
     
     VarMeanEstimator acc;
@@ -1021,28 +733,25 @@ void doInitialReadStatistics(FILE* jsfp, const string& fname, StereoFASTQReader&
       acc(count);
     }
     if(mean(acc)!=0)
-      fprintf(jsfp, "%s[%d, %f]", readOffset ? "," : "", readOffset, sqrt(variance(acc)) / mean(acc) );
+      js << (readOffset ? "," : "") << '[' << readOffset << ", " << fixed(sqrt(variance(acc)) / mean(acc)) << ']';
     readOffset++;
   }
-  fprintf(jsfp, "];\n");
+  js << "];\n";
   
-  vector<double> ratios;
   VarMeanEstimator ratest;
-  fprintf(jsfp, "var gcRatios=[");
-  for(unsigned int i=0; i < *maxreadlen ;++i) {
-    double total=0.001+gcMappings[i] + taMappings[i];
-    double ratio= gcMappings[i]/total;
+  auto ratios = gcRatios(&ratest);
+  js << "var gcRatios=[";
+  for(unsigned int i=0; i < ratios.size() ;++i) 
+    js << (i ? "," : "") << '[' << i << ',' << fixed(ratios[i], 2) << ']';
+  js << "];\n";
 
-    fprintf(jsfp, "%s[%d,%.2f]", i ? "," : "", i, ratio);
-    
-    ratios.push_back(ratio);
-    if(i > 0.1 * *maxreadlen && i < 0.9 * *maxreadlen)
-      ratest(ratio);
-  }
-  fprintf(jsfp,"];\n");
-
-  fflush(jsfp);
+  js.flush();
+}
 
+unsigned int ReadStatistics::recommendBeginSnip() const
+{
+  VarMeanEstimator ratest;
+  auto ratios = gcRatios(&ratest);
   //  cout<<"Variance: "<<sqrt(variance(ratest))<<endl;
   // so where do we put the cut..
   for(unsigned int n=0; n < ratios.size(); ++n) {
@@ -1056,15 +765,39 @@ void doInitialReadStatistics(FILE* jsfp, const string& fname, StereoFASTQReader&
     }
     if(!j) {
       (*g_log)<<"Put the begin trim at: "<<n+1<<endl;
-      if(recommendBeginSnip) {
-	*recommendBeginSnip=n+1;
-	for(auto& i: *recommendIndex)
-	  i-=*recommendBeginSnip;
-	*maxreadlen-=*recommendBeginSnip;
-      }
+      return n+1;
+    }
+  }
+  return 0;
+}
+
+/** Feeds read pairs to stats, afterwards seeks back to the beginning. With maxPairs 0, samples every 11th pair of
+    the whole input, otherwise every one of the first maxPairs pairs */
+void doInitialReadStatistics(ReadStatistics* stats, const string& fname, StereoFASTQReader& fastq, uint64_t maxPairs)
+{
+  if(maxPairs)
+    (*g_log)<<"Sampling the first "<<maxPairs<<" read pairs of the FASTQ input to determine trim optima and indexation parameters"<<endl;
+  else
+    (*g_log)<<"Scanning FASTQ input to determine trim optima and indexation parameters"<<endl;
+
+  boost::progress_display show_progress(filesize(fname.c_str()), cerr);
+  ReadBatch rb1, rb2;
+  uint64_t counter=0;
+  while(!maxPairs || counter < maxPairs) {
+    unsigned int num = fastq.getReadPairs(&rb1, &rb2, maxPairs ? min<uint64_t>(1024, maxPairs - counter) : 1024);
+    if(!num)
       break;
+    show_progress+=rb1.bytes();
+    for(unsigned int i = 0; i < num; ++i) {
+      if(!maxPairs && (++counter%11)) 
+	continue;
+      if(maxPairs)
+	++counter;
+      stats->feed(rb1[i].nucleotides, rb1[i].len);
+      stats->feed(rb2[i].nucleotides, rb2[i].len);
     }
   }
+  fastq.seek(0);
 }
 
 
@@ -1095,6 +828,11 @@ try
   TCLAP::SwitchArg skipVariableSwitch("","skip-variable","Do not emit variable regions", cmd, false);
   TCLAP::SwitchArg skipInsertsSwitch("","skip-inserts","Do not emit inserts", cmd, false);
   TCLAP::SwitchArg excludePhiXSwitch("p","exclude-phix","Exclude PhiX automatically",cmd, false);
+  TCLAP::ValueArg<int> threadsArg("t","threads","Number of threads to map reads with",false, 1,"threads", cmd);
+  TCLAP::SwitchArg singlePassSwitch("","single-pass","Read the FASTQ input only once, basing trim and index choices on its first pairs",cmd, false);
+  TCLAP::ValueArg<int> samplePairsArg("","sample-pairs","Number of read pairs to base trim and index choices on with --single-pass",false, 100000,"pairs", cmd);
+  TCLAP::SwitchArg compressReportSwitch("","compress-report","Write data.js and the loci files gzip compressed, with a .gz suffix",cmd, false);
+  TCLAP::ValueArg<uint32_t> seedArg("","seed","Seed for choosing between equally good mappings, defaults to the current time",false, 0,"seed", cmd);
 
   cmd.parse( argc, argv );
 
@@ -1131,22 +869,29 @@ try
   StereoFASTQReader fastq(fastq1Arg.getValue(), fastq2Arg.getValue(), qualityOffsetArg.getValue());
 
   (*g_log)<<"FASTQ Input from '"<<fastq1Arg.getValue()<<"' and '"<<fastq2Arg.getValue()<<"'"<<endl;
-  unique_ptr<FILE, int(*)(FILE*)> jsfp(fopen("data.js","w"), fclose);
+  bool compressReport = compressReportSwitch.getValue();
+  ReportWriter js("data.js", compressReport);
   vector<unsigned int> indexLengths;
   unsigned int maxreadsize=0;
   unsigned int beginTrim=beginSnipArg.getValue(), endTrim= endSnipArg.getValue();
-  doInitialReadStatistics(jsfp.get(), fastq1Arg.getValue(), fastq, &indexLengths, &maxreadsize, beginTrim ? 0 :&beginTrim, endTrim ? 0 : &endTrim);
+  bool singlePass = singlePassSwitch.getValue();
+  ReadStatistics sampleStats;
+  doInitialReadStatistics(&sampleStats, fastq1Arg.getValue(), fastq, singlePass ? max(1, samplePairsArg.getValue()) : 0);
+  maxreadsize = sampleStats.maxReadLength();
+  indexLengths = sampleStats.recommendIndex();
+  if(!singlePass)
+    sampleStats.writeJS(js);
+  if(!beginTrim && (beginTrim = sampleStats.recommendBeginSnip())) {
+    for(auto& i: indexLengths)
+      i-=beginTrim;
+    maxreadsize-=beginTrim;
+  }
   fastq.setTrim(beginTrim, endTrim);
   (*g_log)<<"Trimming "<<beginTrim<<" from beginning of reads, "<<endTrim<<" from end of reads"<<endl;
 
-  unsigned int bytes=0;
-  FastQRead fqfrag1, fqfrag2;
-
-
-  bytes=fastq.getReadPair(&fqfrag1, &fqfrag2); // get a read to index based on its size
   int keylen=11;
 
-  fputs("var genomes=[];\n", jsfp.get());
+  js << "var genomes=[];\n";
 
   vector<unique_ptr<ReferenceGenome> > refgens;
   auto annotations = annotationsArg.getValue().begin();
@@ -1154,11 +899,8 @@ try
     unique_ptr<ReferenceGenome> rg(new ReferenceGenome(fname));
     double genomeGCRatio = 1.0*(rg->d_cCount + rg->d_gCount)/(rg->d_cCount + rg->d_gCount + rg->d_aCount + rg->d_tCount);
 
-    (*g_log)<<"Read FASTA reference genome of '"<<rg->d_fullname<<"', "<<rg->size()<<" nucleotides from '"<<fname<<"' (GC = "<<genomeGCRatio<<")"<<endl;
-    for(auto i : indexLengths)
-      rg->index(i);
-    rg->index(keylen);
-    fprintf(jsfp.get(), "var genomeGCRatio=%f;\n", genomeGCRatio); // XXXmulti
+    (*g_log)<<"Read FASTA reference genome of '"<<rg->d_fullname<<"', "<<rg->size()<<" nucleotides in "<<rg->d_contigs.size()<<" contig"<<(rg->d_contigs.size() > 1 ? "s" : "")<<" from '"<<fname<<"' (GC = "<<genomeGCRatio<<")"<<endl;
+    js << "var genomeGCRatio=" << fixed(genomeGCRatio) << ";\n"; // XXXmulti
 
     if(annotations != annotationsArg.getValue().end()) {
       auto gar = new GeneAnnotationReader(*annotations);
@@ -1175,9 +917,6 @@ try
     auto rg = ReferenceGenome::makeFromString(phiXFastA);
     double genomeGCRatio = 1.0*(rg->d_cCount + rg->d_gCount)/(rg->d_cCount + rg->d_gCount + rg->d_aCount + rg->d_tCount);
     (*g_log)<<"Read FASTA reference genome of '"<<rg->d_fullname<<"', "<<rg->size()<<" nucleotides from builtin (GC = "<<genomeGCRatio<<")"<<endl;
-    rg->index(maxreadsize);
-    rg->index(keylen);
-
     auto gar = new GeneAnnotationReader("./phix.gff");
     (*g_log)<<"Done reading "<<gar->size()<<" annotations from builtin"<<endl;
     rg->addAnnotations(gar);  
@@ -1185,196 +924,220 @@ try
     refgens.emplace_back(move(rg));
   }
 
+  // one index over all contigs of all references
+  ReferencePanel panel(refgens);
+  vector<unsigned int> lengths(indexLengths);
+  lengths.push_back(keylen);
+  lengths.push_back(maxreadsize);
+  panel.index(lengths, max(1, threadsArg.getValue()));
+
   int duplimit = duplimitArg.getValue();
   if(duplimit < 0) {
     dnapos_t totsize=0;
     for(auto& rg : refgens) 
       totsize += rg->size();
-    auto lambda = 1.0*fastq.estimateReads()/totsize;
+    uint64_t estimated = fastq.estimateReads(); // with singlePass, from how the part we sampled compressed
+    auto lambda = 1.0*estimated/totsize;
     boost::math::poisson_distribution<double> pd(lambda);
     duplimit=boost::math::quantile(pd, 0.999);
-    (*g_log)<<"Auto-set duplicate filter to "<<duplimit<<" based on 0.999 cumulative Poisson. Expect "<<lambda<<" dups on average over estimated "<< fastq.estimateReads()<<" reads"<<endl;
+    (*g_log)<<"Auto-set duplicate filter to "<<duplimit<<" based on 0.999 cumulative Poisson. Expect "<<lambda<<" dups on average over estimated "<< estimated <<" reads"<<endl;
   }
   else if(duplimit > 0)
     (*g_log)<<"Duplicate reads filtered beyond "<<duplimit<<" copies"<<endl;
 
   g_log->flush();
-  dnapos_t pos;
-
-  uint64_t withAny=0, found=0, total=0, tooFrequent=0, goodPairMatches=0, badPairMatches=0,
-    qualityExcluded=0;
 
-  BAMWriter sbw(bamFileArg.getValue(), (*refgens.begin())->d_name, (*refgens.begin())->size()); // XXXmulti
+  uint64_t total=0, tooFrequent=0, qualityExcluded=0;
 
-  (*g_log)<<"Performing matches of reads to reference genome"<<endl;
-  boost::progress_display show_progress(filesize(fastq1Arg.getValue().c_str()), cerr);
- 
+  vector<BAMContig> bamContigs;
+  for(auto& rg : refgens) 
+    for(auto& contig : rg->d_contigs)
+      bamContigs.push_back({contig.name, rg->d_panelOffset + contig.start, contig.length});
+  BAMWriter sbw(bamFileArg.getValue(), bamContigs);
 
-  qstats_t qstats;
-  qstats.resize(maxreadsize);
-  VarMeanEstimator qstat;
-  vector<unsigned int> qcounts(256);
-  vector<uint64_t> unfoundReads;
-  vector<qtally> qqcounts(256);
-  vector<dnapos_t> gchisto(maxreadsize+1);
+  unsigned int numThreads = max(1, threadsArg.getValue());
+  uint32_t seed = seedArg.isSet() ? seedArg.getValue() : time(0);
+  unique_ptr<boost::progress_display> show_progress; // once we know the pairing window, so its log line does not break up the bar
+  uint64_t unshown = 0;
 
   DuplicateCounter dc;
   uint32_t theHash;
   map<uint32_t, uint32_t> seenAlready;
-  vector<uint32_t> pairdisthisto;
   vector<uint32_t> readlengths;
+  ReadStatistics passStats; // with singlePass, gathered along the way on the same pairs as doInitialReadStatistics would have
+  uint64_t pairCounter=0;
   signal(SIGINT, pleaseQuitHandler);
 
-  do { 
-    if(g_pleaseQuit) 
-      break;
-    show_progress += bytes;
-    vector<ReferenceGenome::MatchDescriptor > pairpositions[2];
-    bool dup1(false), dup2(false);
-    safeIncVec(readlengths, fqfrag1.d_nucleotides.length());
-    safeIncVec(readlengths, fqfrag2.d_nucleotides.length());
-    for(unsigned int paircount=0; paircount < 2; ++paircount) {
-      FastQRead& fqfrag(paircount ? fqfrag2 : fqfrag1);
-      total++;
-      for(string::size_type pos = 0 ; pos < fqfrag.d_quality.size(); ++pos) {
-	int i = fqfrag.d_quality[pos];
-	double err = qToErr(i);
-	qstat(err);
-	qstats[pos](err);
-	qcounts[i]++;
-      }
-      dc.feedString(fqfrag.d_nucleotides);
-      if(duplimit) {
-	theHash=qhash(fqfrag.d_nucleotides.c_str(), fqfrag.d_nucleotides.size(), 0);
-	if(++seenAlready[theHash] > (unsigned int)duplimit) {
-	  if(paircount)
-	    dup2=true;
-	  else
-	    dup1=true;
-	  tooFrequent++;
-	  continue;
+  // reading & duplicate filtering happen in order on this thread, the rest is up to the workers
+  const unsigned int batchSize = 1024;
+  auto readBatch = [&](PairBatch* batch) {
+    if(g_pleaseQuit)
+      return false;
+    unsigned int num = fastq.getReadPairs(&batch->reads[0], &batch->reads[1], batchSize);
+    if(!num)
+      return false;
+    if(show_progress)
+      *show_progress += batch->reads[0].bytes();
+    else
+      unshown += batch->reads[0].bytes();
+    for(unsigned int paircount=0; paircount < 2; ++paircount)
+      batch->dup[paircount].assign(num, false);
+    for(unsigned int i = 0; i < num; ++i) {
+      if(singlePass && !(++pairCounter%11)) 
+	for(unsigned int paircount=0; paircount < 2; ++paircount) 
+	  passStats.feed(batch->reads[paircount][i].nucleotides, batch->reads[paircount][i].len, beginTrim);
+      for(unsigned int paircount=0; paircount < 2; ++paircount) {
+	ReadBatch::View fqfrag = batch->reads[paircount][i];
+	total++;
+	safeIncVec(readlengths, fqfrag.len);
+	dc.feedString(fqfrag.nucleotides, fqfrag.len);
+	if(duplimit) {
+	  theHash=qhash(fqfrag.nucleotides, fqfrag.len, 0);
+	  if(++seenAlready[theHash] > (unsigned int)duplimit) {
+	    batch->dup[paircount][i]=true;
+	    tooFrequent++;
+	  }
 	}
       }
-      
-      gchisto[round(fqfrag.d_nucleotides.size()*getGCContent(fqfrag.d_nucleotides))]++;
-      
-      if(fqfrag.d_nucleotides.find('N') != string::npos) {
-	// unfoundReads.push_back(fqfrag.position); // will fail elsewhere and get filed there
-	withAny++;
-	continue;
-      }
-      if((pairpositions[paircount]=getAllReadPosBoth(refgens, indexLengths, &fqfrag)).empty()) {
-	pairpositions[paircount]=fuzzyFind(&fqfrag, refgens, keylen, qlimit);
-      } 
     }
+    return true;
+  };
+
+  /* the pairing window gets learnt here from the first batches, before any of their pairs get mapped, so every
+     worker uses the same one whatever the number of threads */
+  const unsigned int learnBatches = 4;
+  vector<unique_ptr<PairBatch> > batches;
+  for(unsigned int n = 0; n < max(learnBatches, numThreads > 1 ? 4*numThreads : 1); ++n)
+    batches.emplace_back(new PairBatch);
+  InsertSizeModel learnt;
+  unsigned int ahead = 0; // batches read to learn from
+  bool more = true;
+  while(more && ahead < learnBatches && readBatch(batches[ahead].get())) {
+    learnInsertSizes(panel, *batches[ahead], &learnt);
+    more = batches[ahead++]->reads[0].size() == batchSize;
+  }
+  more = more && ahead == learnBatches;
+  unsigned int window = learnt.window(s_mateWindow, s_mateWindow);
+  // finding a mate close by is only a shortcut, so this needs no room for the long inserts the pairing window allows
+  unsigned int searchWindow = learnt.window(0, s_mateWindow);
+  (*g_log)<<"Pairing reads closer than "<<window<<", from "<<learnt.samples()<<" pairs with both reads in one place, insert size "<<learnt.median()<<" +- "<<learnt.mad()<<endl;
+  (*g_log)<<"Looking for mates within "<<searchWindow<<" of a read found in few places first"<<endl;
+  (*g_log)<<"Performing matches of reads to reference genome using "<<numThreads<<" thread"<<(numThreads > 1 ? "s" : "")<<", random seed "<<seed<<endl;
+  show_progress.reset(new boost::progress_display(filesize(fastq1Arg.getValue().c_str()), cerr));
+  *show_progress += unshown;
+
+  vector<unique_ptr<MappingWorker> > workers;
+  for(unsigned int n = 0; n < numThreads; ++n)
+    workers.emplace_back(new MappingWorker(refgens, panel, keylen, qlimit, maxreadsize, seed, !n, sbw.enabled(), window, searchWindow));
+
+  if(numThreads == 1) {
+    for(unsigned int n = 0; n < ahead; ++n)
+      workers[0]->mapBatch(*batches[n]);
+    while(more && readBatch(batches[0].get())) 
+      workers[0]->mapBatch(*batches[0]);
+  }
+  else {
+    BlockingQueue<PairBatch*> todo, spare;
+    for(unsigned int n = ahead; n < batches.size(); ++n)
+      spare.push(batches[n].get());
+    for(unsigned int n = 0; n < ahead; ++n)
+      todo.push(batches[n].get());
     
-    map<int, vector<pair<ReferenceGenome::MatchDescriptor,ReferenceGenome::MatchDescriptor> > > potMatch;
-    unsigned int matchCount=0;
-    for(auto& match1 : pairpositions[0]) {
-      for(auto& match2 : pairpositions[1]) {
-	if(match1.reverse != match2.reverse &&  abs((int64_t) match1.pos - (int64_t)match2.pos) < 1400) {
-	  potMatch[match1.score + match2.score].push_back({match1, match2});
-	  matchCount++;
-	}
-      }
-    }
-   
-    if(!potMatch.empty()) {
-      const auto& chosen = pickRandom(potMatch.begin()->second);
-      goodPairMatches++;
-      int distance = chosen.second.reverse ? 
-	(fqfrag1.d_nucleotides.length() + (int64_t) chosen.second.pos - (int64_t) chosen.first.pos) :
-	(fqfrag1.d_nucleotides.length() + (int64_t) chosen.first.pos - (int64_t) chosen.second.pos);
-
-      if(distance >= 0)
-	safeIncVec(pairdisthisto, distance);
-      for(int paircount = 0 ; paircount < 2; ++paircount) {
-	auto fqfrag = paircount ? &fqfrag2 : &fqfrag1;
-	auto dup = paircount ? dup2 : dup1,
-	  otherDup = paircount? dup1 : dup2;
-	pos = paircount ? chosen.second.pos : chosen.first.pos;
-
-
-	if((paircount ? chosen.second.reverse : chosen.first.reverse) != fqfrag->reversed)
-	  fqfrag->reverse();
-
-	if(otherDup && !dup) {
-	  MapToReference(*chosen.second.rg, pos, *fqfrag, qlimit, &sbw, &qqcounts);
-	}
-	else if(!otherDup && !dup) {
-	  int indel; 
-	  // XXX add amount here
-	  if(MapToReference(*chosen.second.rg, pos, *fqfrag, qlimit, 0, &qqcounts, &indel)) {
-	    sbw.qwrite(pos, *fqfrag, indel, 3 + (paircount ? 0x80 : 0x40),
-		     "=", 
-		     paircount ? chosen.first.pos : chosen.second.pos, 
-		       (chosen.first.reverse ^ (bool)paircount) ? -distance : distance);
+    vector<std::thread> threads;
+    vector<std::exception_ptr> errors(numThreads);
+    for(unsigned int n = 0; n < numThreads; ++n) {
+      threads.emplace_back([&, n]() {
+	  PairBatch* batch;
+	  while(todo.pop(&batch)) {
+	    try {
+	      if(!errors[n]) 
+		workers[n]->mapBatch(*batch);
+	    }
+	    catch(...) {
+	      errors[n] = std::current_exception();
+	      g_pleaseQuit = true;
+	    }
+	    spare.push(batch);
 	  }
-	}
-	found++;
-      }
+	});
     }
-    else {
-      //      cout<<"No pair matches, need to map individually: "<<endl;
-      badPairMatches++;
-      for(unsigned int paircount = 0; paircount < 2; ++paircount) {
-	if(paircount ? dup2 : dup1)
-	  continue;
-	
-	map<int, vector<ReferenceGenome::MatchDescriptor>> scores;
-	for(auto match: pairpositions[paircount]) {
-	  scores[match.score].push_back(match);
-	  //	  cout<<"\t"<<paircount<<"\t"<<match.pos<<" "<<match.reverse<<", score: "<<match.score<<endl;
-	}
-	FastQRead* fqfrag = paircount ? &fqfrag2 : &fqfrag1;
-	if(scores.empty()) {
-	  unfoundReads.push_back(fqfrag->position);
-	  continue;
-	}
-	auto pick = pickRandom(scores.begin()->second);
 
-	if(fqfrag->reversed != pick.reverse)
-	  fqfrag->reverse();
-
-	MapToReference(*pick.rg, pick.pos, *fqfrag, qlimit, &sbw, &qqcounts);
-	found++;
+    PairBatch* batch;
+    try {
+      while(more && spare.pop(&batch)) {
+	if(!readBatch(batch))
+	  break;
+	todo.push(batch);
+	if(batch->reads[0].size() < batchSize)
+	  break;
       }
-    } 
-  } while((bytes=fastq.getReadPair(&fqfrag1, &fqfrag2)));
+    }
+    catch(...) {
+      todo.close();
+      for(auto& t : threads)
+	t.join();
+      throw;
+    }
+    todo.close();
+    for(auto& t : threads)
+      t.join();
+    for(const auto& e : errors)
+      if(e)
+	std::rethrow_exception(e);
+
+    for(unsigned int n = 1; n < numThreads; ++n)
+      workers[0]->merge(*workers[n]);
+    workers.resize(1);
+  }
   signal(SIGINT, SIG_DFL);
+  MappingWorker& mw = *workers[0];
+  sbw.mergeQueue(mw.d_bamqueue);
+  // so our output does not depend on the number of threads
+  sort(mw.d_unfoundReads.begin(), mw.d_unfoundReads.end(), [](uint64_t a, uint64_t b) {
+      return make_pair(a & ~(1ULL<<63), a >> 63) < make_pair(b & ~(1ULL<<63), b >> 63);
+    });
+  for(auto& rg : refgens) {
+    rg->settleInserts();
+    rg->d_locimap.sort();
+    rg->sortPlacements();
+  }
   
+  if(singlePass) {
+    passStats.fillCycles(sampleStats, beginTrim); // we never saw these
+    passStats.writeJS(js);
+  }
+
+  vector<uint32_t> pairdisthisto(mw.d_insertSizes.histogram());
   pairdisthisto.resize(1500); // outliers mess us up otherwise
-  fputs(jsonVector(pairdisthisto, "var pairdisthisto").c_str(), jsfp.get());
-  fputs(jsonVector(readlengths, "var readlengths").c_str(), jsfp.get());
+  writeJSONVector(js, "var pairdisthisto", pairdisthisto);
+  writeJSONVector(js, "var readlengths", readlengths);
 
   uint64_t totNucleotides=total*maxreadsize; // XXX very wrong
-  fprintf(jsfp.get(), "qhisto=[");
+  js << "qhisto=[";
   for(int c=0; c < 50; ++c) {
-    fprintf(jsfp.get(), "%s[%d,%f]", c ? "," : "", (int)c, 1.0*qcounts[c]/totNucleotides);
+    js << (c ? "," : "") << '[' << c << ',' << fixed(1.0*mw.d_qcounts[c]/totNucleotides) << ']';
   }
-  fprintf(jsfp.get(),"];\n");
+  js << "];\n";
 
-  fprintf(jsfp.get(), "var dupcounts=[");
+  js << "var dupcounts=[";
   auto duplicates = dc.getCounts();
   for(auto iter = duplicates.begin(); iter != duplicates.end(); ++iter) {
-    fprintf(jsfp.get(), "%s[%" PRIu64 ",%f]", (iter!=duplicates.begin()) ? "," : "", iter->first, 1.0*iter->second/total);
+    js << ((iter!=duplicates.begin()) ? "," : "") << '[' << (uint64_t)iter->first << ',' << fixed(1.0*iter->second/total) << ']';
   }
-  fprintf(jsfp.get(),"];\n");
+  js << "];\n";
   dc.clear(); // might save some memory..
 
-  dnapos_t totalhisto= accumulate(gchisto.begin(), gchisto.end(), 0);
-  fputs(jsonVector(gchisto, "var gcreadhisto",  
-		   [totalhisto](dnapos_t c){return 1.0*c/totalhisto;},
-		   [&maxreadsize](int i) { return 100.0*i/maxreadsize;}   ).c_str(),  // XXX wrong scaling
-	jsfp.get());
+  dnapos_t totalhisto= accumulate(mw.d_gchisto.begin(), mw.d_gchisto.end(), 0);
+  writeJSONVector(js, "var gcreadhisto", mw.d_gchisto,
+		  [totalhisto](dnapos_t c){return 1.0*c/totalhisto;},
+		  [&maxreadsize](int i) { return 100.0*i/maxreadsize;}   );  // XXX wrong scaling
 
   unsigned int numRef=0;
   for(auto& rg : refgens) {
-    fprintf(jsfp.get(), "genomes[%d]={};\n", numRef);
-    fputs(jsonVector(rg->getGCHisto(), ("genomes["+lexical_cast<string>(numRef)+"].gcrefhisto").c_str(),  
-		     [&maxreadsize,&rg](dnapos_t c){return 1.0*c/(rg->size()/maxreadsize);},
-		     [&maxreadsize](int i) { return 100.0*i/maxreadsize;}   ).c_str(),  // XXX wrong scaling
-	  jsfp.get());
+    js << "genomes[" << numRef << "]={};\n";
+    writeJSONVector(js, "genomes["+lexical_cast<string>(numRef)+"].gcrefhisto", rg->getGCHisto(),
+		    [&maxreadsize,&rg](dnapos_t c){return 1.0*c/(rg->size()/maxreadsize);},
+		    [&maxreadsize](int i) { return 100.0*i/maxreadsize;}   );  // XXX wrong scaling
 
 
     numRef++;
@@ -1382,38 +1145,40 @@ try
 
   (*g_log) << (boost::format("Total reads: %|40t| %10d (%.2f gigabps)") % total % (totNucleotides/1000000000.0)).str() <<endl;
   (*g_log) << (boost::format("Quality excluded: %|40t|-%10d") % qualityExcluded).str() <<endl;
-  (*g_log) << (boost::format("Ignored reads with N: %|40t|-%10d") % withAny).str()<<endl;
+  (*g_log) << (boost::format("Ignored reads with N: %|40t|-%10d") % mw.d_withAny).str()<<endl;
   if(duplimit)
     (*g_log) << (boost::format("Too frequent reads: %|40t| %10d (%.02f%%)") % tooFrequent % (100.0*tooFrequent/total)).str() <<endl;
-  (*g_log) << (boost::format("Full matches: %|40t|-%10d (%.02f%%)\n") % found % (100.0*found/total)).str();
-  (*g_log) << (boost::format(" Reads matched in a good pair: %|40t| %10d\n") % (goodPairMatches*2)).str();
-  (*g_log) << (boost::format(" Reads not matched, bad pair: %|40t| %10d\n") % (badPairMatches*2)).str();
+  (*g_log) << (boost::format("Full matches: %|40t|-%10d (%.02f%%)\n") % mw.d_found % (100.0*mw.d_found/total)).str();
+  (*g_log) << (boost::format(" Reads matched in a good pair: %|40t| %10d\n") % (mw.d_goodPairMatches*2)).str();
+  (*g_log) << (boost::format(" Reads not matched, bad pair: %|40t| %10d\n") % (mw.d_badPairMatches*2)).str();
+  (*g_log) << (boost::format(" Reads found near their mate: %|40t| %10d\n") % mw.d_mateSearchMatches).str();
+  (*g_log) << (boost::format(" Insert size, median and MAD: %|40t| %10d +- %d\n") % mw.d_insertSizes.median() % mw.d_insertSizes.mad()).str();
 
-  (*g_log) << (boost::format("Not fully matched: %|40t|=%10d (%.02f%%)\n") % unfoundReads.size() % (unfoundReads.size()*100.0/total)).str();
-  (*g_log) << (boost::format("Mean Q: %|40t|    %10.2f +- %.2f\n") % (-10.0*log10(mean(qstat))) 
-	       % sqrt(-10.0*log10(variance(qstat)) )).str();
+  (*g_log) << (boost::format("Not fully matched: %|40t|=%10d (%.02f%%)\n") % mw.d_unfoundReads.size() % (mw.d_unfoundReads.size()*100.0/total)).str();
+  (*g_log) << (boost::format("Mean Q: %|40t|    %10.2f +- %.2f\n") % (-10.0*log10(mean(mw.d_qstat))) 
+	       % sqrt(-10.0*log10(variance(mw.d_qstat)) )).str();
 
   seenAlready.clear();
 
   for(auto& rg : refgens) {  // XXXmulti - the 'found' should be per GC, not global!
     for(auto& i : rg->d_correctMappings) {
-      i=found;
+      i=mw.d_found;
     }
   }
-  printQualities(jsfp.get(), qstats);
+  printQualities(js, mw.d_qstats);
 
   if(!bamFileArg.getValue().empty()) {
     (*g_log) << "Writing sorted & indexed BAM file to '"<< bamFileArg.getValue()<<"'"<<endl;
     sbw.runQueue(fastq);
   }
   if(unmatchedDumpSwitch.getValue())
-    writeUnmatchedReads(unfoundReads, fastq);
+    writeUnmatchedReads(mw.d_unfoundReads, fastq);
   int index=0;
   numRef=0;
 
   for(auto& rg : refgens) {
     (*g_log)<<"Output for "<<rg->d_fullname<<endl;
-    rg->printCoverage(jsfp.get(), "genomes["+lexical_cast<string>(numRef)+"].fullHisto");
+    rg->printCoverage(js, "genomes["+lexical_cast<string>(numRef)+"].fullHisto", numThreads);
     Clusterer<Unmatched> cl(100);
     for(auto unm : rg->d_unmRegions) {
       cl.feed(unm);
@@ -1423,14 +1188,14 @@ try
     }
     else {
       for(auto unmCl : cl.d_clusters) {
-	string report=makeReport(*rg, pos, rg->d_locimap[pos], -1);
-	emitRegion(jsfp.get(), *rg, fastq, "Undermatched", index++, unmCl.getBegin()-100, unmCl.getEnd()+100, report);
+	string report=makeReport(*rg, unmCl.getBegin(), rg->d_locimap[unmCl.getBegin()], -1);
+	emitRegion(js, *rg, fastq, "Undermatched", index++, unmCl.getBegin()-100, unmCl.getEnd()+100, report);
       }
     }
-    printCorrectMappings(jsfp.get(), *rg, "genomes["+lexical_cast<string>(numRef)+"].referenceQ");
-    fprintf(jsfp.get(), "genomes[%d].qqdata=[", numRef);
+    printCorrectMappings(js, *rg, "genomes["+lexical_cast<string>(numRef)+"].referenceQ");
+    js << "genomes[" << numRef << "].qqdata=[";
     bool printedYet=false;
-    for(auto coinco = qqcounts.begin() ; coinco != qqcounts.end(); ++coinco) {
+    for(auto coinco = mw.d_qqcounts.begin() ; coinco != mw.d_qqcounts.end(); ++coinco) {
       if(coinco->incorrect || coinco->correct) {
 	double qscore;
 	if(coinco->incorrect && coinco->correct)
@@ -1440,34 +1205,36 @@ try
 	else
 	  qscore=41; // "highest score possible"
 	
-	fprintf(jsfp.get(), "%s[%u, %f, %" PRIu64 "]", 
-		printedYet ?  "," : "", 
-		(unsigned int)(coinco - qqcounts.begin()), qscore,
-		coinco->incorrect + coinco->correct);
+	js << (printedYet ?  "," : "") << '[' << (unsigned int)(coinco - mw.d_qqcounts.begin()) << ", " << fixed(qscore) << ", ";
+	js << (uint64_t)(coinco->incorrect + coinco->correct) << ']';
 	printedYet=true;
       }
     }
-    fprintf(jsfp.get(), "];\n");
+    js << "];\n";
 
     struct revsort
     {
       bool operator()(const unsigned int&a, const unsigned int&b) const
       { return a > b;} 
     };
-    (*g_log)<<"Found "<<rg->d_insertCounts.size()<<" loci with at least one insert in a read"<<endl;
     map<unsigned int, vector<dnapos_t>, revsort> topInserts;
-    unsigned int significantInserts=0;
-    for(const auto& insloc : rg->d_insertCounts) {
-      topInserts[insloc.second].push_back(insloc.first);
-      if(insloc.second > 4)
+    unsigned int insertLoci=0, significantInserts=0;
+    for(const auto& p : rg->d_locimap) {
+      unsigned int inserts = p.second.totalInserts();
+      if(!inserts)
+	continue;
+      insertLoci++;
+      topInserts[inserts].push_back(p.first);
+      if(inserts > 4)
 	significantInserts++;
     }
+    (*g_log)<<"Found "<<insertLoci<<" loci with at least one insert in a read"<<endl;
     (*g_log)<<"Found "<<significantInserts<<" significant inserts"<<endl;
 
 
     uint64_t significantlyVariable=0;
     Clusterer<ClusterLocus> vcl(100);
-    emitLociAndCluster(jsfp.get(), rg.get(), numRef, vcl);
+    emitLociAndCluster(js, rg.get(), numRef, vcl, compressReport);
     (*g_log)<<vcl.numClusters()<<" clusters of real variability, " << vcl.numEntries()<<" variable loci"<<endl;
     
     if(skipVariableSwitch.getValue()) {
@@ -1497,7 +1264,7 @@ try
 	    maxPos=max(r.second, maxPos);
 	  }	  
 
-	  emitRegion(jsfp.get(), *rg, fastq, "Variable", index++, minPos > 100 ? minPos-100 : 1, maxPos+100 > rg->size() ? rg->size() : maxPos+100, theReport, maxVarcount);
+	  emitRegion(js, *rg, fastq, "Variable", index++, minPos > 100 ? minPos-100 : 1, maxPos+100 > rg->size() ? rg->size() : maxPos+100, theReport, maxVarcount);
 	}
       }
       (*g_log)<<"Found "<<significantlyVariable<<" significantly variable loci"<<endl;
@@ -1511,7 +1278,7 @@ try
 	  break;
 	for(const auto& position : insert.second) {
 	  auto theReport = makeReport(*rg, position, rg->d_locimap[position], 0);
-	  emitRegion(jsfp.get(), *rg, fastq, "Insert", index++, position, theReport);
+	  emitRegion(js, *rg, fastq, "Insert", index++, position, theReport);
 	}
       }
     }
@@ -1520,7 +1287,8 @@ try
   g_log->flush();
   string log = jsonlog.str();
   replace_all(log, "\n", "\\n");
-  fprintf(jsfp.get(), "var antonieLog=\"%s\";\n", log.c_str());
+  js << "var antonieLog=\"" << log << "\";\n";
+  js.close();
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,230 @@
+#include "dnakernels.hh"
+#include <atomic>
+#include <algorithm>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DNAKERNELS_X86
+#include <immintrin.h>
+#endif
+
+static std::atomic<int> s_level(-1);
+
+static SIMDLevel bestSIMDLevel()
+{
+#ifdef DNAKERNELS_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    return SIMDLevel::AVX2;
+#endif
+  return SIMDLevel::Scalar;
+}
+
+SIMDLevel getSIMDLevel()
+{
+  int level = s_level.load(std::memory_order_relaxed);
+  if(level < 0) {
+    level = (int)bestSIMDLevel();
+    s_level.store(level, std::memory_order_relaxed);
+  }
+  return (SIMDLevel)level;
+}
+
+void setSIMDLevel(SIMDLevel level)
+{
+  s_level.store((int)std::min(level, bestSIMDLevel()), std::memory_order_relaxed);
+}
+
+const char* SIMDLevelName(SIMDLevel level)
+{
+  return level == SIMDLevel::AVX2 ? "AVX2" : "scalar";
+}
+
+static NucleotideCounts countNucleotidesScalar(const char* str, size_t len)
+{
+  NucleotideCounts ret{0, 0, 0, 0, 0, 0};
+  for(const char* c = str; c != str + len; ++c) {
+    switch(*c) {
+    case 'A': ++ret.a; break;
+    case 'C': ++ret.c; break;
+    case 'G': ++ret.g; break;
+    case 'T': ++ret.t; break;
+    case 'N': ++ret.n; break;
+    default: ++ret.other;
+    }
+  }
+  return ret;
+}
+
+static const char* subtractQualityOffsetScalar(char* quality, size_t len, uint8_t offset)
+{
+  for(char* c = quality; c != quality + len; ++c) {
+    if((uint8_t)*c < offset)
+      return c;
+    *c -= offset;
+  }
+  return nullptr;
+}
+
+static uint8_t minQualityScalar(const char* quality, size_t len)
+{
+  uint8_t ret = 255;
+  for(const char* c = quality; c != quality + len; ++c)
+    ret = std::min(ret, (uint8_t)*c);
+  return ret;
+}
+
+static inline char complement(char c)
+{
+  switch(c) {
+  case 'A': return 'T';
+  case 'C': return 'G';
+  case 'G': return 'C';
+  case 'T': return 'A';
+  default: return c;
+  }
+}
+
+static void reverseComplementScalar(char* str, size_t len)
+{
+  if(!len)
+    return;
+  for(char *lo = str, *hi = str + len - 1; lo <= hi; ++lo, --hi) {
+    char tmp = complement(*lo);
+    *lo = complement(*hi);
+    *hi = tmp;
+  }
+}
+
+#ifdef DNAKERNELS_X86
+//! sums the 32 bytes in v
+__attribute__((target("avx2"))) static inline uint32_t sumBytes(__m256i v)
+{
+  __m256i sums = _mm256_sad_epu8(v, _mm256_setzero_si256());
+  __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+  return _mm_cvtsi128_si32(_mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum)));
+}
+
+__attribute__((target("avx2"))) static NucleotideCounts countNucleotidesAVX2(const char* str, size_t len)
+{
+  NucleotideCounts ret{0, 0, 0, 0, 0, 0};
+  const __m256i A = _mm256_set1_epi8('A'), C = _mm256_set1_epi8('C'), G = _mm256_set1_epi8('G'),
+    T = _mm256_set1_epi8('T'), N = _mm256_set1_epi8('N');
+  size_t pos = 0;
+  while(len - pos >= 32) {
+    // the per byte counters would overflow beyond 255 rounds
+    size_t rounds = std::min<size_t>((len - pos) / 32, 255);
+    __m256i ca = _mm256_setzero_si256(), cc = ca, cg = ca, ct = ca, cn = ca;
+    for(size_t r = 0; r < rounds; ++r, pos += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(str + pos));
+      // a match is -1, so subtracting it counts
+      ca = _mm256_sub_epi8(ca, _mm256_cmpeq_epi8(v, A));
+      cc = _mm256_sub_epi8(cc, _mm256_cmpeq_epi8(v, C));
+      cg = _mm256_sub_epi8(cg, _mm256_cmpeq_epi8(v, G));
+      ct = _mm256_sub_epi8(ct, _mm256_cmpeq_epi8(v, T));
+      cn = _mm256_sub_epi8(cn, _mm256_cmpeq_epi8(v, N));
+    }
+    ret.a += sumBytes(ca);
+    ret.c += sumBytes(cc);
+    ret.g += sumBytes(cg);
+    ret.t += sumBytes(ct);
+    ret.n += sumBytes(cn);
+  }
+  NucleotideCounts tail = countNucleotidesScalar(str + pos, len - pos);
+  ret.a += tail.a;
+  ret.c += tail.c;
+  ret.g += tail.g;
+  ret.t += tail.t;
+  ret.n += tail.n;
+  ret.other = len - ret.a - ret.c - ret.g - ret.t - ret.n;
+  return ret;
+}
+
+__attribute__((target("avx2"))) static const char* subtractQualityOffsetAVX2(char* quality, size_t len, uint8_t offset)
+{
+  const __m256i off = _mm256_set1_epi8(offset);
+  size_t pos = 0;
+  for(; len - pos >= 32; pos += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(quality + pos));
+    // unsigned v >= offset is max(v, offset) == v
+    if(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, off), v)) != -1)
+      break; // the scalar version finds out which byte it was
+    _mm256_storeu_si256((__m256i*)(quality + pos), _mm256_sub_epi8(v, off));
+  }
+  return subtractQualityOffsetScalar(quality + pos, len - pos, offset);
+}
+
+__attribute__((target("avx2"))) static uint8_t minQualityAVX2(const char* quality, size_t len)
+{
+  __m256i mins = _mm256_set1_epi8((char)255);
+  size_t pos = 0;
+  for(; len - pos >= 32; pos += 32)
+    mins = _mm256_min_epu8(mins, _mm256_loadu_si256((const __m256i*)(quality + pos)));
+  alignas(32) uint8_t bytes[32];
+  _mm256_store_si256((__m256i*)bytes, mins);
+  uint8_t ret = minQualityScalar(quality + pos, len - pos);
+  for(auto b : bytes)
+    ret = std::min(ret, b);
+  return ret;
+}
+
+__attribute__((target("avx2"))) static inline __m256i reverseComplement32(__m256i v)
+{
+  const __m256i reverse = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+					   15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  v = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, reverse), 0x4E);
+  // 'A'^'T' == 0x15, 'C'^'G' == 0x04
+  __m256i at = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('A')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('T')));
+  __m256i cg = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('C')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('G')));
+  v = _mm256_xor_si256(v, _mm256_and_si256(at, _mm256_set1_epi8(0x15)));
+  return _mm256_xor_si256(v, _mm256_and_si256(cg, _mm256_set1_epi8(0x04)));
+}
+
+__attribute__((target("avx2"))) static void reverseComplementAVX2(char* str, size_t len)
+{
+  size_t lo = 0, hi = len;
+  // swap 32 bytes from either end at a time, the middle goes scalar
+  for(; hi - lo >= 64; lo += 32, hi -= 32) {
+    __m256i front = _mm256_loadu_si256((const __m256i*)(str + lo));
+    __m256i back = _mm256_loadu_si256((const __m256i*)(str + hi - 32));
+    _mm256_storeu_si256((__m256i*)(str + lo), reverseComplement32(back));
+    _mm256_storeu_si256((__m256i*)(str + hi - 32), reverseComplement32(front));
+  }
+  reverseComplementScalar(str + lo, hi - lo);
+}
+#endif
+
+NucleotideCounts countNucleotides(const char* str, size_t len)
+{
+#ifdef DNAKERNELS_X86
+  if(getSIMDLevel() == SIMDLevel::AVX2)
+    return countNucleotidesAVX2(str, len);
+#endif
+  return countNucleotidesScalar(str, len);
+}
+
+const char* subtractQualityOffset(char* quality, size_t len, uint8_t offset)
+{
+#ifdef DNAKERNELS_X86
+  if(getSIMDLevel() == SIMDLevel::AVX2)
+    return subtractQualityOffsetAVX2(quality, len, offset);
+#endif
+  return subtractQualityOffsetScalar(quality, len, offset);
+}
+
+uint8_t minQuality(const char* quality, size_t len)
+{
+#ifdef DNAKERNELS_X86
+  if(getSIMDLevel() == SIMDLevel::AVX2)
+    return minQualityAVX2(quality, len);
+#endif
+  return minQualityScalar(quality, len);
+}
+
+void reverseComplement(char* str, size_t len)
+{
+#ifdef DNAKERNELS_X86
+  if(getSIMDLevel() == SIMDLevel::AVX2)
+    return reverseComplementAVX2(str, len);
+#endif
+  reverseComplementScalar(str, len);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/* The loops every read goes through, over raw bytes. On x86 these use AVX2 when the CPU has it,
+   picked at runtime, and plain C++ otherwise. Both give exactly the same results. */
+
+//! How many of each nucleotide a sequence holds, anything else counts as other
+struct NucleotideCounts
+{
+  uint32_t a, c, g, t, n, other;
+  //! G and C as a fraction of the ACGTN nucleotides, 0 if there are none
+  double gcFraction() const
+  {
+    uint32_t total = a + c + g + t + n;
+    if(!total)
+      return 0.0;
+    return 1.0*(c + g)/(1.0*total);
+  }
+};
+
+NucleotideCounts countNucleotides(const char* str, size_t len);
+//! Subtracts offset from each quality byte. Returns the first byte that was below offset, untouched, or nullptr if none was
+const char* subtractQualityOffset(char* quality, size_t len, uint8_t offset);
+//! the lowest quality byte, 255 if there are none
+uint8_t minQuality(const char* quality, size_t len);
+//! reverse complement in place, anything but ACGT only gets moved
+void reverseComplement(char* str, size_t len);
+
+enum class SIMDLevel { Scalar, AVX2 };
+//! what the kernels currently use
+SIMDLevel getSIMDLevel();
+//! for testing and benchmarking, asking for more than the CPU can do gets what it can do
+void setSIMDLevel(SIMDLevel level);
+const char* SIMDLevelName(SIMDLevel level);
@@ -1,5 +1,6 @@
 #include "dnamisc.hh"
 #include "antonie.hh"
+#include "dnakernels.hh"
 #include <vector>
 #include <stdexcept>
 #include <math.h>
@@ -14,29 +15,23 @@ using std::runtime_error;
 
 double getGCContent(const std::string& str)
 {
-  dnapos_t aCount{0}, cCount{0}, gCount{0}, tCount{0}, nCount{0};
-  for(auto c : str) {
-    if(c=='A') ++aCount;
-    else if(c=='C') ++cCount;
-    else if(c=='G') ++gCount;
-    else if(c=='T') ++tCount;
-    else if(c=='N') ++nCount;
-  }
-  dnapos_t total = cCount + gCount + aCount + tCount + nCount;
-  if(!total)
-    return 0.0;
-  return 1.0*(cCount + gCount)/(1.0*total);
+  return getGCContent(str.c_str(), str.size());
+}
+
+double getGCContent(const char* str, size_t len)
+{
+  return countNucleotides(str, len).gcFraction();
 }
 
 double qToErr(unsigned int i) 
 {
-  static vector<double> answers;
-  
-  if(answers.empty()) {
+  static const vector<double> answers = []() { // thread safe initialization
+    vector<double> ret;
     for(int n = 0; n < 60 ; ++n) {
-      answers.push_back(pow(10.0, -n/10.0));
+      ret.push_back(pow(10.0, -n/10.0));
     }
-  }
+    return ret;
+  }();
   if(i > answers.size()) {
     throw runtime_error("Can't calculate error rate for Q "+boost::lexical_cast<std::string>(i));
   }
@@ -46,20 +41,26 @@ double qToErr(unsigned int i)
 
 uint32_t kmerMapper(const std::string& str, int offset, int unsigned len)
 {
-  uint32_t ret=0;
-  const char *c=str.c_str() + offset;
-  std::string::size_type val;
-  for(std::string::size_type i = 0; i != len; ++i, ++c) {
-    ret<<=2;
-    if(*c=='A') val=0;
-    else if(*c=='C') val=1;
-    else if(*c=='G') val=2;
-    else if(*c=='T') val=3;
-    else 
-      continue;
+  return kmerMapper(str.c_str() + offset, len);
+}
 
-    ret |= val;
-  }
+uint32_t kmerMapper(const char* str, int unsigned len)
+{
+  // 2 bit code per nucleotide, anything else contributes 0 bits
+  static const struct Table {
+    uint8_t val[256];
+    Table() {
+      for(auto& v : val)
+	v = 0;
+      val[(uint8_t)'C'] = 1;
+      val[(uint8_t)'G'] = 2;
+      val[(uint8_t)'T'] = 3;
+    }
+  } table;
+  uint32_t ret=0;
+  const uint8_t *c=(const uint8_t*)str;
+  for(std::string::size_type i = 0; i != len; ++i, ++c) 
+    ret = (ret << 2) | table.val[*c];
   return ret;
 }
 
@@ -197,7 +198,12 @@ char DNAToAminoAcid(const char* s)
 
 void DuplicateCounter::feedString(const std::string& str)
 {
-  uint32_t hashval = qhash(str.c_str(), str.length(), 0);
+  feedString(str.c_str(), str.length());
+}
+
+void DuplicateCounter::feedString(const char* str, size_t len)
+{
+  uint32_t hashval = qhash(str, len, 0);
   d_hashes.push_back(hashval);
 }
 
@@ -15,6 +15,20 @@ double qToErr(unsigned int i);
 
 //! returns GC fraction of nucleotides in str
 double getGCContent(const std::string& str);
+//! the same for the len nucleotides at str
+double getGCContent(const char* str, size_t len);
+
+//! GC content of a window sliding over nucleotides, counted the way getGCContent does but one nucleotide at a time
+struct GCWindow
+{
+  unsigned int gc = 0, counted = 0; //!< counted is A, C, G, T and N, anything else gets ignored
+
+  static unsigned int isGC(char c) { return c == 'C' || c == 'G'; }
+  static unsigned int isCounted(char c) { return c == 'A' || c == 'C' || c == 'G' || c == 'T' || c == 'N'; }
+  void add(char c) { gc += isGC(c); counted += isCounted(c); }
+  void remove(char c) { gc -= isGC(c); counted -= isCounted(c); }
+  double fraction() const { return counted ? 1.0*gc/(1.0*counted) : 0.0; }
+};
 
 
 //! Generic class to cluster objects that are 'close by'
@@ -127,82 +141,16 @@ const typename T::value_type& pickRandom(const T& t)
   return t[rand() % t.size()];
 }
 
-inline std::string jsonVectorPair(const std::vector<std::pair<double, double> >& in) 
-{
-  std::ostringstream str;
-  str<<"[";
-  bool first=true;
-  for(const auto& ent : in) {
-    if(!first)
-      str<<",";
-    first=false;
-    str<<"["<<ent.first<<","<<ent.second<<"]";
-  }
-  str<<"]";
-  return str.str();
-}
-
-/** returns v as a string in JSON format, where v is a vector of values, and we return it as an array of [offset,value] pairs. v can be transformed inline  ysing yAdjust and xAdjust
-    \param v Vector of values
-    \param name name of JSON object
-    \param yAdjust function (or lambda) that transforms the values in v
-    \param xAdjust function (or lambda) that generates the offsets in our return vector. Gets passed this offset, returns a double
-*/
-template<typename T>
-std::string jsonVector(const std::vector<T>& v, const std::string& name, 
-		  std::function<double(dnapos_t)> yAdjust = [](dnapos_t d){return 1.0*d;},
-		  std::function<double(int)> xAdjust = [](int i){return 1.0*i;})
+//! Pick a random element using the supplied generator, so picks can be made reproducible
+template<typename T, typename R>
+const typename T::value_type& pickRandom(const T& t, R& rng)
 {
-  std::ostringstream ret;
-  ret <<name<<"=[";
-  for(auto iter = v.begin(); iter != v.end(); ++iter) {
-    if(iter != v.begin())
-      ret<<',';
-    ret << '[' << xAdjust(iter - v.begin()) <<','<< yAdjust(*iter)<<']';
-  }
-  ret <<"];\n";
-  return ret.str();
+  return t[rng() % t.size()];
 }
 
-
-
-template<typename T>
-std::string jsonVectorD(const std::vector<T>& v, 
-		  std::function<double(double)> yAdjust = [](double d){return d;},
-		  std::function<double(int)> xAdjust = [](int i){return 1.0*i;})
-{
-  std::ostringstream ret;
-  ret<<"[";
-  for(auto iter = v.begin(); iter != v.end(); ++iter) {
-    if(iter != v.begin())
-      ret<<',';
-    ret << '[' << std::fixed<< xAdjust(iter - v.begin()) <<',';
-    ret.unsetf(std::ios_base::floatfield);
-    ret << yAdjust(*iter)<<']';
-  }
-  ret <<"]";
-  return ret.str();
-}
-
-template<typename T>
-std::string jsonVectorX(const std::vector<T>& v, 
-		  std::function<int(int)> xAdjust = [](int i){return i;})
-{
-  std::ostringstream ret;
-  ret<<"[";
-  for(auto iter = v.begin(); iter != v.end(); ++iter) {
-    if(iter != v.begin())
-      ret<<',';
-    ret << '[' << xAdjust(iter - v.begin()) <<',';
-    ret << *iter<<']';
-  }
-  ret <<"]";
-  return ret.str();
-}
-
-
 //! maps 'len' nucleotides from 'str' at offset offset to a 32 bit string. At most 16 nuclotides therefore!
 uint32_t kmerMapper(const std::string& str, int offset, int unsigned len);
+uint32_t kmerMapper(const char* str, int unsigned len);
 
 char DNAToAminoAcid(const char* s);
 const char* AminoAcidName(char c);
@@ -217,6 +165,7 @@ public:
     d_hashes.reserve(estimate);
   }
   void feedString(const std::string& str); //! do statistics on str
+  void feedString(const char* str, size_t len); //! do statistics on str
   void clear(); //! clean ourselves up
   typedef std::map<uint64_t,uint64_t> counts_t;
 
@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <string.h>
 #include "misc.hh"
+#include "dnakernels.hh"
 #include <boost/lexical_cast.hpp>
 using namespace std;
 
@@ -16,13 +17,7 @@ FASTQReader::FASTQReader(const std::string& str, unsigned int qoffset)
 
 bool FastQRead::exceedsQuality(unsigned int limit)
 {
-  uint8_t q;
-  for(string::size_type pos = 0 ; pos < d_quality.size(); ++pos) {
-    q = d_quality[pos];
-    if(q < limit)
-      return false;
-  }
-  return true;
+  return d_quality.empty() || minQuality(d_quality.c_str(), d_quality.size()) >= limit;
 }
 
 string FastQRead::getSangerQualityString() const
@@ -51,53 +46,168 @@ std::string FastQRead::getNameFromHeader() const
   return name;
 }
 
+//! snips off what we were told to, if that leaves anything
+void FASTQReader::trim(const char** line, size_t* len) const
+{
+  if((d_snipLeft || d_snipRight) && (d_snipLeft + d_snipRight < *len)) {
+    *line += d_snipLeft;
+    *len -= d_snipLeft + d_snipRight;
+  }
+}
+
+void FASTQReader::convertQuality(char* quality, size_t len) const
+{
+  const char* c = subtractQualityOffset(quality, len, d_qoffset);
+  if(c)
+    throw runtime_error("Attempting to parse a quality code of val "+boost::lexical_cast<string>((int)*c)+" which is < our quality offset");
+}
+
 unsigned int FASTQReader::getRead(FastQRead* fq)
 {
   uint64_t pos = d_reader->getUncPos();
-  char line[1024]="";
-  if(!d_reader->fgets(line, sizeof(line)))
+  const char* line;
+  size_t len;
+  if(!d_reader->getLine(&line, &len))
     return 0;
-  if(line[0] != '@')
-    throw runtime_error("Input not FASTQ, line: '"+string(line)+"'");
-
-  chomp(line);
-  fq->d_header.assign(line+1);
-
-  d_reader->fgets(line, sizeof(line));
-  chomp(line);
-  
-  if((d_snipLeft || d_snipRight) && (d_snipLeft + d_snipRight < strlen(line)))
-    fq->d_nucleotides.assign(line + d_snipLeft, strlen(line) -d_snipLeft-d_snipRight);
-  else
-    fq->d_nucleotides.assign(line);
-  d_reader->fgets(line, sizeof(line));
-  d_reader->fgets(line, sizeof(line));
+  if(!len || line[0] != '@')
+    throw runtime_error("Input not FASTQ, line: '"+string(line, len)+"'");
 
-  chomp(line);
+  fq->d_header.assign(line+1, len-1);
 
-  if((d_snipLeft || d_snipRight) && (d_snipLeft + d_snipRight < strlen(line)))
-    fq->d_quality.assign(line + d_snipLeft, strlen(line)-d_snipLeft-d_snipRight);
-  else
-    fq->d_quality.assign(line);
+  if(!d_reader->getLine(&line, &len))
+    throw runtime_error("Truncated FASTQ record for '"+fq->d_header+"'");
+  trim(&line, &len);
+  fq->d_nucleotides.assign(line, len);
 
-  for(auto& c : fq->d_quality) {
-    if((unsigned int)c < d_qoffset)
-      throw runtime_error("Attempting to parse a quality code of val "+boost::lexical_cast<string>((int)c)+" which is < our quality offset");
-    c -= d_qoffset;
-  }
+  if(!d_reader->getLine(&line, &len) || !d_reader->getLine(&line, &len))
+    throw runtime_error("Truncated FASTQ record for '"+fq->d_header+"'");
+  trim(&line, &len);
+  fq->d_quality.assign(line, len);
+  convertQuality(&fq->d_quality[0], fq->d_quality.size());
 
   fq->reversed=0;
   fq->position=pos;
   return d_reader->getUncPos() - pos;
 }
 
+unsigned int FASTQReader::getReads(ReadBatch* rb, unsigned int num)
+{
+  rb->clear();
+  uint64_t start = d_reader->getUncPos();
+  const char* line;
+  size_t len;
+  while(rb->d_index.size() < num) {
+    ReadBatch::Entry e;
+    e.position = d_reader->getUncPos();
+    e.reversed = false;
+    if(!d_reader->getLine(&line, &len))
+      break;
+    if(!len || line[0] != '@')
+      throw runtime_error("Input not FASTQ, line: '"+string(line, len)+"'");
+    e.header = rb->d_headers.size();
+    e.headerLen = len - 1;
+    rb->d_headers.append(line + 1, len - 1);
+
+    if(!d_reader->getLine(&line, &len))
+      throw runtime_error("Truncated FASTQ record for '"+rb->d_headers.substr(e.header)+"'");
+    trim(&line, &len);
+    e.nucleotides = rb->d_nucleotides.size();
+    e.len = len;
+    rb->d_nucleotides.append(line, len);
+
+    if(!d_reader->getLine(&line, &len) || !d_reader->getLine(&line, &len))
+      throw runtime_error("Truncated FASTQ record for '"+rb->d_headers.substr(e.header)+"'");
+    trim(&line, &len);
+    if(len != e.len)
+      throw runtime_error("Quality and nucleotide lengths differ in FASTQ record for '"+rb->d_headers.substr(e.header)+"'");
+    rb->d_qualities.append(line, len);
+    convertQuality(&rb->d_qualities[e.nucleotides], len);
+    rb->d_index.push_back(e);
+  }
+  rb->d_bytes = d_reader->getUncPos() - start;
+  return rb->d_index.size();
+}
+
+void ReadBatch::clear()
+{
+  d_headers.clear();
+  d_nucleotides.clear();
+  d_qualities.clear();
+  d_index.clear();
+  d_bytes = 0;
+}
+
+ReadBatch::View ReadBatch::operator[](size_t n) const
+{
+  const Entry& e = d_index[n];
+  return View{d_headers.c_str() + e.header, d_nucleotides.c_str() + e.nucleotides, d_qualities.c_str() + e.nucleotides,
+      e.headerLen, e.len, e.reversed, e.position};
+}
+
+void ReadBatch::add(const char* header, uint32_t headerLen, const char* nucleotides, const char* quality, uint32_t len, 
+		    bool reversed, uint64_t position)
+{
+  d_index.push_back({d_headers.size(), d_nucleotides.size(), headerLen, len, reversed, position});
+  d_headers.append(header, headerLen);
+  d_nucleotides.append(nucleotides, len);
+  d_qualities.append(quality, len);
+}
+
+void ReadBatch::add(const FastQRead& fq)
+{
+  if(fq.d_quality.size() != fq.d_nucleotides.size())
+    throw runtime_error("Quality and nucleotide lengths differ for '"+fq.d_header+"'");
+  add(fq.d_header.c_str(), fq.d_header.size(), fq.d_nucleotides.c_str(), fq.d_quality.c_str(), fq.d_nucleotides.size(),
+      fq.reversed, fq.position);
+}
+
+void ReadBatch::add(const View& v)
+{
+  // v might point into our own arenas, which might move as we append
+  if(v.header >= d_headers.c_str() && v.header < d_headers.c_str() + d_headers.size()) {
+    FastQRead fq;
+    v.copyTo(&fq);
+    add(fq);
+  }
+  else
+    add(v.header, v.headerLen, v.nucleotides, v.quality, v.len, v.reversed, v.position);
+}
+
+void ReadBatch::View::copyTo(FastQRead* fq) const
+{
+  fq->d_header.assign(header, headerLen);
+  fq->d_nucleotides.assign(nucleotides, len);
+  fq->d_quality.assign(quality, len);
+  fq->reversed = reversed;
+  fq->position = position;
+}
+
+static int compareSpans(const char* a, uint32_t alen, const char* b, uint32_t blen)
+{
+  int ret = memcmp(a, b, min(alen, blen));
+  if(ret)
+    return ret;
+  return alen < blen ? -1 : (alen > blen ? 1 : 0);
+}
+
+bool ReadBatch::View::operator<(const View& rhs) const
+{
+  int c = compareSpans(nucleotides, len, rhs.nucleotides, rhs.len);
+  if(c)
+    return c < 0;
+  c = compareSpans(quality, len, rhs.quality, rhs.len);
+  if(c)
+    return c < 0;
+  return std::tie(reversed, position) < std::tie(rhs.reversed, rhs.position);
+}
+
 uint64_t FASTQReader::estimateReads()
 {
   uint64_t pos = d_reader->getUncPos();
   FastQRead fqr;
   auto size = getRead(&fqr);
   seek(pos);
-  return d_reader->uncompressedSize() / size;
+  return d_reader->estimatedSize() / size;
 }
 
 unsigned int StereoFASTQReader::getRead(uint64_t pos, FastQRead* fq)
@@ -146,5 +256,15 @@ unsigned int StereoFASTQReader::getReadPair(FastQRead* fq1, FastQRead* fq2)
   return ret1;
 }
 
+unsigned int StereoFASTQReader::getReadPairs(ReadBatch* rb1, ReadBatch* rb2, unsigned int num)
+{
+  unsigned int ret = d_fq1.getReads(rb1, num);
+  if(d_fq2.getReads(rb2, ret) != ret)
+    throw runtime_error("Second FASTQ file of pair has fewer reads than the first one");
+  for(auto& e : rb2->d_index)
+    e.position |= (1ULL<<63);
+  return ret;
+}
+
 
 
@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdexcept>
+#include <vector>
+#include <tuple>
 #include "zstuff.hh"
 
 //! Represents a FastQRead. Can be reversed or not. 
@@ -27,6 +29,61 @@ struct FastQRead
 
 };
 
+/** Many reads in one go. Headers, nucleotides and qualities each live in one contiguous arena, with a table
+    of offsets on the side. Refilling a batch reuses its memory, so reading batches does not allocate
+    once the arenas have grown large enough. */
+class ReadBatch
+{
+public:
+  //! A read in a ReadBatch, pointing into its arenas. Cheap to copy, valid until the batch gets cleared or added to
+  struct View
+  {
+    const char* header;
+    const char* nucleotides;
+    const char* quality; //!< same length as nucleotides, already corrected for the quality offset
+    uint32_t headerLen, len;
+    bool reversed;
+    uint64_t position; //!< like FastQRead::position
+
+    std::string getNucleotides() const
+    {
+      return std::string(nucleotides, len);
+    }
+    void copyTo(FastQRead* fq) const; //!< reuses the strings in fq
+    bool operator<(const View& rhs) const; //!< same ordering as FastQRead
+  };
+
+  ReadBatch() : d_bytes(0) {}
+  void clear();
+  size_t size() const
+  {
+    return d_index.size();
+  }
+  View operator[](size_t n) const;
+  void add(const FastQRead& fq);
+  void add(const View& view);
+  //! how many bytes of input the reads in here took up
+  uint64_t bytes() const
+  {
+    return d_bytes;
+  }
+private:
+  friend class FASTQReader;
+  friend class StereoFASTQReader;
+  struct Entry
+  {
+    uint64_t header, nucleotides; //!< offsets into the arenas, quality shares the nucleotides offset
+    uint32_t headerLen, len;
+    bool reversed;
+    uint64_t position;
+  };
+  void add(const char* header, uint32_t headerLen, const char* nucleotides, const char* quality, uint32_t len, 
+	   bool reversed, uint64_t position);
+  std::string d_headers, d_nucleotides, d_qualities;
+  std::vector<Entry> d_index;
+  uint64_t d_bytes;
+};
+
 //! Reads a single FASTQ file, and can seek in it. Does adapation of quality scores (Sanger by default) and and can also snip off first n or last n bases.
 class FASTQReader
 {
@@ -41,9 +98,13 @@ public:
   {
     d_reader->seek(pos);
   }
+  //! from the size of the next read. Does not read the rest of compressed input to find out how big it is
   uint64_t estimateReads();
   unsigned int getRead(FastQRead* fq); //!< Get a FastQRead, return number of bytes read
+  unsigned int getReads(ReadBatch* rb, unsigned int num); //!< Refill rb with up to num reads, returns how many we got
 private:
+  void trim(const char** line, size_t* len) const;
+  void convertQuality(char* quality, size_t len) const;
   unsigned int d_qoffset;
   unsigned int d_snipLeft, d_snipRight;
   std::unique_ptr<LineReader> d_reader;
@@ -62,6 +123,8 @@ public:
   uint64_t estimateReads();
   unsigned int getRead(uint64_t pos, FastQRead* fq2);
   unsigned int getReadPair(FastQRead* fq1, FastQRead* fq2);
+  //! Refill rb1 and rb2 with up to num pairs, returns how many we got
+  unsigned int getReadPairs(ReadBatch* rb1, ReadBatch* rb2, unsigned int num);
 private:
   FASTQReader d_fq1, d_fq2;
   static uint64_t s_mask;
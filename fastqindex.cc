@@ -51,26 +51,25 @@ unique_ptr<vector<HashedPos> > indexFASTQ(FASTQReader* fqreader, const std::stri
 std::map<pair<FASTQReader*, uint64_t>, FastQRead> g_cache;
 
 std::unordered_set<uint32_t> g_skip;
-vector<FastQRead> getConsensusMatches(const std::string& consensus, const map<FASTQReader*, unique_ptr<vector<HashedPos> > >& fhpos, int chunklen)
+void getConsensusMatches(const std::string& consensus, const map<FASTQReader*, unique_ptr<vector<HashedPos> > >& fhpos, int chunklen, ReadBatch* ret)
 {
-  vector<FastQRead> ret;
+  ret->clear();
   if(consensus.find('N') != string::npos)
-    return ret;
+    return;
 
   uint32_t h = qhash(consensus.c_str(), chunklen, 0);
   if(g_skip.count(h))
-    return ret;
+    return;
 
   //  cout<<"Looking for "<<consensus<<endl;
   HashedPos fnd({h, 0});
   
-  vector<FastQRead> options;
   bool hadSomething=false;
+  FastQRead fqr;
   for(auto& hpos : fhpos) {
     auto range = equal_range(hpos.second->begin(), hpos.second->end(), fnd);
     for(;range.first != range.second; ++range.first) {
       hadSomething=true;
-      FastQRead fqr;
       //      cout<<"\tFound potential hit at offset "<<range.first->position<<"!"<<endl;
       // XXX THIS DISABLES THE CACHE, also other lines below
       if(0 && g_cache.count(make_pair(hpos.first, (uint64_t)range.first->position))) {
@@ -91,10 +90,9 @@ vector<FastQRead> getConsensusMatches(const std::string& consensus, const map<FA
       }
       else
 	; // g_cache[make_pair(hpos.first, (uint64_t)range.first->position)] = fqr;
-      ret.push_back(fqr);
+      ret->add(fqr);
     }
   }
   if(!hadSomething)
     g_skip.insert(h);
-  return ret;
 }
@@ -18,4 +18,5 @@ struct HashedPos
 
 std::unique_ptr<std::vector<HashedPos> > indexFASTQ(FASTQReader* fqreader, const std::string& fname, int chunklen);
 
-std::vector<FastQRead> getConsensusMatches(const std::string& consensus, const std::map<FASTQReader*, std::unique_ptr<std::vector<HashedPos> > >& fhpos, int chunklen);
+//! refills ret with the reads that start with the first chunklen nucleotides of consensus, reversed if needed
+void getConsensusMatches(const std::string& consensus, const std::map<FASTQReader*, std::unique_ptr<std::vector<HashedPos> > >& fhpos, int chunklen, ReadBatch* ret);
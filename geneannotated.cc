@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <algorithm>
 #include <map>
+#include <functional>
 #include "misc.hh"
 #include <boost/algorithm/string.hpp>
 using namespace std;
@@ -90,17 +91,52 @@ GeneAnnotationReader::GeneAnnotationReader(const std::string& fname)
       
   no:;
   }
+  fclose(fp);
+  buildIndex();
 }
 
-vector<GeneAnnotation> GeneAnnotationReader::lookup(uint64_t pos)
+void GeneAnnotationReader::buildIndex()
 {
-  vector<GeneAnnotation> ret;
+  d_intervals.clear();
+  for(unsigned int n = 0; n < d_gas.size(); ++n)
+    d_intervals.push_back({d_gas[n].startPos, d_gas[n].stopPos, d_gas[n].stopPos, n});
+  sort(d_intervals.begin(), d_intervals.end(), [](const Interval& a, const Interval& b) {
+      return a.startPos < b.startPos;
+    });
 
-  for(const auto& a : d_gas) {
-    if(a.startPos <= pos && pos <= a.stopPos)
-      ret.push_back(a);
+  // each range gets the furthest stop of its two halves and its middle, bottom up
+  std::function<uint64_t(unsigned int, unsigned int)> fill = [&](unsigned int lo, unsigned int hi) -> uint64_t {
+    if(lo >= hi)
+      return 0;
+    unsigned int mid = lo + (hi - lo) / 2;
+    auto& root = d_intervals[mid];
+    root.maxStop = max(root.stopPos, max(fill(lo, mid), fill(mid + 1, hi)));
+    return root.maxStop;
+  };
+  fill(0, d_intervals.size());
+}
+
+void GeneAnnotationReader::lookup(uint64_t pos, unsigned int lo, unsigned int hi, vector<const GeneAnnotation*>* ret) const
+{
+  while(lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    const auto& root = d_intervals[mid];
+    if(root.maxStop < pos) // all of this range ends before pos
+      return;
+    lookup(pos, lo, mid, ret);
+    if(root.startPos > pos) // and so do all after it
+      return;
+    if(pos <= root.stopPos)
+      ret->push_back(&d_gas[root.index]);
+    lo = mid + 1;
   }
-  return ret;
+}
+
+void GeneAnnotationReader::lookup(uint64_t pos, vector<const GeneAnnotation*>* ret) const
+{
+  ret->clear();
+  lookup(pos, 0, d_intervals.size(), ret);
+  sort(ret->begin(), ret->end()); // d_gas is in file order
 }
 
 void GeneAnnotationReader::parseGenBank(const std::string& fname)
@@ -126,5 +162,7 @@ void GeneAnnotationReader::parseGenBank(const std::string& fname)
 
     genbank+=line+"\n";
   }
+  fclose(fp);
   d_gas=parseGenBankString(genbank);
+  buildIndex();
 }
@@ -25,13 +25,26 @@ class GeneAnnotationReader
 {
 public:
   GeneAnnotationReader(const std::string& fname); //!< Parse GFF3 from fname
-  std::vector<GeneAnnotation> lookup(uint64_t pos); //!< Get all annotations for pos
+  //! all annotations covering pos, in the order of the file. Points into us, clears ret first
+  void lookup(uint64_t pos, std::vector<const GeneAnnotation*>* ret) const;
   uint64_t size() const { return d_gas.size(); } //!< Number of annotations known
 
 private:
   typedef std::vector<GeneAnnotation> gas_t;
   void parseGenBank(const std::string& fname);
+  void buildIndex();
+  void lookup(uint64_t pos, unsigned int lo, unsigned int hi, std::vector<const GeneAnnotation*>* ret) const;
   gas_t d_gas;
+
+  /** d_gas by start position, as an implicit tree: the middle of each range of entries is the root of it, and
+      knows where the last of that range stops, so lookups skip ranges that end before pos */
+  struct Interval
+  {
+    uint64_t startPos, stopPos;
+    uint64_t maxStop; //!< of the range this is the middle of
+    unsigned int index; //!< in d_gas
+  };
+  std::vector<Interval> d_intervals;
 };
 
 std::vector<GeneAnnotation> parseGenBankString(const std::string& bank);
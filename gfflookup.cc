@@ -15,14 +15,19 @@ using namespace std;
 int main(int argc, char **argv)
 {
   if(argc < 3) {
-    cerr<<"Syntax: gfflookup annotations.gff refgenome.fna offset1 [offset2]"<<endl;
+    cerr<<"Syntax: gfflookup annotations.gff refgenome.fna [offset1] [offset2]"<<endl;
+    cerr<<"Without offsets, reads them from standard input, one per line"<<endl;
     return EXIT_FAILURE;
   }
+  ios_base::sync_with_stdio(false);
   GeneAnnotationReader gar(argv[1]);
   ReferenceGenome rg(argv[2]);
-  for(int n = 3; n < argc; ++n) {
-    for(const auto& ga : gar.lookup(atoi(argv[n]))) {
-      cout<<atoi(argv[n])<<'\t'<<ga.startPos<<" - "<<ga.stopPos<<'\t'<<ga.name<<'\t'<<ga.tag<< '\t'<<(ga.strand ? '+' : '-')<<'\t'<<(ga.gene ? "gene" : "") << endl;
+  vector<const GeneAnnotation*> gas;
+  auto report = [&](uint64_t offset) {
+    gar.lookup(offset, &gas);
+    for(auto annotation : gas) {
+      const auto& ga = *annotation;
+      cout<<offset<<'\t'<<ga.startPos<<" - "<<ga.stopPos<<'\t'<<ga.name<<'\t'<<ga.tag<< '\t'<<(ga.strand ? '+' : '-')<<'\t'<<(ga.gene ? "gene" : "") << '\n';
       continue;
 
 
@@ -37,7 +42,15 @@ int main(int argc, char **argv)
       	cout<<endl;
       }
     }
+  };
 
-    
+  if(argc == 3) { // batch mode
+    string line;
+    while(getline(cin, line)) {
+      if(!line.empty())
+	report(atoll(line.c_str()));
+    }
   }
+  for(int n = 3; n < argc; ++n)
+    report(atoi(argv[n]));
 }
@@ -0,0 +1 @@
+#define GIT_HASH "213f2a9+"
@@ -0,0 +1,289 @@
+#include "kmerindex.hh"
+#include <stdexcept>
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include <boost/lexical_cast.hpp>
+extern "C" {
+#include "hash.h"
+}
+#include "misc.hh"
+
+using namespace std;
+
+//! what a saved KmerIndex starts with, followed by the offsets and then the positions
+struct KmerIndexHeader
+{
+  char magic[8];
+  uint32_t k;
+  uint32_t posSize; //!< sizeof(dnapos_t)
+  uint64_t genomeSize, genomeHash;
+  uint64_t numPositions;
+  uint64_t checksum; //!< over the offsets and positions
+};
+
+static inline int nucleotideCode(char c)
+{
+  switch(c) {
+  case 'A': return 0;
+  case 'C': return 1;
+  case 'G': return 2;
+  case 'T': return 3;
+  default: return -1;
+  }
+}
+
+//! calls f(pos, kmer) for each position from begin up to end where k nucleotides of ACGT start
+template<typename F>
+static void forEachKmer(const string& genome, unsigned int k, uint64_t begin, uint64_t end, F f)
+{
+  const uint32_t mask = (1U << (2*k)) - 1;
+  uint32_t kmer = 0;
+  unsigned int valid = 0;
+  // the k-mers starting near end finish beyond it
+  for(uint64_t pos = begin; pos < min(end + k - 1, (uint64_t)genome.size()); ++pos) {
+    int code = nucleotideCode(genome[pos]);
+    if(code < 0) {
+      valid = 0;
+      continue;
+    }
+    kmer = ((kmer << 2) | code) & mask;
+    if(++valid >= k)
+      f(pos + 1 - k, kmer);
+  }
+}
+
+/* Builds in three sweeps, with the genome cut up in one chunk per thread:
+   1) each thread counts the k-mers starting in its chunk
+   2) per range of k-mers, threads add up those counts into where each k-mer starts, and where the positions
+      each chunk has of it start within that
+   3) each thread places the positions of its chunk
+   Chunks are in genome order, so within a k-mer positions end up in ascending order, and the result does not
+   depend on numThreads */
+KmerIndex::KmerIndex(const string& genome, unsigned int k, unsigned int numThreads) : d_k(k), d_map(0), d_mapSize(0)
+{
+  if(!k || k > s_maxK)
+    throw runtime_error("Can't index k-mers of length "+boost::lexical_cast<string>(k));
+  numThreads = max(1U, numThreads);
+  const uint64_t numKmers = 1ULL << (2*k);
+  const uint64_t size = genome.size();
+  auto chunk = [&](unsigned int t) {
+    return make_pair(size * t / numThreads, size * (t + 1) / numThreads);
+  };
+  auto range = [&](unsigned int t) { 
+    return make_pair((uint32_t)(numKmers * t / numThreads), (uint32_t)(numKmers * (t + 1) / numThreads));
+  };
+
+  vector<vector<uint32_t> > cursors(numThreads); // counts per chunk at first
+  runThreads(numThreads, [&](unsigned int t) {
+      auto& counts = cursors[t];
+      counts.assign(numKmers, 0);
+      auto c = chunk(t);
+      forEachKmer(genome, k, c.first, c.second, [&counts](uint64_t, uint32_t kmer) {
+	  counts[kmer]++;
+	});
+    });
+
+  auto& offsets = d_offsetStore;
+  offsets.resize(numKmers + 1);
+  vector<uint64_t> rangeTotals(numThreads);
+  runThreads(numThreads, [&](unsigned int t) {
+      auto r = range(t);
+      uint64_t sum = 0; // for now, offsets within our range
+      for(uint32_t kmer = r.first; kmer < r.second; ++kmer) {
+	offsets[kmer] = sum;
+	for(auto& counts : cursors) {
+	  uint32_t count = counts[kmer];
+	  counts[kmer] = sum;
+	  sum += count;
+	}
+      }
+      rangeTotals[t] = sum;
+    });
+  uint64_t total = 0;
+  for(auto& rt : rangeTotals) {
+    uint64_t rangeTotal = rt;
+    rt = total; // now the base of that range
+    total += rangeTotal;
+  }
+  if(total > 0xffffffff)
+    throw runtime_error("Genome too large to index");
+  offsets[numKmers] = total;
+  runThreads(numThreads, [&](unsigned int t) {
+      auto r = range(t);
+      for(uint32_t kmer = r.first; kmer < r.second; ++kmer) {
+	offsets[kmer] += rangeTotals[t];
+	for(auto& c : cursors)
+	  c[kmer] += rangeTotals[t];
+      }
+    });
+
+  auto& positions = d_positionStore;
+  positions.resize(total);
+  runThreads(numThreads, [&](unsigned int t) {
+      auto& cur = cursors[t];
+      auto c = chunk(t);
+      forEachKmer(genome, k, c.first, c.second, [&](uint64_t pos, uint32_t kmer) {
+	  positions[cur[kmer]++] = pos;
+	});
+    });
+
+  d_offsets = offsets.data();
+  d_positions = positions.data();
+  d_numPositions = positions.size();
+}
+
+KmerIndex::~KmerIndex()
+{
+#ifndef _WIN32
+  if(d_map)
+    munmap(d_map, d_mapSize);
+#endif
+}
+
+string KmerIndex::indexName(const string& fname, unsigned int k)
+{
+  return fname+".k"+boost::lexical_cast<string>(k)+".idx";
+}
+
+uint64_t KmerIndex::checksum() const
+{
+  uint64_t ret = hash64_any(d_offsets, ((1ULL << (2*d_k)) + 1) * sizeof(uint32_t), 0);
+  return hash64_any(d_positions, d_numPositions * sizeof(dnapos_t), ret);
+}
+
+unique_ptr<KmerIndex> KmerIndex::load(const string& fname, const string& genome, unsigned int k)
+{
+  unique_ptr<KmerIndex> ret;
+  if(!k || k > s_maxK)
+    return ret;
+  FILE* fp = fopen(fname.c_str(), "rb");
+  if(!fp)
+    return ret;
+  std::shared_ptr<FILE> guard(fp, fclose);
+  KmerIndexHeader kih;
+  struct stat st;
+  if(fread(&kih, sizeof(kih), 1, fp) != 1 || memcmp(kih.magic, "AKIDX001", 8) || kih.k != k || kih.posSize != sizeof(dnapos_t) ||
+     kih.genomeSize != genome.size() || kih.genomeHash != hash64_any(genome.c_str(), genome.size(), 0) || 
+     fstat(fileno(fp), &st) < 0)
+    return ret;
+  uint64_t numOffsets = (1ULL << (2*k)) + 1;
+  if((uint64_t)st.st_size != sizeof(kih) + numOffsets * sizeof(uint32_t) + kih.numPositions * sizeof(dnapos_t))
+    return ret;
+
+  ret.reset(new KmerIndex);
+  ret->d_k = k;
+  ret->d_numPositions = kih.numPositions;
+#ifndef _WIN32
+  void* p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+  if(p != MAP_FAILED) {
+    ret->d_map = p;
+    ret->d_mapSize = st.st_size;
+    ret->d_offsets = (const uint32_t*)((const char*)p + sizeof(kih));
+    ret->d_positions = (const dnapos_t*)(ret->d_offsets + numOffsets);
+  }
+#endif
+  if(!ret->d_map) {
+    ret->d_offsetStore.resize(numOffsets);
+    ret->d_positionStore.resize(kih.numPositions);
+    if(fread(ret->d_offsetStore.data(), sizeof(uint32_t), numOffsets, fp) != numOffsets ||
+       fread(ret->d_positionStore.data(), sizeof(dnapos_t), kih.numPositions, fp) != kih.numPositions) 
+      return unique_ptr<KmerIndex>();
+    ret->d_offsets = ret->d_offsetStore.data();
+    ret->d_positions = ret->d_positionStore.data();
+  }
+  if(ret->d_offsets[numOffsets - 1] != kih.numPositions || ret->checksum() != kih.checksum)
+    ret.reset();
+  return ret;
+}
+
+void KmerIndex::save(const string& fname, const string& genome) const
+{
+  KmerIndexHeader kih;
+  memset(&kih, 0, sizeof(kih));
+  memcpy(kih.magic, "AKIDX001", 8);
+  kih.k = d_k;
+  kih.posSize = sizeof(dnapos_t);
+  kih.genomeSize = genome.size();
+  kih.genomeHash = hash64_any(genome.c_str(), genome.size(), 0);
+  kih.numPositions = d_numPositions;
+  kih.checksum = checksum();
+
+  // concurrent runs might be saving the same index
+  string tmpname = fname+"."+boost::lexical_cast<string>(getpid())+".tmp";
+  FILE* fp = fopen(tmpname.c_str(), "wb");
+  if(!fp)
+    return;
+  uint64_t numOffsets = (1ULL << (2*d_k)) + 1;
+  bool ok = fwrite(&kih, sizeof(kih), 1, fp) == 1 && fwrite(d_offsets, sizeof(uint32_t), numOffsets, fp) == numOffsets &&
+    fwrite(d_positions, sizeof(dnapos_t), d_numPositions, fp) == d_numPositions;
+  ok = !fclose(fp) && ok;
+  if(!ok || rename(tmpname.c_str(), fname.c_str()) < 0)
+    unlink(tmpname.c_str());
+}
+
+unique_ptr<KmerIndex> KmerIndex::loadOrBuild(const string& fname, const string& genome, unsigned int k, unsigned int numThreads)
+{
+  unique_ptr<KmerIndex> ret;
+  if(!fname.empty() && (ret = load(fname, genome, k)))
+    return ret;
+  ret.reset(new KmerIndex(genome, k, numThreads));
+  if(!fname.empty())
+    ret->save(fname, genome);
+  return ret;
+}
+
+unsigned int KmerIndex::chooseK(unsigned int shortest, uint64_t genomeSize)
+{
+  // longer k-mers make for fewer candidates, but more buckets than there are positions only cost memory
+  unsigned int k = min(shortest, s_maxK);
+  while(k > 1 && (1ULL << (2*(k-1))) >= genomeSize)
+    --k;
+  return k;
+}
+
+bool KmerIndex::encode(const char* str, unsigned int k, uint32_t* kmer)
+{
+  *kmer = 0;
+  for(unsigned int n = 0; n < k; ++n) {
+    int code = nucleotideCode(str[n]);
+    if(code < 0)
+      return false;
+    *kmer = (*kmer << 2) | code;
+  }
+  return true;
+}
+
+void KmerIndex::lookup(const string& genome, const char* str, unsigned int len, vector<dnapos_t>* ret) const
+{
+  if(len < d_k)
+    throw runtime_error("Attempting to look up "+boost::lexical_cast<string>(len)+" nucleotides in an index of "+boost::lexical_cast<string>(d_k)+"-mers");
+  uint32_t kmer;
+  if(!encode(str, d_k, &kmer))
+    return;
+  // the k-mer at the end of str might be rarer, then we check fewer candidates
+  unsigned int offset = 0;
+  uint32_t last;
+  if(len > d_k && encode(str + len - d_k, d_k, &last) &&
+     d_offsets[last + 1] - d_offsets[last] < d_offsets[kmer + 1] - d_offsets[kmer]) {
+    kmer = last;
+    offset = len - d_k;
+  }
+
+  for(uint32_t n = d_offsets[kmer]; n != d_offsets[kmer + 1]; ++n) {
+    dnapos_t pos = d_positions[n];
+    if(pos < offset)
+      continue;
+    pos -= offset;
+    if(pos + len > genome.size())
+      continue;
+    if(len == d_k || !memcmp(genome.c_str() + pos, str, len))
+      ret->push_back(pos);
+  }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include "antonie.hh"
+
+/** Index of where each k-mer occurs in a genome, addressed directly by the k-mer in 2 bits per nucleotide,
+    so a lookup touches d_offsets once and then reads its positions in one go. Any string of at least k
+    nucleotides can be looked up, candidates get checked against the genome itself. Windows holding anything
+    but ACGT in their first k nucleotides are not indexed. 
+
+    An index can be saved to a file, and later loaded from there by mapping it into memory, which is a lot
+    faster than building it, and lets concurrent runs share it. */
+class KmerIndex
+{
+public:
+  static const unsigned int s_maxK = 12; //!< 4^12 offsets take 64MB already
+
+  KmerIndex(const std::string& genome, unsigned int k, unsigned int numThreads=1);
+  ~KmerIndex();
+  KmerIndex(const KmerIndex&) = delete;
+  KmerIndex& operator=(const KmerIndex&) = delete;
+
+  //! where we save the index of k-mers of length k of the FASTA file fname
+  static std::string indexName(const std::string& fname, unsigned int k);
+  //! the index saved in fname, if it is intact and for this genome and k. nullptr otherwise, which is fine
+  static std::unique_ptr<KmerIndex> load(const std::string& fname, const std::string& genome, unsigned int k);
+  //! best effort, genome has to be the one we were built from
+  void save(const std::string& fname, const std::string& genome) const;
+  //! the index saved in fname if it is there and fits, otherwise builds one and saves it there. Empty fname just builds
+  static std::unique_ptr<KmerIndex> loadOrBuild(const std::string& fname, const std::string& genome, unsigned int k, unsigned int numThreads=1);
+  //! k-mer length for looking up strings of shortest and longer: as long as possible, but with no more buckets than genomeSize needs
+  static unsigned int chooseK(unsigned int shortest, uint64_t genomeSize);
+
+  unsigned int k() const
+  {
+    return d_k;
+  }
+  //! appends the positions in genome where str starts, in ascending order. genome must be the one we were built from
+  void lookup(const std::string& genome, const char* str, unsigned int len, std::vector<dnapos_t>* ret) const;
+
+  //! 2 bits per nucleotide, false if str has anything but ACGT in its first k
+  static bool encode(const char* str, unsigned int k, uint32_t* kmer);
+private:
+  KmerIndex() : d_map(0), d_mapSize(0) {}
+  uint64_t checksum() const;
+  unsigned int d_k;
+  std::vector<uint32_t> d_offsetStore;
+  std::vector<dnapos_t> d_positionStore;
+  const uint32_t* d_offsets; //!< 4^k + 1 of them, positions of kmer are d_positions[d_offsets[kmer]] up to d_offsets[kmer+1]
+  const dnapos_t* d_positions; //!< in our stores, or in d_map
+  uint64_t d_numPositions;
+  void* d_map;
+  size_t d_mapSize;
+};
@@ -0,0 +1,201 @@
+#include "mappingworker.hh"
+#include <random>
+#include <math.h>
+#include <stdexcept>
+#include "dnamisc.hh"
+#include "dnakernels.hh"
+
+extern "C" {
+#include "hash.h"
+}
+
+using namespace std;
+
+/* The primary worker tallies straight into the ReferenceGenome s, the others get their own
+   MappingStats which merge() adds to those of the primary */
+MappingWorker::MappingWorker(vector<unique_ptr<ReferenceGenome> >& refgens, const ReferencePanel& panel, unsigned int keylen, int qlimit, unsigned int maxreadsize, uint32_t seed, bool primary, bool writeBAM,
+			     unsigned int window, unsigned int searchWindow) :
+  d_withAny(0), d_found(0), d_goodPairMatches(0), d_badPairMatches(0), d_mateSearchMatches(0),
+  d_qstats(maxreadsize), d_qcounts(256), d_qqcounts(256), d_gchisto(maxreadsize+1),
+  d_refgens(refgens), d_panel(panel), d_voter(panel, keylen), d_bam(writeBAM ? &d_bamqueue : 0), d_keylen(keylen), d_qlimit(qlimit), d_seed(seed), d_window(window), d_searchWindow(searchWindow)
+{
+  for(auto& rg : refgens) {
+    if(primary) {
+      d_stats.push_back(rg.get());
+      continue;
+    }
+    d_ownStats.emplace_back(new MappingStats);
+    d_ownStats.back()->sizeLike(*rg);
+    d_stats.push_back(d_ownStats.back().get());
+  }
+}
+
+MappingStats& MappingWorker::stats(const ReferenceGenome* rg)
+{
+  for(unsigned int n = 0; n < d_refgens.size(); ++n)
+    if(d_refgens[n].get() == rg)
+      return *d_stats[n];
+  throw runtime_error("Mapping to a reference genome we don't know about");
+}
+
+void MappingWorker::mapBatch(const PairBatch& batch)
+{
+  for(size_t i = 0; i < batch.reads[0].size(); ++i) {
+    for(unsigned int paircount = 0; paircount < 2; ++paircount) {
+      batch.reads[paircount][i].copyTo(&d_pair.fqfrag[paircount]);
+      d_pair.dup[paircount] = batch.dup[paircount][i];
+    }
+    mapPair(d_pair);
+  }
+}
+
+void MappingWorker::mapPair(ReadPair& rp)
+{
+  // every pair gets its own generator, so our choices do not depend on which thread maps it
+  std::minstd_rand rng(qhash(&rp.fqfrag[0].position, 1, d_seed));
+  FastQRead& fqfrag1(rp.fqfrag[0]);
+  FastQRead& fqfrag2(rp.fqfrag[1]);
+  bool dup1(rp.dup[0]), dup2(rp.dup[1]);
+  dnapos_t pos;
+
+  auto& pairpositions = d_pairPositions;
+  bool needSearch[2] = {false, false}; // no exact match, but worth looking for
+  for(unsigned int paircount=0; paircount < 2; ++paircount) {
+    pairpositions[paircount].clear();
+    FastQRead& fqfrag(rp.fqfrag[paircount]);
+    if(fqfrag.d_quality.size() > d_qstats.size()) // longer than anything we sampled
+      d_qstats.resize(fqfrag.d_quality.size());
+    for(string::size_type pos = 0 ; pos < fqfrag.d_quality.size(); ++pos) {
+      int i = fqfrag.d_quality[pos];
+      double err = qToErr(i);
+      d_qstat(err);
+      d_qstats[pos](err);
+      d_qcounts[i]++;
+    }
+    if(rp.dup[paircount])
+      continue;
+      
+    NucleotideCounts counts = countNucleotides(fqfrag.d_nucleotides.c_str(), fqfrag.d_nucleotides.size());
+    if(fqfrag.d_nucleotides.size() >= d_gchisto.size())
+      d_gchisto.resize(fqfrag.d_nucleotides.size() + 1);
+    d_gchisto[round(fqfrag.d_nucleotides.size()*counts.gcFraction())]++;
+      
+    if(counts.n) {
+      // unfoundReads.push_back(fqfrag.position); // will fail elsewhere and get filed there
+      d_withAny++;
+      continue;
+    }
+    d_panel.getAllReadPosBoth(&fqfrag, &pairpositions[paircount], &d_scratch.positions);
+    needSearch[paircount] = pairpositions[paircount].empty();
+  }
+
+  // a mate found exactly in only a few places tells us where to look for the other read
+  for(unsigned int paircount=0; paircount < 2; ++paircount) {
+    if(!needSearch[paircount])
+      continue;
+    FastQRead* fqfrag = &rp.fqfrag[paircount];
+    const auto& anchors = pairpositions[1 - paircount];
+    if(!needSearch[1 - paircount] && !anchors.empty() && anchors.size() <= s_maxAnchors) {
+      mateSearch(fqfrag, anchors, d_searchWindow, d_scratch, d_qlimit, &pairpositions[paircount]);
+      if(!pairpositions[paircount].empty()) {
+	d_mateSearchMatches++;
+	continue;
+      }
+    }
+    fuzzyFind(fqfrag, d_panel, d_voter, d_scratch, d_keylen, d_qlimit, &pairpositions[paircount]);
+  }
+
+  if(bestPairs(pairpositions[0], pairpositions[1], d_window, &d_scratch.matchPairs) >= 0) {
+    const auto& chosen = pickRandom(d_scratch.matchPairs, rng);
+    d_goodPairMatches++;
+    int distance = pairDistance(chosen, fqfrag1.d_nucleotides.length());
+
+    if(distance >= 0)
+      d_insertSizes.add(distance);
+    auto& ms = stats(chosen.second.rg);
+    for(int paircount = 0 ; paircount < 2; ++paircount) {
+      auto fqfrag = paircount ? &fqfrag2 : &fqfrag1;
+      auto dup = paircount ? dup2 : dup1,
+	otherDup = paircount? dup1 : dup2;
+      pos = paircount ? chosen.second.pos : chosen.first.pos;
+
+      if((paircount ? chosen.second.reverse : chosen.first.reverse) != fqfrag->reversed)
+	fqfrag->reverse();
+
+      if(otherDup && !dup) {
+	MapToReference(d_scratch, *chosen.second.rg, ms, pos, *fqfrag, d_qlimit, d_bam, &d_qqcounts);
+      }
+      else if(!otherDup && !dup) {
+	dnapos_t alignedPos;
+	if(MapToReference(d_scratch, *chosen.second.rg, ms, pos, *fqfrag, d_qlimit, 0, &d_qqcounts, &d_scratch.cigar, &alignedPos) && d_bam) {
+	  dnapos_t panelOffset = chosen.second.rg->d_panelOffset;
+	  d_bam->qwrite(panelOffset + alignedPos, *fqfrag, d_scratch.cigar, 3 + (paircount ? 0x80 : 0x40),
+			    "=", 
+			    panelOffset + (paircount ? chosen.first.pos : chosen.second.pos), 
+			    (chosen.first.reverse ^ (bool)paircount) ? -distance : distance);
+	}
+      }
+      d_found++;
+    }
+  }
+  else {
+    //      cout<<"No pair matches, need to map individually: "<<endl;
+    d_badPairMatches++;
+    for(unsigned int paircount = 0; paircount < 2; ++paircount) {
+      if(paircount ? dup2 : dup1)
+	continue;
+	
+      // the best scoring ones, in the order we found them
+      auto& picks = d_scratch.picks;
+      picks.clear();
+      for(const auto& match: pairpositions[paircount]) {
+	if(!picks.empty() && match.score > picks.front().score)
+	  continue;
+	if(!picks.empty() && match.score < picks.front().score)
+	  picks.clear();
+	picks.push_back(match);
+      }
+      FastQRead* fqfrag = paircount ? &fqfrag2 : &fqfrag1;
+      if(picks.empty()) {
+	d_unfoundReads.push_back(fqfrag->position);
+	continue;
+      }
+      auto pick = pickRandom(picks, rng);
+
+      if(fqfrag->reversed != pick.reverse)
+	fqfrag->reverse();
+
+      MapToReference(d_scratch, *pick.rg, stats(pick.rg), pick.pos, *fqfrag, d_qlimit, d_bam, &d_qqcounts);
+      d_found++;
+    }
+  } 
+}
+
+void MappingWorker::merge(MappingWorker& rhs)
+{
+  d_withAny += rhs.d_withAny;
+  d_found += rhs.d_found;
+  d_goodPairMatches += rhs.d_goodPairMatches;
+  d_badPairMatches += rhs.d_badPairMatches;
+  d_mateSearchMatches += rhs.d_mateSearchMatches;
+  if(rhs.d_qstats.size() > d_qstats.size())
+    d_qstats.resize(rhs.d_qstats.size());
+  for(unsigned int n = 0; n < rhs.d_qstats.size(); ++n)
+    d_qstats[n].merge(rhs.d_qstats[n]);
+  d_qstat.merge(rhs.d_qstat);
+  for(unsigned int n = 0; n < d_qcounts.size(); ++n)
+    d_qcounts[n] += rhs.d_qcounts[n];
+  d_unfoundReads.insert(d_unfoundReads.end(), rhs.d_unfoundReads.begin(), rhs.d_unfoundReads.end());
+  for(unsigned int n = 0; n < d_qqcounts.size(); ++n) {
+    d_qqcounts[n].correct += rhs.d_qqcounts[n].correct;
+    d_qqcounts[n].incorrect += rhs.d_qqcounts[n].incorrect;
+  }
+  if(rhs.d_gchisto.size() > d_gchisto.size())
+    d_gchisto.resize(rhs.d_gchisto.size());
+  for(unsigned int n = 0; n < rhs.d_gchisto.size(); ++n)
+    d_gchisto[n] += rhs.d_gchisto[n];
+  d_insertSizes.merge(rhs.d_insertSizes);
+  d_bamqueue.merge(rhs.d_bamqueue);
+  for(unsigned int n = 0; n < d_stats.size(); ++n)
+    d_stats[n]->merge(*rhs.d_stats[n]);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include "misc.hh"
+#include "fastq.hh"
+#include "refgenome.hh"
+#include "pairing.hh"
+#include "readsearch.hh"
+#include "saminfra.hh"
+
+typedef std::vector<VarMeanEstimator> qstats_t;
+
+//! A pair of reads on its way to a MappingWorker. Duplicate filtering depends on read order, so it happens while reading
+struct ReadPair
+{
+  FastQRead fqfrag[2];
+  bool dup[2];
+};
+
+//! A number of read pairs that get handed to a worker thread in one go. Gets recycled, so its arenas keep their allocations
+struct PairBatch
+{
+  ReadBatch reads[2];
+  std::vector<bool> dup[2];
+};
+
+//! Maps read pairs, tallying into its own statistics so several can run in parallel. merge() combines them afterwards
+class MappingWorker
+{
+public:
+  /** reads of a pair go together if closer than window, a read gets looked for within searchWindow of its mate first.
+      With writeBAM false, d_bamqueue stays empty */
+  MappingWorker(std::vector<std::unique_ptr<ReferenceGenome> >& refgens, const ReferencePanel& panel, unsigned int keylen, int qlimit, unsigned int maxreadsize, uint32_t seed, bool primary, bool writeBAM,
+		unsigned int window, unsigned int searchWindow);
+  void mapPair(ReadPair& rp);
+  void mapBatch(const PairBatch& batch);
+  void merge(MappingWorker& rhs);
+
+  uint64_t d_withAny, d_found, d_goodPairMatches, d_badPairMatches;
+  uint64_t d_mateSearchMatches; //!< reads found near their mate, without a search of all references
+  qstats_t d_qstats;
+  VarMeanEstimator d_qstat;
+  std::vector<unsigned int> d_qcounts;
+  std::vector<uint64_t> d_unfoundReads;
+  std::vector<qtally> d_qqcounts;
+  std::vector<dnapos_t> d_gchisto;
+  InsertSizeModel d_insertSizes; //!< of the pairs this worker mapped
+  BAMQueue d_bamqueue;
+private:
+  MappingStats& stats(const ReferenceGenome* rg);
+  std::vector<std::unique_ptr<ReferenceGenome> >& d_refgens;
+  const ReferencePanel& d_panel;
+  DiagonalVoter d_voter;
+  SearchScratch d_scratch;
+  BAMQueue* d_bam; //!< d_bamqueue, or null if we are not writing a BAM file
+  std::vector<ReferenceGenome::MatchDescriptor> d_pairPositions[2]; //!< where either read of the pair might go
+  unsigned int d_keylen;
+  int d_qlimit;
+  uint32_t d_seed;
+  unsigned int d_window, d_searchWindow; //!< the same for all workers, so pairing does not depend on which one maps a pair
+  std::vector<MappingStats*> d_stats; // one per reference, either the ReferenceGenome itself, or one of d_ownStats
+  std::vector<std::unique_ptr<MappingStats> > d_ownStats;
+  ReadPair d_pair; //!< mapBatch() unpacks into this, so the strings keep their allocations
+};
@@ -1,4 +1,5 @@
 #include "misc.hh"
+#include "dnakernels.hh"
 #include <string.h>
 #include <stdexcept>
 #include <algorithm>
@@ -77,17 +78,8 @@ static void rev_and_comp_tbl_small(const char *in, char *out, size_t len)
 
 void reverseNucleotides(std::string* nucleotides)
 {
-  std::reverse(nucleotides->begin(), nucleotides->end());
-  for(string::iterator iter = nucleotides->begin(); iter != nucleotides->end(); ++iter) {
-    if(*iter == 'C')
-      *iter = 'G';
-    else if(*iter == 'G')
-      *iter = 'C';
-    else if(*iter == 'A')
-      *iter = 'T';
-    else if(*iter == 'T')
-      *iter = 'A';
-  }
+  if(!nucleotides->empty())
+    reverseComplement(&(*nucleotides)[0], nucleotides->size());
 }
 
 string compilerVersion()
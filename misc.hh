@@ -2,6 +2,11 @@
 #include <stdio.h>
 #include <string>
 #include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
 
 void chomp(char* line);
 char* sfgets(char* p, int num, FILE* fp);
@@ -26,6 +31,13 @@ public:
   {
     return N>0;
   }
+  //! fold in the values fed to another estimator
+  void merge(const VarMeanEstimator& rhs)
+  {
+    N += rhs.N;
+    xTot += rhs.xTot;
+    x2Tot += rhs.x2Tot;
+  }
   friend double mean(const VarMeanEstimator& vme);
   friend double variance(const VarMeanEstimator& vme);
 private:
@@ -46,5 +58,58 @@ inline double variance(const VarMeanEstimator& vme)
   return (vme.x2Tot - vme.xTot*vme.xTot/vme.N)/vme.N;
 }
 
+/** Hands work from one thread to others. pop() blocks until there is something to
+    return, and returns false once the queue is closed and empty */
+template<typename T>
+class BlockingQueue
+{
+public:
+  BlockingQueue() : d_closed(false) {}
+  void push(T t)
+  {
+    {
+      std::lock_guard<std::mutex> lock(d_mut);
+      d_queue.push_back(std::move(t));
+    }
+    d_cond.notify_one();
+  }
+  bool pop(T* t)
+  {
+    std::unique_lock<std::mutex> lock(d_mut);
+    d_cond.wait(lock, [this]() { return d_closed || !d_queue.empty(); });
+    if(d_queue.empty())
+      return false;
+    *t = std::move(d_queue.front());
+    d_queue.pop_front();
+    return true;
+  }
+  //! wakes up all waiting poppers, which will get 'false' once we are drained
+  void close()
+  {
+    {
+      std::lock_guard<std::mutex> lock(d_mut);
+      d_closed = true;
+    }
+    d_cond.notify_all();
+  }
+private:
+  std::mutex d_mut;
+  std::condition_variable d_cond;
+  std::deque<T> d_queue;
+  bool d_closed;
+};
+
+//! runs f(0) up to f(numThreads - 1), each on a thread of its own, except for the last one which runs on ours
+template<typename F>
+void runThreads(unsigned int numThreads, F f)
+{
+  std::vector<std::thread> threads;
+  for(unsigned int t = 0; t + 1 < numThreads; ++t)
+    threads.emplace_back(f, t);
+  f(numThreads - 1);
+  for(auto& t : threads)
+    t.join();
+}
+
 std::string compilerVersion();
 void reverseNucleotides(std::string* nucleotides);
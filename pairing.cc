@@ -0,0 +1,114 @@
+#include "pairing.hh"
+#include <algorithm>
+#include <tuple>
+
+using namespace std;
+
+void InsertSizeModel::add(unsigned int distance)
+{
+  if(distance >= d_histo.size())
+    d_histo.resize(distance + 1);
+  d_histo[distance]++;
+  d_samples++;
+}
+
+void InsertSizeModel::merge(const InsertSizeModel& rhs)
+{
+  if(rhs.d_histo.size() > d_histo.size())
+    d_histo.resize(rhs.d_histo.size());
+  for(unsigned int n = 0; n < rhs.d_histo.size(); ++n)
+    d_histo[n] += rhs.d_histo[n];
+  d_samples += rhs.d_samples;
+}
+
+unsigned int InsertSizeModel::median() const
+{
+  if(!d_samples)
+    return 0;
+  uint64_t half = (d_samples + 1) / 2, seen = 0;
+  unsigned int ret = 0;
+  while((seen += d_histo[ret]) < half)
+    ++ret;
+  return ret;
+}
+
+unsigned int InsertSizeModel::mad() const
+{
+  if(!d_samples)
+    return 0;
+  // grow a band around the median until it holds half the pairs, its half width is the median absolute deviation
+  unsigned int med = median(), ret = 0;
+  uint64_t half = (d_samples + 1) / 2, seen = d_histo[med];
+  while(seen < half) {
+    ++ret;
+    if(med >= ret)
+      seen += d_histo[med - ret];
+    if(med + ret < d_histo.size())
+      seen += d_histo[med + ret];
+  }
+  return ret;
+}
+
+unsigned int InsertSizeModel::window(unsigned int floor, unsigned int fallback, uint64_t minSamples) const
+{
+  if(d_samples < minSamples)
+    return fallback;
+  // 1.4826 MAD is the standard deviation of a normal distribution, but a perfectly sized library should still get some room
+  double spread = max(1.4826 * mad(), 10.0);
+  return max<double>(floor, median() + 8 * spread);
+}
+
+int64_t exactPairDistance(const ReferencePanel& panel, FastQRead* fq1, FastQRead* fq2, vector<ReferenceGenome::MatchDescriptor>* found,
+			  vector<dnapos_t>* positions)
+{
+  MatchPair mp;
+  panel.getAllReadPosBoth(fq1, found, positions);
+  if(found->size() != 1)
+    return -1;
+  mp.first = found->front();
+  panel.getAllReadPosBoth(fq2, found, positions);
+  if(found->size() != 1)
+    return -1;
+  mp.second = found->front();
+  if(mp.first.rg != mp.second.rg || mp.first.reverse == mp.second.reverse ||
+     mp.first.rg->contigIndex(mp.first.pos) != mp.second.rg->contigIndex(mp.second.pos))
+    return -1;
+  int64_t distance = pairDistance(mp, fq1->d_nucleotides.length());
+  return distance >= 0 ? distance : -1;
+}
+
+static uint64_t panelPos(const ReferenceGenome::MatchDescriptor& md)
+{
+  return (uint64_t)md.rg->d_panelOffset + md.pos;
+}
+
+int bestPairs(vector<ReferenceGenome::MatchDescriptor>& first, vector<ReferenceGenome::MatchDescriptor>& second,
+	      unsigned int window, vector<MatchPair>* ret)
+{
+  ret->clear();
+  auto order = [](const ReferenceGenome::MatchDescriptor& a, const ReferenceGenome::MatchDescriptor& b) {
+    return make_tuple(panelPos(a), a.reverse) < make_tuple(panelPos(b), b.reverse);
+  };
+  sort(first.begin(), first.end(), order);
+  sort(second.begin(), second.end(), order);
+
+  int best = -1;
+  auto lower = second.begin();
+  for(const auto& one : first) {
+    uint64_t pos = panelPos(one);
+    while(lower != second.end() && panelPos(*lower) + window <= pos)
+      ++lower;
+    for(auto two = lower; two != second.end() && panelPos(*two) < pos + window; ++two) {
+      if(two->rg != one.rg || two->reverse == one.reverse || one.rg->contigIndex(one.pos) != two->rg->contigIndex(two->pos))
+	continue;
+      int score = one.score + two->score;
+      if(best < 0 || score < best) {
+	best = score;
+	ret->clear();
+      }
+      if(score == best)
+	ret->push_back({one, *two});
+    }
+  }
+  return best;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include "refgenome.hh"
+
+/** The insert size of a library, as a histogram of the distances between the reads of a pair, with its median and
+    median absolute deviation. window() turns that into how far apart the reads of a pair may be */
+class InsertSizeModel
+{
+public:
+  InsertSizeModel() : d_samples(0) {}
+  void add(unsigned int distance);
+  void merge(const InsertSizeModel& rhs);
+  uint64_t samples() const { return d_samples; }
+  unsigned int median() const;
+  unsigned int mad() const;
+  /** reads of a pair are this close, or closer: the median plus 8 times the spread, but at least floor, so a library
+      with some long inserts keeps them. fallback with fewer than minSamples */
+  unsigned int window(unsigned int floor, unsigned int fallback, uint64_t minSamples=100) const;
+  const std::vector<uint32_t>& histogram() const { return d_histo; }
+private:
+  std::vector<uint32_t> d_histo; //!< how many pairs we saw at each distance
+  uint64_t d_samples;
+};
+
+typedef std::pair<ReferenceGenome::MatchDescriptor, ReferenceGenome::MatchDescriptor> MatchPair;
+
+//! from the start of the first read to the end of the second, negative if they face away from each other. len1 is that of the first read
+inline int64_t pairDistance(const MatchPair& mp, unsigned int len1)
+{
+  return mp.second.reverse ? 
+    (len1 + (int64_t) mp.second.pos - (int64_t) mp.first.pos) :
+    (len1 + (int64_t) mp.first.pos - (int64_t) mp.second.pos);
+}
+
+/** pairDistance() of fq1 and fq2 if both occur exactly once, on opposite strands of one contig, however far apart
+    that is. -1 if not. For learning an InsertSizeModel without assuming a window, found and positions are scratch */
+int64_t exactPairDistance(const ReferencePanel& panel, FastQRead* fq1, FastQRead* fq2, std::vector<ReferenceGenome::MatchDescriptor>* found,
+			  std::vector<dnapos_t>* positions);
+
+/** Of the pairs of a position from first and one from second that are on opposite strands of one contig and closer
+    than window, puts those with the lowest combined score in ret. Sorts first and second by panel position and
+    sweeps them with two pointers, so repeats do not cost the product of their sizes. Returns that lowest score, -1
+    if nothing pairs up */
+int bestPairs(std::vector<ReferenceGenome::MatchDescriptor>& first, std::vector<ReferenceGenome::MatchDescriptor>& second,
+	      unsigned int window, std::vector<MatchPair>* ret);
@@ -0,0 +1,202 @@
+#include "readsearch.hh"
+#include <algorithm>
+
+using namespace std;
+
+bool alignRead(SearchScratch& scratch, const ReferenceGenome& rg, dnapos_t pos, const FastQRead& fqfrag, dnapos_t* alignedPos, const Alignment** al)
+{
+  unsigned int len = fqfrag.d_nucleotides.length();
+  dnapos_t start = pos > s_alignBand ? pos - s_alignBand : 1;
+  auto band = rg.view(start, pos + len + s_alignBand);
+  *al = &scratch.aligner.align(fqfrag.d_nucleotides.c_str(), len, band.data(), band.length(), pos - start);
+  *alignedPos = start + (*al)->refStart;
+  return (*al)->indels && (*al)->mismatches < 5 && (*al)->distance <= len / 10;
+}
+
+unsigned int diffScore(SearchScratch& scratch, const ReferenceGenome& rg, dnapos_t pos, const FastQRead& fqfrag, int qlimit)
+{
+  unsigned int diffcount=0;
+  auto reference = rg.view(pos, pos + fqfrag.d_nucleotides.length());
+  for(string::size_type i = 0; i < fqfrag.d_nucleotides.size() && i < reference.size();++i) {
+    if(fqfrag.d_nucleotides[i] != reference[i] && fqfrag.d_quality[i] > qlimit)
+      diffcount++;
+  }
+
+  if(diffcount >= 5) { // bit too different, maybe there is an indel
+    const Alignment* al;
+    dnapos_t alignedPos;
+    if(alignRead(scratch, rg, pos, fqfrag, &alignedPos, &al))
+      return min(diffcount, al->mismatches + al->indels);
+  }
+
+  return diffcount;
+}
+
+static bool alreadyHave(const vector<ReferenceGenome::MatchDescriptor>& found, const ReferenceGenome* rg, dnapos_t pos)
+{
+  return find_if(found.begin(), found.end(),
+		 [rg, pos](const ReferenceGenome::MatchDescriptor& md){ return md.rg==rg && md.pos==pos;}) != found.end();
+}
+
+void fuzzyFind(FastQRead* fqfrag, const ReferencePanel& panel, DiagonalVoter& voter, SearchScratch& scratch, unsigned int keylen, int qlimit,
+	       vector<ReferenceGenome::MatchDescriptor>* ret)
+{
+  ret->clear();
+  if(fqfrag->d_nucleotides.length() < 3*keylen) // too short
+    return;
+
+  // three seeds agreeing, as the triplet search used to want
+  voter.vote(fqfrag->d_nucleotides, 8, 3, &scratch.candidates);
+  bool flipped = false;
+  int score;
+  ReferenceGenome* rg;
+  dnapos_t pos;
+  for(const auto& candidate : scratch.candidates) {
+    if(candidate.reverse != flipped) {
+      fqfrag->reverse();
+      flipped = !flipped;
+    }
+    if(!panel.locate(candidate.diagonal, fqfrag->d_nucleotides.length(), &rg, &pos))
+      continue;
+    if(alreadyHave(*ret, rg, pos))
+      continue;
+
+    score = diffScore(scratch, *rg, pos, *fqfrag, qlimit);
+    ret->push_back({rg, pos, fqfrag->reversed, score});
+    if(score==0) // won't get any better than this
+      return;
+  }
+}
+
+void mateSearch(FastQRead* fqfrag, const vector<ReferenceGenome::MatchDescriptor>& anchors, unsigned int window, SearchScratch& scratch, int qlimit,
+		vector<ReferenceGenome::MatchDescriptor>* ret)
+{
+  ret->clear();
+  unsigned int len = fqfrag->d_nucleotides.length();
+  for(const auto& anchor : anchors) {
+    if(fqfrag->reversed == anchor.reverse)
+      fqfrag->reverse();
+    const auto& contig = anchor.rg->d_contigs[anchor.rg->contigIndex(anchor.pos)];
+    dnapos_t start = anchor.pos >= contig.start + window ? anchor.pos - (window - 1) : contig.start;
+    dnapos_t stop = min<uint64_t>((uint64_t)anchor.pos + (window - 1) + len, (uint64_t)contig.start + contig.length);
+    if(stop < start + len)
+      continue;
+    auto band = anchor.rg->view(start, stop);
+    const Alignment& al = scratch.aligner.align(fqfrag->d_nucleotides.c_str(), len, band.data(), band.length(), anchor.pos - start);
+    if(al.distance > len / 10)
+      continue;
+    dnapos_t pos = start + al.refStart;
+    if(alreadyHave(*ret, anchor.rg, pos))
+      continue;
+    ret->push_back({anchor.rg, pos, fqfrag->reversed, (int)diffScore(scratch, *anchor.rg, pos, *fqfrag, qlimit)});
+  }
+}
+
+//! the first indel of cigar, the way FASTQMapping has it
+static int firstIndel(const Cigar& cigar)
+{
+  int offset = 0;
+  for(auto op : cigar) {
+    if((op & 0xf) == CigarInsert)
+      return offset;
+    if((op & 0xf) == CigarDelete)
+      return -offset;
+    offset += op >> 4;
+  }
+  return 0;
+}
+
+int MapToReference(SearchScratch& scratch, const ReferenceGenome& rg, MappingStats& ms, dnapos_t pos, const FastQRead& fqfrag, int qlimit, BAMQueue* sbw, vector<qtally>* qqcounts, Cigar* outCigar, dnapos_t* outPos)
+{
+  if(pos > rg.size()) // can happen because of inserts or circular genomes
+    return false;
+  unsigned int len = fqfrag.d_nucleotides.length();
+  auto reference = rg.view(pos, pos + len);
+
+  double diffcount=0;
+  for(string::size_type i = 0; i < fqfrag.d_nucleotides.size() && i < reference.size();++i) {
+    if(fqfrag.d_nucleotides[i] != reference[i]) {
+      if(fqfrag.d_quality[i] > qlimit) 
+	diffcount++;
+      else
+	diffcount+=0.5;
+    }
+  }
+  bool didMap=false;
+  static const Cigar s_straight; // all of the read matches or mismatches in one go
+  const Cigar* cigar = &s_straight;
+
+  if(diffcount < 5) {
+    didMap=true;
+    ms.mapFastQ(pos, fqfrag);
+    if(sbw)
+      sbw->qwrite(rg.d_panelOffset + pos, fqfrag);
+  }
+  else {
+    const Alignment* al;
+    dnapos_t alignedPos;
+    if(alignRead(scratch, rg, pos, fqfrag, &alignedPos, &al)) {
+      pos = alignedPos;
+      reference = rg.view(pos, pos + al->refLength);
+      cigar = &al->cigar;
+      diffcount = al->mismatches;
+      ms.mapFastQ(pos, fqfrag, firstIndel(*cigar));
+      if(sbw)
+	sbw->qwrite(rg.d_panelOffset + pos, fqfrag, *cigar);
+      didMap=true;
+    }
+  }
+  if(outCigar)
+    *outCigar = *cigar;
+  if(outPos)
+    *outPos = pos;
+
+  // walk the read and the reference along the cigar
+  ms.fitReadLength(len);
+  unsigned int q = 0, r = 0; // in the read, in the reference
+  auto walk = [&](uint32_t op) {
+    unsigned int amount = cigar->empty() ? len : (op >> 4);
+    switch(cigar->empty() ? CigarMatch : (op & 0xf)) {
+    case CigarInsert: // our read has an insert here
+      if(didMap) {
+	auto& locus = ms.d_locimap[pos+r];
+	locus.add(fqfrag.d_nucleotides[q], fqfrag.d_quality[q], fqfrag.reversed ^ (q > len/2)); // head or tail
+	ms.addInsert(pos+r, boost::string_ref(fqfrag.d_nucleotides).substr(q, amount));
+      }
+      q += amount;
+      return;
+    case CigarDelete: // our read lacks these
+      for(unsigned int n = 0; n < amount; ++n, ++r)
+	if(didMap && diffcount < 5)
+	  ms.d_locimap[pos+r].add('X', 40, fqfrag.reversed ^ (q > len/2));
+      return;
+    }
+    for(unsigned int n = 0; n < amount && q < len && r < reference.size(); ++n, ++q, ++r) {
+      unsigned int readMapPos = fqfrag.reversed ? ((len - 1) - q) : q;
+      char c =  fqfrag.d_nucleotides[q];
+
+      if(c != reference[r]) {
+	if(fqfrag.d_quality[q] > qlimit && diffcount < 5) 
+	  ms.d_locimap[pos+r].add(c, fqfrag.d_quality[q], fqfrag.reversed ^ (q > len/2)); // head or tail
+      
+	if(diffcount < 5) {
+	  unsigned int qual = (unsigned int)fqfrag.d_quality[q];
+	  (*qqcounts)[qual].incorrect++;
+	  ms.d_wrongMappings[readMapPos]++;
+	}
+      }
+      else {
+	ms.cover(pos+r,fqfrag.d_quality[q], qlimit);
+	if(diffcount < 5) {
+	  (*qqcounts)[(unsigned int)fqfrag.d_quality[q]].correct++;
+	  ms.d_correctMappings[readMapPos]++;
+	}
+      }
+    }
+  };
+  if(cigar->empty())
+    walk(0);
+  for(auto op : *cigar)
+    walk(op);
+  return didMap;
+}
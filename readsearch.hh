@@ -0,0 +1,58 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "refgenome.hh"
+#include "seeding.hh"
+#include "aligner.hh"
+#include "pairing.hh"
+#include "saminfra.hh"
+
+//! how far either way from where we expect a read we look for it when aligning with indels
+static const unsigned int s_alignBand = 16;
+//! the two reads of a pair start closer together than this, or than what InsertSizeModel::window() learns from the first pairs
+static const unsigned int s_mateWindow = 1400;
+//! a mate found in more places than this is a repeat, and no guide to where the other read is
+static const unsigned int s_maxAnchors = 4;
+
+/** Everything finding and mapping a read needs besides the read and the references. Kept from read to read, so once
+    these have grown to fit our reads, none of the functions below allocate. One per thread */
+struct SearchScratch
+{
+  BandedAligner aligner;
+  Cigar cigar;
+  std::vector<dnapos_t> positions;
+  std::vector<SeedCandidate> candidates;
+  std::vector<MatchPair> matchPairs;
+  std::vector<ReferenceGenome::MatchDescriptor> picks;
+};
+
+/** Aligns fqfrag with indels to around pos in rg. True if it fits well enough: with an indel, fewer than 5 other
+    differences and no more than a tenth of its length edited in all. alignedPos is where it then starts, al
+    points into scratch.aligner */
+bool alignRead(SearchScratch& scratch, const ReferenceGenome& rg, dnapos_t pos, const FastQRead& fqfrag, dnapos_t* alignedPos, const Alignment** al);
+
+//! differences between fqfrag and rg at pos that count, fewer if an alignment with indels explains them better
+unsigned int diffScore(SearchScratch& scratch, const ReferenceGenome& rg, dnapos_t pos, const FastQRead& fqfrag, int qlimit);
+
+//! candidates from diagonal voting over all references at once, only the best few of them get scored
+void fuzzyFind(FastQRead* fqfrag, const ReferencePanel& panel, DiagonalVoter& voter, SearchScratch& scratch, unsigned int keylen, int qlimit,
+	       std::vector<ReferenceGenome::MatchDescriptor>* ret);
+
+/** looks for fqfrag only near where its mate was found: on the other strand, closer than window and on the same
+    contig, aligned with indels. Empty if it is not there, after which a search of all references is still possible */
+void mateSearch(FastQRead* fqfrag, const std::vector<ReferenceGenome::MatchDescriptor>& anchors, unsigned int window, SearchScratch& scratch, int qlimit,
+		std::vector<ReferenceGenome::MatchDescriptor>* ret);
+
+//! Keeps a tally of correct and incorrect mappings
+struct qtally
+{
+  qtally() : correct{0}, incorrect{0}{}
+  uint64_t correct;
+  uint64_t incorrect;
+};
+
+/** Maps fqfrag to rg at pos, tallying into ms (which belongs to rg, or is a thread specific copy) and queueing it on
+    sbw if that is set. Reads that differ too much get aligned with indels. outCigar and outPos say how and where it
+    got mapped. Like the search functions, this allocates nothing once scratch, ms and sbw have grown to fit */
+int MapToReference(SearchScratch& scratch, const ReferenceGenome& rg, MappingStats& ms, dnapos_t pos, const FastQRead& fqfrag, int qlimit,
+		   BAMQueue* sbw, std::vector<qtally>* qqcounts, Cigar* outCigar=0, dnapos_t* outPos=0);
@@ -3,103 +3,278 @@
 #include <stdexcept>
 #include <string.h>
 #include <algorithm>
+#include <tuple>
 #include <boost/algorithm/string.hpp>
 #include "misc.hh"
 #include "dnamisc.hh"
 
-extern "C" {
-#include "hash.h"
-}
-
 using boost::lexical_cast;
 using namespace std;
 
-vector<dnapos_t> ReferenceGenome::getReadPositions(const std::string& nucleotides)
+void MappingStats::cover(dnapos_t pos, unsigned int length, const std::string& quality, int limit) 
 {
-  vector<dnapos_t> ret;
-  if(!d_indexes.count(nucleotides.length()))
-    throw runtime_error("Attempting to find a read of length we've not indexed for ("+boost::lexical_cast<string>(nucleotides.length())+")");
-  
-  auto& index = d_indexes[nucleotides.length()];
-  
-  uint32_t hashval = qhash(nucleotides.c_str(), nucleotides.length(), 0);
-  HashPos hp(hashval, 0);
-  pair<index_t::const_iterator, index_t::const_iterator> range = equal_range(index.begin(), index.end(), hp);
-  if(range.first == range.second)
-    return ret;
-  
-  for(;range.first != range.second; range.first++) {
-    if(!memcmp(d_genome.c_str() + range.first->d_pos, nucleotides.c_str(), nucleotides.length())) {
-      ret.push_back(range.first->d_pos);
-    }
+  const char* p = quality.c_str();
+  for(unsigned int i = 0; i < length; ++i) {
+    if(p[i] > limit)
+      d_coverage[pos+i]++;
   }
-  return ret;
 }
-  
-dnapos_t ReferenceGenome::getReadPosBoth(FastQRead* fq, int qlimit) // tries original & complement
+
+void MappingStats::cover(dnapos_t pos, char quality, int limit) 
 {
-  vector<dnapos_t> positions;
+  if(quality > (int) limit)
+    d_coverage[pos]++;
+}
 
-  for(int tries = 0; tries < 2; ++tries) {
-    positions = getReadPositions(fq->d_nucleotides);
+FASTQMapping::FASTQMapping(uint64_t pos, dnapos_t locus_, int indel, bool reverse) : locus(locus_)
+{
+  if(pos & ~(s_fileBit | s_offsetMask))
+    throw runtime_error("Read position "+lexical_cast<string>(pos)+" too large to log a mapping for");
+  if(indel < -s_indelBias || indel >= s_indelBias)
+    throw runtime_error("Indel offset "+lexical_cast<string>(indel)+" too large to log a mapping for");
+  d_read = pos | ((uint64_t)(indel + s_indelBias) << s_offsetBits) | (reverse ? s_reverseBit : 0);
+}
 
-    if(!positions.empty()) {
-      auto pick = pickRandom(positions);
+void MappingStats::mapFastQ(dnapos_t pos, const FastQRead& fqfrag, int indel)
+{
+  d_placements.emplace_back(fqfrag.position, pos, indel, fqfrag.reversed);
+  //    cout<<"Adding mapping at pos "<<pos<<", indel = "<<indel<<", reverse= "<<fqfrag.reversed<<endl;
+}
 
-      cover(pick, fq->d_nucleotides.size(), fq->d_quality, qlimit);
+void MappingStats::sortPlacements()
+{
+  sort(d_placements.begin(), d_placements.end());
+}
 
-      return pick;
-    }
-    fq->reverse();
+std::pair<vector<FASTQMapping>::const_iterator, vector<FASTQMapping>::const_iterator> MappingStats::placements(dnapos_t start, dnapos_t stop) const
+{
+  auto begin = lower_bound(d_placements.begin(), d_placements.end(), start, [](const FASTQMapping& fqm, dnapos_t pos) { return fqm.locus < pos; });
+  auto end = lower_bound(begin, d_placements.end(), stop, [](const FASTQMapping& fqm, dnapos_t pos) { return fqm.locus < pos; });
+  return {begin, end};
+}
+
+int MappingStats::LociStats::kind(char nucleotide)
+{
+  switch(nucleotide) {
+  case 'A':
+    return A;
+  case 'C':
+    return C;
+  case 'G':
+    return G;
+  case 'T':
+    return T;
+  case 'X':
+    return X;
   }
-  return dnanpos;
+  return N;
 }
 
-vector<ReferenceGenome::MatchDescriptor> ReferenceGenome::getAllReadPosBoth(FastQRead* fq) // tries original & complement
+void MappingStats::LociStats::add(char nucleotide, char quality, bool head)
 {
-  vector<MatchDescriptor > ret;
-  string nucleotides;
-  for(int tries = 0; tries < 2; ++tries) {
-    for(auto position : getReadPositions(fq->d_nucleotides)) 
-      ret.push_back({this, position, (bool)tries, 0});
-    fq->reverse();
+  int k = kind(nucleotide);
+  counts[k]++;
+  qualities[k] += quality;
+  if(head)
+    heads[k]++;
+}
+
+bool MappingStats::LociStats::addInsert(uint32_t id, unsigned int count)
+{
+  for(auto& ic : inserts) {
+    if(!ic.count)
+      ic.id = id;
+    if(ic.id == id) {
+      ic.count += count;
+      return true;
+    }
   }
+  otherInserts += count;
+  return false;
+}
+
+uint32_t MappingStats::LociStats::total() const
+{
+  uint32_t ret = 0;
+  for(auto c : counts)
+    ret += c;
   return ret;
 }
 
-void ReferenceGenome::cover(dnapos_t pos, unsigned int length, const std::string& quality, int limit) 
+uint32_t MappingStats::LociStats::totalHeads() const
 {
-  const char* p = quality.c_str();
-  for(unsigned int i = 0; i < length; ++i) {
-    if(p[i] > limit)
-      d_mapping[pos+i].coverage++;
+  uint32_t ret = 0;
+  for(auto h : heads)
+    ret += h;
+  return ret;
+}
+
+uint32_t MappingStats::LociStats::totalInserts() const
+{
+  uint32_t ret = otherInserts;
+  for(const auto& ic : inserts)
+    ret += ic.count;
+  return ret;
+}
+
+void MappingStats::LociMap::resize(dnapos_t size)
+{
+  d_slots.resize(size);
+}
+
+MappingStats::LociStats& MappingStats::LociMap::operator[](dnapos_t pos)
+{
+  if(pos >= d_slots.size())
+    d_slots.resize(pos + 1);
+  if(!d_slots[pos]) {
+    d_entries.push_back({pos, LociStats()});
+    d_slots[pos] = d_entries.size();
   }
+  return d_entries[d_slots[pos] - 1].second;
 }
 
-void ReferenceGenome::cover(dnapos_t pos, char quality, int limit) 
+MappingStats::LociMap::iterator MappingStats::LociMap::find(dnapos_t pos)
 {
-  if(quality > (int) limit)
-    d_mapping[pos].coverage++;
+  if(pos >= d_slots.size() || !d_slots[pos])
+    return d_entries.end();
+  return d_entries.begin() + (d_slots[pos] - 1);
+}
+
+MappingStats::LociMap::const_iterator MappingStats::LociMap::find(dnapos_t pos) const
+{
+  if(pos >= d_slots.size() || !d_slots[pos])
+    return d_entries.end();
+  return d_entries.begin() + (d_slots[pos] - 1);
+}
+
+void MappingStats::LociMap::clear()
+{
+  for(const auto& e : d_entries)
+    d_slots[e.first] = 0;
+  d_entries.clear();
+}
+
+void MappingStats::LociMap::sort()
+{
+  std::sort(d_entries.begin(), d_entries.end(), [](const value_type& a, const value_type& b) { return a.first < b.first; });
+  for(uint32_t n = 0; n < d_entries.size(); ++n)
+    d_slots[d_entries[n].first] = n + 1;
+}
+
+uint32_t MappingStats::internInsert(boost::string_ref insert)
+{
+  d_insertKey.assign(insert.data(), insert.size());
+  auto iter = d_insertIds.find(d_insertKey);
+  if(iter != d_insertIds.end())
+    return iter->second;
+  d_inserts.push_back(d_insertKey);
+  d_insertIds[d_insertKey] = d_inserts.size() - 1;
+  return d_inserts.size() - 1;
+}
+
+void MappingStats::addInsert(dnapos_t pos, boost::string_ref insert, unsigned int count)
+{
+  addInsert(pos, internInsert(insert), count);
+}
+
+void MappingStats::addInsert(dnapos_t pos, uint32_t id, unsigned int count)
+{
+  if(!d_locimap[pos].addInsert(id, count))
+    d_otherInserts[((uint64_t)pos << 32) + id] += count;
+}
+
+void MappingStats::settleInserts()
+{
+  vector<pair<uint64_t, uint32_t> > others(d_otherInserts.begin(), d_otherInserts.end());
+  sort(others.begin(), others.end());
+  vector<LociStats::InsertCount> all;
+  for(auto iter = others.begin(); iter != others.end(); ) {
+    dnapos_t pos = iter->first >> 32;
+    auto& ls = d_locimap[pos];
+    all.assign(begin(ls.inserts), end(ls.inserts));
+    for(; iter != others.end() && (iter->first >> 32) == pos; ++iter)
+      all.push_back({(uint32_t)iter->first, iter->second});
+    std::sort(all.begin(), all.end(), [this](const LociStats::InsertCount& a, const LociStats::InsertCount& b) {
+	return a.count != b.count ? a.count > b.count : d_inserts[a.id] < d_inserts[b.id];
+      });
+    ls.otherInserts = 0;
+    for(unsigned int n = 0; n < all.size(); ++n) {
+      if(n < LociStats::s_insertSlots)
+	ls.inserts[n] = all[n];
+      else
+	ls.otherInserts += all[n].count;
+    }
+  }
+  d_otherInserts.clear();
 }
 
-void ReferenceGenome::mapFastQ(dnapos_t pos, const FastQRead& fqfrag, int indel)
+void MappingStats::fitReadLength(unsigned int length)
 {
-  FASTQMapping fqm;
-  fqm.pos=fqfrag.position;
-  fqm.reverse = fqfrag.reversed;
-  fqm.indel = indel;
-  d_mapping[pos].d_fastqs.push_front(fqm);
-  //    cout<<"Adding mapping at pos "<<pos<<", indel = "<<indel<<", reverse= "<<fqm.reverse<<endl;
+  if(length > d_correctMappings.size()) {
+    d_correctMappings.resize(length);
+    d_wrongMappings.resize(length);
+    d_taMappings.resize(length);
+    d_gcMappings.resize(length);
+  }
+}
+
+void MappingStats::sizeLike(const MappingStats& rhs)
+{
+  d_coverage.assign(rhs.d_coverage.size(), 0);
+  d_placements.clear();
+  d_correctMappings.assign(rhs.d_correctMappings.size(), 0);
+  d_wrongMappings.assign(rhs.d_wrongMappings.size(), 0);
+  d_gcMappings.assign(rhs.d_gcMappings.size(), 0);
+  d_taMappings.assign(rhs.d_taMappings.size(), 0);
+  d_locimap.clear();
+  d_locimap.resize(rhs.d_coverage.size());
+  d_inserts.clear();
+  d_insertIds.clear();
+  d_otherInserts.clear();
+}
+
+void MappingStats::merge(MappingStats& rhs)
+{
+  for(dnapos_t pos = 0; pos < d_coverage.size() && pos < rhs.d_coverage.size(); ++pos)
+    d_coverage[pos] += rhs.d_coverage[pos];
+  d_placements.insert(d_placements.end(), rhs.d_placements.begin(), rhs.d_placements.end());
+  vector<FASTQMapping>().swap(rhs.d_placements);
+
+  auto addVec = [](vector<unsigned int>& us, const vector<unsigned int>& them) {
+    if(us.size() < them.size())
+      us.resize(them.size());
+    for(unsigned int n = 0; n < them.size(); ++n)
+      us[n] += them[n];
+  };
+  addVec(d_correctMappings, rhs.d_correctMappings);
+  addVec(d_wrongMappings, rhs.d_wrongMappings);
+  addVec(d_gcMappings, rhs.d_gcMappings);
+  addVec(d_taMappings, rhs.d_taMappings);
+
+  for(const auto& p : rhs.d_locimap) {
+    auto& us = d_locimap[p.first];
+    for(int n = 0; n < LociStats::Kinds; ++n) {
+      us.counts[n] += p.second.counts[n];
+      us.qualities[n] += p.second.qualities[n];
+      us.heads[n] += p.second.heads[n];
+    }
+    for(const auto& ic : p.second.inserts)
+      if(ic.count)
+	addInsert(p.first, internInsert(rhs.d_inserts[ic.id]), ic.count);
+  }
+  for(const auto& o : rhs.d_otherInserts)
+    addInsert(o.first >> 32, internInsert(rhs.d_inserts[(uint32_t)o.first]), o.second);
+  rhs.d_locimap.clear();
+  rhs.d_otherInserts.clear();
+  rhs.d_inserts.clear();
+  rhs.d_insertIds.clear();
 }
 
 
 
 string ReferenceGenome::snippet(dnapos_t start, dnapos_t stop) const 
 { 
-  if(stop > d_genome.size()) {
-      return d_genome.substr(start);
-  }
-  return d_genome.substr(start, stop-start);
+  return view(start, stop).to_string();
 }
 
 ReferenceGenome::ReferenceGenome(const string& fname)
@@ -108,6 +283,7 @@ ReferenceGenome::ReferenceGenome(const string& fname)
   if(!fp)
     throw runtime_error("Unable to open reference genome file '"+fname+"'");
   d_genome.reserve(filesize(fname.c_str()));  // slight overestimate which is great
+  d_fname = fname;
 
   char line[256]="";
 
@@ -116,19 +292,17 @@ ReferenceGenome::ReferenceGenome(const string& fname)
 
   if(line[0] != '>') 
     throw runtime_error("Input not FASTA");
-  d_fullname=line+1;
-
-  char* spacepos=strchr(line+1, ' ');
 
-  if(spacepos)
-    *spacepos=0;
-  d_name=line+1;
-  
   d_genome="*"; // this gets all our offsets ""right""
+  addContig(line+1);
   while(fgets(line, sizeof(line), fp)) {
     chomp(line);
-    d_genome.append(line);
+    if(line[0]=='>')
+      addContig(line+1);
+    else
+      d_genome.append(line);
   }
+  fclose(fp);
   
   initGenome();
 }
@@ -137,29 +311,49 @@ unique_ptr<ReferenceGenome> ReferenceGenome::makeFromString(const std::string& g
 {
   istringstream istr(genome);
   unique_ptr<ReferenceGenome> ret(new ReferenceGenome);
-  getline(istr, ret->d_name);
-  if(ret->d_name.empty() || ret->d_name[0]!='>') 
+  string line;
+  getline(istr, line);
+  boost::trim_right(line);
+  if(line.empty() || line[0]!='>') 
     throw runtime_error("Input not FASTA");
-  ret->d_fullname=ret->d_name.substr(1); // skip >
-
-  ret->d_name = ret->d_fullname; // should stop after ' '
-  auto spacepos = ret->d_name.find(' ');
-  if(spacepos != string::npos)
-    ret->d_name=ret->d_name.substr(0, spacepos);
 
-  string line;
   ret->d_genome="*"; // this gets all our offsets ""right""
+  ret->addContig(line.substr(1)); // skip >
   while(getline(istr, line)) {
     boost::trim_right(line);
-    ret->d_genome.append(line);
+    if(!line.empty() && line[0]=='>')
+      ret->addContig(line.substr(1));
+    else
+      ret->d_genome.append(line);
   }
   
   ret->initGenome();
   return ret;
 }
 
+void ReferenceGenome::addContig(const string& fullname)
+{
+  if(!d_contigs.empty())
+    d_genome.append(1, 'N');
+  string name = fullname.substr(0, fullname.find(' ')); // should stop after ' '
+  d_contigs.push_back({name, fullname, (dnapos_t)d_genome.size(), 0});
+  if(d_contigs.size() == 1) {
+    d_name = name;
+    d_fullname = fullname;
+  }
+}
+
+unsigned int ReferenceGenome::contigIndex(dnapos_t pos) const
+{
+  auto iter = upper_bound(d_contigs.begin(), d_contigs.end(), pos, [](dnapos_t p, const Contig& c) { return p < c.start; });
+  return iter == d_contigs.begin() ? 0 : iter - d_contigs.begin() - 1;
+}
+
 void ReferenceGenome::initGenome()
 {
+  for(unsigned int n = 0; n < d_contigs.size(); ++n) // the separating N is not part of either
+    d_contigs[n].length = (n + 1 < d_contigs.size() ? d_contigs[n+1].start - 1 : d_genome.size()) - d_contigs[n].start;
+
   d_aCount = d_cCount = d_gCount = d_tCount = 0;
   for(const auto& c : d_genome) {
     switch(c) {
@@ -178,17 +372,25 @@ void ReferenceGenome::initGenome()
     }
   }
 
-  d_mapping.resize(d_genome.size());
+  d_coverage.resize(d_genome.size());
+  d_locimap.resize(d_genome.size());
 }
 
 // returns as if we sampled once per index length, an array of index length bins
 vector<dnapos_t> ReferenceGenome::getGCHisto()
 {
   vector<dnapos_t> ret;
-  unsigned int indexlength = d_indexes.rbegin()->first;
+  unsigned int indexlength = *d_indexLengths.rbegin();
   ret.resize(indexlength); // biggest index
+  GCWindow window;
+  dnapos_t begin = 0, end = 0; // what window holds
   for(dnapos_t pos = 0; pos < d_genome.size() ; pos += indexlength/4) {
-    ret[round(indexlength*getGCContent(snippet(pos, pos + indexlength)))]++;
+    dnapos_t stop = min<uint64_t>((uint64_t)pos + indexlength, d_genome.size());
+    for(; begin < pos; ++begin)
+      window.remove(d_genome[begin]);
+    for(; end < stop; ++end)
+      window.add(d_genome[end]);
+    ret[round(indexlength*window.fraction())]++;
   }
   for(auto& c : ret) {
     c/=4;
@@ -196,32 +398,86 @@ vector<dnapos_t> ReferenceGenome::getGCHisto()
   return ret;
 }
 
-void ReferenceGenome::index(unsigned int length)
+map<double, VarMeanEstimator> CoverageStats::gcTable() const
 {
-  if(length > d_correctMappings.size()) {
-    d_correctMappings.resize(length);
-    d_wrongMappings.resize(length);
-    d_taMappings.resize(length);
-    d_gcMappings.resize(length);
-  }
+  map<double, VarMeanEstimator> ret;
+  for(unsigned int counted = 0; counted <= s_gcWindow; ++counted)
+    for(unsigned int gc = 0; gc <= counted; ++gc)
+      if(gcCoverage[gcIndex(counted, gc)].valid())
+	ret[counted ? 1.0*gc/(1.0*counted) : 0.0].merge(gcCoverage[gcIndex(counted, gc)]);
+  return ret;
+}
 
-  auto& index = d_indexes[length];
-  index.reserve(d_genome.length());
-  
-  for(string::size_type pos = 0 ; pos < d_genome.length() - length; ++pos) {
-    uint32_t hashval = qhash(d_genome.c_str() + pos, length, 0);
-    index.push_back(HashPos(hashval, pos));
+void CoverageStats::append(const CoverageStats& rhs)
+{
+  if(histo.size() < rhs.histo.size())
+    histo.resize(rhs.histo.size());
+  for(unsigned int n = 0; n < rhs.histo.size(); ++n)
+    histo[n] += rhs.histo[n];
+  depth.merge(rhs.depth);
+  undercovered += rhs.undercovered;
+  gcCoverage.resize(gcIndex(s_gcWindow, s_gcWindow) + 1);
+  for(unsigned int n = 0; n < rhs.gcCoverage.size(); ++n)
+    gcCoverage[n].merge(rhs.gcCoverage[n]);
+  for(const auto& run : rhs.lowRuns) {
+    if(!lowRuns.empty() && lowRuns.back().stop == run.pos) // it continues from our end
+      lowRuns.back().stop = run.stop;
+    else
+      lowRuns.push_back(run);
   }
+}
 
-  sort(index.begin(), index.end());
-  uint64_t diff = 0;
-
-  for(auto iter = index.begin(); iter!= index.end() ; ++iter) {
-    if(iter != index.begin() && iter->d_hash != prev(iter)->d_hash) {
-      diff++;
-    }
-  }
-  // (*g_log)<<"Average fill in genome hash of length "<<length<<": "<<1.0*d_genome.length()/diff<<endl;
+CoverageStats ReferenceGenome::getCoverageStats(unsigned int numThreads) const
+{
+  numThreads = max(1U, numThreads);
+  const uint64_t size = d_coverage.size();
+  const unsigned int half = CoverageStats::s_gcWindow / 2;
+  vector<CoverageStats> chunks(numThreads);
+  runThreads(numThreads, [&](unsigned int t) {
+      auto& cs = chunks[t];
+      cs.histo.resize(1000);
+      cs.gcCoverage.resize(CoverageStats::gcIndex(CoverageStats::s_gcWindow, CoverageStats::s_gcWindow) + 1);
+      GCWindow window;
+      bool filled = false;
+      for(uint64_t pos = size * t / numThreads; pos < size * (t + 1) / numThreads; ++pos) {
+	uint32_t cov = d_coverage[pos];
+	// the window is pos - 20 up to pos + 20, only whole ones count
+	if(pos > half && pos + half <= d_genome.size()) {
+	  if(!filled) {
+	    for(uint64_t n = pos - half; n < pos + half; ++n)
+	      window.add(d_genome[n]);
+	    filled = true;
+	  }
+	  else {
+	    window.remove(d_genome[pos - half - 1]);
+	    window.add(d_genome[pos + half - 1]);
+	  }
+	  cs.gcCoverage[CoverageStats::gcIndex(window.counted, window.gc)](cov);
+	}
+
+	cs.depth(cov);
+	if(cov >= cs.histo.size())
+	  cs.histo.resize(2*cov+1);
+	cs.histo[cov]++;
+
+	if(cov < CoverageStats::s_minDepth) {
+	  cs.undercovered++;
+	  if(!cs.lowRuns.empty() && cs.lowRuns.back().stop == pos)
+	    cs.lowRuns.back().stop = pos + 1;
+	  else
+	    cs.lowRuns.push_back({(dnapos_t)pos, (dnapos_t)pos + 1});
+	}
+      }
+    });
+
+  CoverageStats ret;
+  for(const auto& cs : chunks)
+    ret.append(cs);
+  // only runs with reference around them are worth showing
+  ret.lowRuns.erase(remove_if(ret.lowRuns.begin(), ret.lowRuns.end(), [this](const Unmatched& unm) {
+	return unm.pos <= 40 || unm.stop + 40 >= d_genome.length();
+      }), ret.lowRuns.end());
+  return ret;
 }
 
 string ReferenceGenome::getMatchingFastQs(dnapos_t pos, StereoFASTQReader& fastq)
@@ -238,33 +494,36 @@ string ReferenceGenome::getMatchingFastQs(dnapos_t start, dnapos_t stop, StereoF
     start = 1;
   string reference=snippet(start, stop);
   unsigned int insertPos=0;
+  auto range = placements(start, stop);
+  auto iter = range.first;
   for(unsigned int i = 0 ; i < stop - start; ++i) {
     if(i== (stop-start)/2)
       os << reference << endl;
     string spacer(i, ' ');
-    for(auto& fqm : d_mapping[start+i].d_fastqs) {
+    for(; iter != range.second && iter->locus == start + i; ++iter) {
+      const auto& fqm = *iter;
       FastQRead fqr;
-      fastq.getRead(fqm.pos, &fqr);
-      if(fqm.reverse)
+      fastq.getRead(fqm.pos(), &fqr);
+      if(fqm.reverse())
         fqr.reverse();
 
-      if(fqm.indel > 0 && !insertPos) { // our read has an insert at this position, stretch reference
-        if(i+fqm.indel < reference.size())
-          reference.insert(i+fqm.indel, 1, '_');
-        insertPos=i+fqm.indel;
-      } else if(fqm.indel < 0) {      // our read has an erase at this position
-        fqr.d_nucleotides.insert(-fqm.indel, 1, 'X');
-        fqr.d_quality.insert(-fqm.indel, 1, 42);
+      if(fqm.indel() > 0 && !insertPos) { // our read has an insert at this position, stretch reference
+        if(i+fqm.indel() < reference.size())
+          reference.insert(i+fqm.indel(), 1, '_');
+        insertPos=i+fqm.indel();
+      } else if(fqm.indel() < 0) {      // our read has an erase at this position
+        fqr.d_nucleotides.insert(-fqm.indel(), 1, 'X');
+        fqr.d_quality.insert(-fqm.indel(), 1, 42);
       }
       
-      if(fqm.indel <= 0 && insertPos && i > insertPos) {
+      if(fqm.indel() <= 0 && insertPos && i > insertPos) {
         fqr.d_nucleotides.insert(0, 1, '<');
         fqr.d_quality.insert(0, 1, 40);
       }
       os << spacer;
       int offset=0;
       for(unsigned int j = 0 ; j < fqr.d_nucleotides.size() && i + j + offset < reference.size(); ++j) {
-        if(reference[i+j]=='_' && !fqm.indel) {
+        if(reference[i+j]=='_' && !fqm.indel()) {
           os<<'_';
           offset=1;
         }
@@ -277,10 +536,93 @@ string ReferenceGenome::getMatchingFastQs(dnapos_t start, dnapos_t stop, StereoF
         else
           os<< (char)tolower(fqr.d_nucleotides[j]);
       }
-      os<<"                 "<<(fqm.reverse ? 'R' : ' ');
+      os<<"                 "<<(fqm.reverse() ? 'R' : ' ');
       os<<endl;
     }
   }
   return os.str();
 }
 
+
+ReferencePanel::ReferencePanel(vector<unique_ptr<ReferenceGenome> >& refs) : d_refs(refs)
+{
+  uint64_t total = 0;
+  for(auto& rg : refs)
+    total += rg->d_genome.size();
+  if(total > 0xffffffff)
+    throw runtime_error("Reference genomes too large to index together");
+  d_genome.reserve(total);
+  for(auto& rg : refs) {
+    rg->d_panelOffset = d_genome.size();
+    d_genome.append(rg->d_genome); // the padding in front keeps neighbouring genomes from matching across
+  }
+}
+
+void ReferencePanel::index(const vector<unsigned int>& lengths, unsigned int numThreads)
+{
+  if(lengths.empty())
+    return;
+  string fname; // next to the first reference that has a file, but not where that one keeps its own index
+  for(auto& rg : d_refs) {
+    rg->d_indexLengths.insert(lengths.begin(), lengths.end());
+    rg->fitReadLength(*max_element(lengths.begin(), lengths.end()));
+    if(fname.empty() && !rg->d_fname.empty())
+      fname = d_refs.size() == 1 ? rg->d_fname : rg->d_fname+".panel";
+  }
+  unsigned int k = KmerIndex::chooseK(*min_element(lengths.begin(), lengths.end()), d_genome.size());
+  if(d_kmers && d_kmers->k() == k)
+    return;
+  d_kmers = KmerIndex::loadOrBuild(fname.empty() ? "" : KmerIndex::indexName(fname, k), d_genome, k, numThreads);
+}
+
+void ReferencePanel::getPositions(const char* nucleotides, unsigned int len, vector<dnapos_t>* ret) const
+{
+  if(!d_kmers || len < d_kmers->k())
+    throw runtime_error("Attempting to find a read of length we've not indexed for ("+boost::lexical_cast<string>(len)+")");
+  d_kmers->lookup(d_genome, nucleotides, len, ret);
+}
+
+bool ReferencePanel::locate(dnapos_t pos, unsigned int len, ReferenceGenome** rg, dnapos_t* rgpos) const
+{
+  auto iter = upper_bound(d_refs.begin(), d_refs.end(), pos, 
+			  [](dnapos_t p, const unique_ptr<ReferenceGenome>& r) { return p < r->d_panelOffset; });
+  if(iter == d_refs.begin())
+    return false;
+  --iter;
+  *rg = iter->get();
+  *rgpos = pos - (*rg)->d_panelOffset;
+  if((*rg)->d_contigs.empty())
+    return false;
+  const auto& contig = (*rg)->d_contigs[(*rg)->contigIndex(*rgpos)];
+  return *rgpos >= contig.start && (uint64_t)*rgpos + len <= (uint64_t)contig.start + contig.length;
+}
+
+vector<ReferenceGenome::MatchDescriptor> ReferencePanel::getAllReadPosBoth(FastQRead* fq) const
+{
+  vector<ReferenceGenome::MatchDescriptor> ret;
+  vector<dnapos_t> positions;
+  getAllReadPosBoth(fq, &ret, &positions);
+  return ret;
+}
+
+void ReferencePanel::getAllReadPosBoth(FastQRead* fq, vector<ReferenceGenome::MatchDescriptor>* ret, vector<dnapos_t>* positions) const
+{
+  ret->clear();
+  if(!d_kmers || fq->d_nucleotides.length() < d_kmers->k())
+    return;
+  ReferenceGenome* rg;
+  dnapos_t rgpos;
+  for(int tries = 0; tries < 2; ++tries) {
+    positions->clear();
+    getPositions(fq->d_nucleotides.c_str(), fq->d_nucleotides.length(), positions);
+    for(auto pos : *positions) 
+      if(locate(pos, fq->d_nucleotides.length(), &rg, &rgpos))
+	ret->push_back({rg, rgpos, (bool)tries, 0});
+    fq->reverse();
+  }
+  // per reference, as if we had looked each of them up in turn. Each strand came out in order of position, so this
+  // is what a stable sort on the reference gives, without the buffer stable_sort would allocate
+  sort(ret->begin(), ret->end(), [](const ReferenceGenome::MatchDescriptor& a, const ReferenceGenome::MatchDescriptor& b) {
+      return std::make_tuple(a.rg->d_panelOffset, a.reverse, a.pos) < std::make_tuple(b.rg->d_panelOffset, b.reverse, b.pos);
+    });
+}
@@ -2,46 +2,177 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
-#include <forward_list>
 #include <map>
+#include <set>
+#include <boost/utility/string_ref.hpp>
 #include "geneannotated.hh"
+#include "kmerindex.hh"
 #include "antonie.hh"
 #include "fastq.hh"
+#include "misc.hh"
 
 using std::string;
 using std::vector;
 using std::unordered_map;
 using std::map;
-using std::forward_list; 
 using std::unique_ptr;
 
-//! Position of a FastQRead that is mapped here, and how (reverse complemented or with an indel, and where)
+class ReportWriter;
+
+/** A FastQRead mapped here: where it starts, which read it is, and how (reverse complemented or with an indel, and
+    where). 12 bytes, the strand and the indel live in bits of the read position no FASTQ file gets near */
 struct FASTQMapping
 {
-  uint64_t pos;
-  bool reverse;
-  int indel; // 0 = nothing, >0 means WE have an insert versus reference at pos
-             // <0 means WE have a delete versus reference at pos
-};
+  FASTQMapping() {}
+  FASTQMapping(uint64_t pos, dnapos_t locus, int indel, bool reverse); //!< throws if pos or indel do not fit
+  uint64_t pos() const //!< of the read, as StereoFASTQReader::getRead wants it
+  {
+    return d_read & (s_fileBit | s_offsetMask);
+  }
+  int indel() const // 0 = nothing, >0 means WE have an insert versus reference at pos
+  {                 // <0 means WE have a delete versus reference at pos
+    return (int)((d_read >> s_offsetBits) & s_indelMask) - s_indelBias;
+  }
+  bool reverse() const
+  {
+    return d_read & s_reverseBit;
+  }
+  bool operator<(const FASTQMapping& rhs) const
+  {
+    if(locus != rhs.locus)
+      return locus < rhs.locus;
+    if(pos() != rhs.pos())
+      return pos() < rhs.pos();
+    return d_read < rhs.d_read;
+  }
+
+  dnapos_t locus;
+private:
+  static const unsigned int s_offsetBits = 48, s_indelBits = 14;
+  static const uint64_t s_offsetMask = (1ULL << s_offsetBits) - 1, s_indelMask = (1ULL << s_indelBits) - 1;
+  static const int s_indelBias = 1 << (s_indelBits - 1);
+  static const uint64_t s_reverseBit = 1ULL << 62, s_fileBit = 1ULL << 63; //!< the latter as StereoFASTQReader sets it
+  uint64_t d_read; //!< pos(), with indel() + s_indelBias above s_offsetBits and reverse() in s_reverseBit
+} __attribute__((packed));
+static_assert(sizeof(FASTQMapping) == 12, "FASTQMapping should pack into 12 bytes");
+
 
-//! List of all FASTQMapping s that map to a locus, plus coverage statistic
-struct GenomeLocusMapping
+//! Everything mapping reads to a ReferenceGenome tallies. The ReferenceGenome holds the final result, additional mapping threads each fill their own copy, which gets merged in afterwards
+struct MappingStats
 {
-  GenomeLocusMapping() : coverage(0) {}
-  forward_list<FASTQMapping> d_fastqs;
-  unsigned int coverage;
-};
+  void sizeLike(const MappingStats& rhs); //!< allocate room for the same genome as rhs, but with nothing tallied
+  void fitReadLength(unsigned int length); //!< make room for the per read position tallies of reads this long
+  void merge(MappingStats& rhs); //!< add the tallies of rhs to ours, steals its FASTQMapping s
+  void sortPlacements(); //!< by locus, after which placements() works
+  //! the FASTQMapping s of reads starting from start up to stop, in order
+  std::pair<vector<FASTQMapping>::const_iterator, vector<FASTQMapping>::const_iterator> placements(dnapos_t start, dnapos_t stop) const;
 
+  void mapFastQ(dnapos_t pos, const FastQRead& fqfrag, int indel=0);
+  void cover(dnapos_t pos, char quality, int limit);
+  void cover(dnapos_t pos, unsigned int length, const std::string& quality, int limit) ;
+
+  vector<uint32_t> d_coverage; //!< per locus, the mapped nucleotides of good enough quality
+  vector<FASTQMapping> d_placements; //!< one per read mapped, in the order they came in until sortPlacements()
+  vector<unsigned int> d_correctMappings, d_wrongMappings, d_gcMappings, d_taMappings;
+
+  /** what reads say differently from the reference at a locus, tallied as they come in. The same size however deep
+      the coverage: inserts beyond the first s_insertSlots different ones are only counted, MappingStats::addInsert()
+      keeps track of which they were until settleInserts() */
+  struct LociStats
+  {
+    enum { A, C, G, T, X, N, Kinds }; //!< X is a deletion, N any other nucleotide
+    static const unsigned int s_insertSlots = 4;
+
+    uint32_t counts[Kinds] = {};
+    uint32_t qualities[Kinds] = {}; //!< sum of the qualities, a deletion counts as 40
+    uint32_t heads[Kinds] = {}; //!< how many came from the head of a read
+    struct InsertCount
+    {
+      uint32_t id; //!< in MappingStats::d_inserts
+      uint32_t count;
+    } inserts[s_insertSlots] = {};
+    uint32_t otherInserts = 0; //!< those that did not fit in a slot
+
+    static int kind(char nucleotide);
+    void add(char nucleotide, char quality, bool head);
+    bool addInsert(uint32_t id, unsigned int count=1); //!< false if there was no slot for it, and it only got counted
+    uint32_t total() const; //!< all differences
+    uint32_t totalHeads() const;
+    uint32_t totalInserts() const;
+  };
+
+  /** The LociStats of the loci reads differ at, looked up like an unordered_map. A slot per locus of the genome says
+      where in a flat vector its LociStats is, so a new locus costs no allocation of its own. Iterates in the order
+      loci came in, or by locus after sort() */
+  class LociMap
+  {
+  public:
+    typedef std::pair<dnapos_t, LociStats> value_type;
+    typedef vector<value_type>::iterator iterator;
+    typedef vector<value_type>::const_iterator const_iterator;
+
+    void resize(dnapos_t size); //!< room for loci 0 up to size, which stays if we get clear()ed
+    LociStats& operator[](dnapos_t pos);
+    iterator find(dnapos_t pos);
+    const_iterator find(dnapos_t pos) const;
+    iterator begin() { return d_entries.begin(); }
+    iterator end() { return d_entries.end(); }
+    const_iterator begin() const { return d_entries.begin(); }
+    const_iterator end() const { return d_entries.end(); }
+    size_t size() const { return d_entries.size(); }
+    bool empty() const { return d_entries.empty(); }
+    void clear();
+    void sort(); //!< by locus, so what comes out does not depend on which thread mapped what
+  private:
+    vector<uint32_t> d_slots; //!< per locus, 1 + where its LociStats is in d_entries, 0 for none
+    vector<value_type> d_entries;
+  };
+  typedef LociMap locimap_t;
+  locimap_t d_locimap;
+  vector<string> d_inserts; //!< interned insert sequences, LociStats::InsertCount::id indexes this
+  unordered_map<string, uint32_t> d_insertIds;
+  uint32_t internInsert(boost::string_ref insert);
+  //! tallies insert at pos, in d_otherInserts if its LociStats has no slot left for it
+  void addInsert(dnapos_t pos, boost::string_ref insert, unsigned int count=1);
+  /** after the last merge: the s_insertSlots most frequent inserts of each locus get its slots, ties going by
+      sequence, so which inserts we report does not depend on the order in which reads got mapped and merged */
+  void settleInserts();
+  unordered_map<uint64_t, uint32_t> d_otherInserts; //!< (locus << 32) + insert id, for those without a slot
+private:
+  void addInsert(dnapos_t pos, uint32_t id, unsigned int count);
+  string d_insertKey; //!< internInsert() looks up through this, which keeps its allocation
+};
 
 //! A region with little coverage
 struct Unmatched
 {
-  string left, unmatched, right;
-  dnapos_t pos;
+  dnapos_t pos; //!< its first locus
+  dnapos_t stop; //!< the first locus covered again
+};
+
+//! What one pass over the coverage of a ReferenceGenome yields, see ReferenceGenome::getCoverageStats
+struct CoverageStats
+{
+  static const unsigned int s_minDepth = 5; //!< loci covered less are undercovered
+  static const unsigned int s_gcWindow = 40; //!< the nucleotides around a locus whose GC content we relate to its depth
+
+  vector<unsigned int> histo; //!< per depth, how many loci have it
+  VarMeanEstimator depth;
+  uint64_t undercovered = 0; //!< loci
+  vector<Unmatched> lowRuns; //!< stretches of undercovered loci, in order
+  //! depth per window of s_gcWindow nucleotides, indexed by how many of them counted (ACGTN) and how many of those were G or C
+  vector<VarMeanEstimator> gcCoverage;
+
+  static unsigned int gcIndex(unsigned int counted, unsigned int gc) { return counted*(s_gcWindow + 1) + gc; }
+  //! gcCoverage per GC fraction, as getGCContent would give it for the window
+  map<double, VarMeanEstimator> gcTable() const;
+  //! adds the stats of the stretch of genome following ours
+  void append(const CoverageStats& rhs);
 };
 
-//! Represents a reference genome to be aligned against
-class ReferenceGenome
+/** Represents a reference genome to be aligned against. All records of the FASTA file end up in one genome as its
+    contigs, with a single N between each two of them so nothing matches across. Positions are within that genome */
+class ReferenceGenome : public MappingStats
 {
 public:
   ReferenceGenome(const string& fname); //!< Read reference from FASTA
@@ -60,70 +191,90 @@ public:
     bool reverse;
     int score;
   };
-  void mapFastQ(dnapos_t pos, const FastQRead& fqfrag, int indel=0);
-  void cover(dnapos_t pos, char quality, int limit);
-  void cover(dnapos_t pos, unsigned int length, const std::string& quality, int limit) ;
-  vector<MatchDescriptor> getAllReadPosBoth(FastQRead* fq); // tries original & complement
-  dnapos_t getReadPosBoth(FastQRead* fq, int qlimit); // tries original & complement
-  vector<dnapos_t> getReadPositions(const std::string& nucleotides);
 
   vector<dnapos_t> getGCHisto();
+  //! nucleotides start up to stop, both clamped to the genome, without copying them. Valid for as long as we are
+  boost::string_ref view(dnapos_t start, dnapos_t stop) const
+  {
+    if(start > d_genome.size())
+      start = d_genome.size();
+    if(stop > d_genome.size())
+      stop = d_genome.size();
+    return boost::string_ref(d_genome.c_str() + start, stop > start ? stop - start : 0);
+  }
+  //! the nucleotide at pos, 0 beyond the end
+  char nucleotide(dnapos_t pos) const
+  {
+    return pos < d_genome.size() ? d_genome[pos] : 0;
+  }
+  //! a copy of view(start, stop)
   string snippet(dnapos_t start, dnapos_t stop) const;
 
-  void printCoverage(FILE* jsfp, const std::string& fname);
-  void index(unsigned int length);
+  /** one pass over d_coverage, and the reference for GC content, in chunks on numThreads threads. lowRuns only has
+      those with at least 40 nucleotides of reference either side, and that end before the genome does */
+  CoverageStats getCoverageStats(unsigned int numThreads=1) const;
+  //! writes the coverage histogram as fname, and coverage by GC content, to js. Also writes the gccoverage file
+  void printCoverage(ReportWriter& js, const std::string& fname, unsigned int numThreads=1);
+
+  //! One record of our FASTA
+  struct Contig
+  {
+    string name, fullname;
+    dnapos_t start, length; //!< start is the position of its first nucleotide
+  };
+  vector<Contig> d_contigs; //!< in order of position
+  //! the one of d_contigs pos is in, the N after a contig counts as its own
+  unsigned int contigIndex(dnapos_t pos) const;
 
   string getMatchingFastQs(dnapos_t pos, StereoFASTQReader& fastq); 
   string getMatchingFastQs(dnapos_t start, dnapos_t stop,  StereoFASTQReader& fastq); 
-  vector<GenomeLocusMapping> d_mapping;
-  vector<unsigned int> d_correctMappings, d_wrongMappings, d_gcMappings, d_taMappings;
 
   vector<Unmatched> d_unmRegions;
-  //! statistics for a locus
-  struct LociStats
-  {
-    //! A difference in this locus
-    struct Difference
-    {
-      char nucleotide;
-      char quality;
-      bool headOrTail;
-      string insert;
-      bool operator<(const Difference& b) const
-      {
-	return std::tie(nucleotide, quality) < std::tie(b.nucleotide, b.quality);
-      }
-    };
-    vector<Difference> samples; 
-  };
   dnapos_t d_aCount, d_cCount, d_gCount, d_tCount;
-  typedef unordered_map<dnapos_t, LociStats> locimap_t;
-  locimap_t d_locimap;
-  unordered_map<dnapos_t, unsigned int> d_insertCounts;
-  string d_name;
+  string d_name; //!< of our first contig
   string d_fullname;
+  dnapos_t d_panelOffset = 0; //!< where our genome starts in the ReferencePanel we are part of
   unique_ptr<GeneAnnotationReader> d_gar;
   void addAnnotations(GeneAnnotationReader* gar) 
   {
     d_gar=unique_ptr<GeneAnnotationReader>(gar);
   }
 private:
+  friend class ReferencePanel;
   ReferenceGenome() = default;
+  void addContig(const string& fullname); //!< nucleotides appended after this are part of it
   void initGenome();
   string d_genome;
-  struct HashPos {
-    HashPos(uint32_t hash_, dnapos_t pos) : d_hash(hash_), d_pos(pos)
-    {}
-    HashPos(){}
-    uint32_t d_hash;
-    dnapos_t d_pos;
-    
-    bool operator<(const HashPos& rhs) const 
-    {
-      return d_hash < rhs.d_hash;
-    }
-  };
+  string d_fname; //!< empty if we did not come from a file
+  std::set<unsigned int> d_indexLengths; //!< set by the ReferencePanel that indexes us
+};
+
+/** All contigs of a number of ReferenceGenome s, looked up through one index. Looking up a read costs the same
+    however many references there are. Positions in the panel are those of each genome, offset by its d_panelOffset */
+class ReferencePanel
+{
+public:
+  explicit ReferencePanel(vector<unique_ptr<ReferenceGenome> >& refs);
+  ReferencePanel(const ReferencePanel&) = delete;
+  ReferencePanel& operator=(const ReferencePanel&) = delete;
 
-  typedef vector<HashPos> index_t;
-  map<int, index_t> d_indexes;
+  /** after this, reads of these lengths and longer can be looked up, on all our references at once. Built on numThreads
+      threads, saved next to the FASTA and used from there next time */
+  void index(const vector<unsigned int>& lengths, unsigned int numThreads=1);
+  //! appends the panel positions where nucleotides occur, they have to be at least as long as the shortest length we indexed
+  void getPositions(const char* nucleotides, unsigned int len, vector<dnapos_t>* ret) const;
+  //! the reference and position on it for panel position pos. False if len nucleotides from there do not fit in a single contig
+  bool locate(dnapos_t pos, unsigned int len, ReferenceGenome** rg, dnapos_t* rgpos) const;
+  //! exact matches on all references, tries original & complement, reads of any length
+  vector<ReferenceGenome::MatchDescriptor> getAllReadPosBoth(FastQRead* fq) const;
+  //! the same into ret, with positions as scratch space. Both keep their allocations from call to call
+  void getAllReadPosBoth(FastQRead* fq, vector<ReferenceGenome::MatchDescriptor>* ret, vector<dnapos_t>* positions) const;
+  dnapos_t size() const
+  {
+    return d_genome.size();
+  }
+private:
+  vector<unique_ptr<ReferenceGenome> >& d_refs;
+  string d_genome; //!< those of d_refs back to back, each still with its padding in front
+  unique_ptr<KmerIndex> d_kmers;
 };
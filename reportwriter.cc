@@ -0,0 +1,106 @@
+#include "reportwriter.hh"
+#include <stdexcept>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+using namespace std;
+
+void appendInteger(string* out, uint64_t val)
+{
+  char digits[20];
+  char* p = digits + sizeof(digits);
+  do {
+    *--p = '0' + val % 10;
+    val /= 10;
+  } while(val);
+  out->append(p, digits + sizeof(digits) - p);
+}
+
+void appendInteger(string* out, int64_t val)
+{
+  if(val < 0) {
+    out->append(1, '-');
+    appendInteger(out, -(uint64_t)val);
+  }
+  else
+    appendInteger(out, (uint64_t)val);
+}
+
+void appendDouble(string* out, double val)
+{
+  // most of what we write are counts or zeroes, which %g shows as integers up to 6 digits
+  if(val == floor(val) && fabs(val) < 1000000 && !(val == 0 && signbit(val))) {
+    appendInteger(out, (int64_t)val);
+    return;
+  }
+  char buffer[32];
+  int len = snprintf(buffer, sizeof(buffer), "%g", val);
+  out->append(buffer, len);
+}
+
+void appendFixed(string* out, double val, int decimals)
+{
+  char buffer[384]; // %f of the largest double has 309 digits before the point
+  int len = snprintf(buffer, sizeof(buffer), "%.*f", decimals, val);
+  out->append(buffer, min<int>(len, sizeof(buffer) - 1));
+}
+
+void writeJSONPairs(ReportWriter& rw, const vector<pair<double, double> >& in)
+{
+  rw << '[';
+  for(size_t n = 0; n < in.size(); ++n) {
+    if(n)
+      rw << ',';
+    rw << '[' << in[n].first << ',' << in[n].second << ']';
+  }
+  rw << ']';
+}
+
+void ReportWriter::addSink(const string& fname, bool compress)
+{
+  Sink sink{compress ? fname+".gz" : fname, 0, 0};
+  if(compress)
+    sink.gz = gzopen(sink.fname.c_str(), "wb");
+  else
+    sink.fp = fopen(sink.fname.c_str(), "w");
+  if(!sink.fp && !sink.gz)
+    throw runtime_error("Unable to open '"+sink.fname+"' for writing a report: "+string(strerror(errno)));
+  d_sinks.push_back(sink);
+}
+
+void ReportWriter::flush()
+{
+  if(d_sinks.empty()) // then we are only collecting
+    return;
+  for(const auto& sink : d_sinks) {
+    bool ok = sink.gz ? gzwrite(sink.gz, d_buffer.c_str(), d_buffer.size()) == (int)d_buffer.size() :
+      fwrite(d_buffer.c_str(), 1, d_buffer.size(), sink.fp) == d_buffer.size() && !fflush(sink.fp);
+    if(!ok)
+      throw runtime_error("Unable to write report to '"+sink.fname+"'");
+  }
+  d_buffer.clear();
+}
+
+void ReportWriter::close()
+{
+  if(d_sinks.empty())
+    return;
+  flush();
+  string failed;
+  for(const auto& sink : d_sinks) {
+    if(sink.gz ? gzclose(sink.gz) != Z_OK : fclose(sink.fp) != 0)
+      failed = sink.fname;
+  }
+  d_sinks.clear();
+  if(!failed.empty())
+    throw runtime_error("Unable to finish writing report to '"+failed+"'");
+}
+
+ReportWriter::~ReportWriter()
+{
+  try {
+    close();
+  }
+  catch(...) {} // a destructor has nobody to tell
+}
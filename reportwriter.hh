@@ -0,0 +1,162 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <type_traits>
+#include <stdio.h>
+#include <stdint.h>
+#include <zlib.h>
+#include <boost/utility.hpp>
+#include <boost/utility/string_ref.hpp>
+#include "antonie.hh"
+
+//! appends val in decimal
+void appendInteger(std::string* out, uint64_t val);
+void appendInteger(std::string* out, int64_t val);
+//! appends val as an ostream would by default, which is like printf %g
+void appendDouble(std::string* out, double val);
+//! appends val like printf %.<decimals>f
+void appendFixed(std::string* out, double val, int decimals);
+
+//! a double to be written with a fixed number of decimals, see fixed()
+struct FixedDouble
+{
+  double val;
+  int decimals;
+};
+
+//! for ReportWriter: val with decimals digits after the point, like printf %f does
+inline FixedDouble fixed(double val, int decimals=6)
+{
+  return {val, decimals};
+}
+
+/** Buffered writer for our reports: data.js and the loci files. Text and numbers get formatted straight into one
+    buffer, which goes out to each of our sinks once it has grown large enough. A sink is a plain file or a gzip
+    compressed one. A ReportWriter without sinks only collects, so a record can be formatted once and then be
+    handed to several writers */
+class ReportWriter : boost::noncopyable
+{
+public:
+  ReportWriter() {}
+  //! writes to fname, or with compress to fname.gz
+  explicit ReportWriter(const std::string& fname, bool compress=false)
+  {
+    addSink(fname, compress);
+  }
+  ~ReportWriter();
+  //! also writes to fname, or with compress to fname.gz. Throws if it can't be opened
+  void addSink(const std::string& fname, bool compress=false);
+
+  ReportWriter& operator<<(char c)
+  {
+    d_buffer.append(1, c);
+    return check();
+  }
+  ReportWriter& operator<<(const char* str)
+  {
+    d_buffer.append(str);
+    return check();
+  }
+  ReportWriter& operator<<(const std::string& str)
+  {
+    d_buffer.append(str);
+    return check();
+  }
+  ReportWriter& operator<<(boost::string_ref str)
+  {
+    d_buffer.append(str.data(), str.size());
+    return check();
+  }
+  ReportWriter& operator<<(double val)
+  {
+    appendDouble(&d_buffer, val);
+    return check();
+  }
+  ReportWriter& operator<<(const FixedDouble& fd)
+  {
+    appendFixed(&d_buffer, fd.val, fd.decimals);
+    return check();
+  }
+  template<typename T>
+  typename std::enable_if<std::is_integral<T>::value, ReportWriter&>::type operator<<(T val)
+  {
+    if(std::is_signed<T>::value)
+      appendInteger(&d_buffer, (int64_t)val);
+    else
+      appendInteger(&d_buffer, (uint64_t)val);
+    return check();
+  }
+
+  //! what we have collected and not yet written
+  const std::string& str() const
+  {
+    return d_buffer;
+  }
+  void clear()
+  {
+    d_buffer.clear();
+  }
+  //! writes what we have collected to all our sinks, if we have any
+  void flush();
+  //! flushes and closes all sinks, throws if writing to any of them failed
+  void close();
+
+private:
+  ReportWriter& check()
+  {
+    if(d_buffer.size() >= s_flushSize && !d_sinks.empty())
+      flush();
+    return *this;
+  }
+  static const size_t s_flushSize = 1 << 16;
+  struct Sink
+  {
+    std::string fname;
+    FILE* fp;
+    gzFile gz;
+  };
+  std::string d_buffer;
+  std::vector<Sink> d_sinks;
+};
+
+//! v as name=[[x,y],...];, with y = yAdjust(v[x]) and x = xAdjust(offset in v), both as doubles
+template<typename T, typename Y, typename X>
+void writeJSONVector(ReportWriter& rw, const std::string& name, const std::vector<T>& v, Y yAdjust, X xAdjust)
+{
+  rw << name << "=[";
+  for(size_t n = 0; n < v.size(); ++n) {
+    if(n)
+      rw << ',';
+    rw << '[' << (double)xAdjust(n) << ',' << (double)yAdjust(v[n]) << ']';
+  }
+  rw << "];\n";
+}
+
+template<typename T, typename Y>
+void writeJSONVector(ReportWriter& rw, const std::string& name, const std::vector<T>& v, Y yAdjust)
+{
+  writeJSONVector(rw, name, v, yAdjust, [](int i){return 1.0*i;});
+}
+
+template<typename T>
+void writeJSONVector(ReportWriter& rw, const std::string& name, const std::vector<T>& v)
+{
+  writeJSONVector(rw, name, v, [](dnapos_t d){return 1.0*d;});
+}
+
+//! v as [[x,v[x]],...], with x = xAdjust(offset in v)
+template<typename T, typename X>
+void writeJSONPairs(ReportWriter& rw, const std::vector<T>& v, X xAdjust)
+{
+  rw << '[';
+  for(size_t n = 0; n < v.size(); ++n) {
+    if(n)
+      rw << ',';
+    rw << '[' << xAdjust(n) << ',' << v[n] << ']';
+  }
+  rw << ']';
+}
+
+//! in as [[first,second],...]
+void writeJSONPairs(ReportWriter& rw, const std::vector<std::pair<double, double> >& in);
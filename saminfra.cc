@@ -39,7 +39,7 @@ SAMWriter::SAMWriter(const std::string& fname, const std::string& genomeName, dn
   fprintf(d_fp, "@PG\tID:antonie\tPN:antonie\tVN:0.0.0\n");  
 }
 
-void SAMWriter::write(dnapos_t pos, const FastQRead& fqfrag, int indel, int flags, const std::string& rnext, dnapos_t pnext, int32_t tlen)
+void SAMWriter::write(dnapos_t pos, const FastQRead& fqfrag, const Cigar& cigarOps, int flags, const std::string& rnext, dnapos_t pnext, int32_t tlen)
 {
   if(!d_fp) 
     return;
@@ -50,26 +50,7 @@ void SAMWriter::write(dnapos_t pos, const FastQRead& fqfrag, int indel, int flag
     c+=33; // we always output Sanger
   }
 
-  string cigar;
-  if(!indel) {
-    cigar = lexical_cast<string>(fqfrag.d_nucleotides.length());
-    cigar.append(1,'M');
-  }
-  else if(indel < 0) {
-    cigar = lexical_cast<string>(-indel);
-    cigar.append(1,'M');
-    cigar += "1D";
-    cigar += lexical_cast<string>(fqfrag.d_nucleotides.length()+indel);
-    cigar.append(1,'M');
-  }
-  else if(indel > 0) {
-    cigar = lexical_cast<string>(indel);
-    cigar.append(1,'M');
-    cigar += "1I";
-    cigar += lexical_cast<string>(fqfrag.d_nucleotides.length()-1-indel);
-    cigar.append(1,'M');
-
-  }
+  string cigar = cigarString(cigarOps, fqfrag.d_nucleotides.length());
 	
   fprintf(d_fp, "%s\t%u\t%s\t%u\t42\t%s\t"
 	  "%s\t%u\t%d\t"
@@ -126,7 +107,7 @@ struct BAMBuilder
   string* d_str;
 };
 
-BAMWriter::BAMWriter(const std::string& fname, const std::string& refname, dnapos_t reflen) : d_fname(fname), d_zw(fname)
+BAMWriter::BAMWriter(const std::string& fname, const std::vector<BAMContig>& contigs) : d_fname(fname), d_contigs(contigs), d_zw(fname)
 {
   if(d_fname.empty())
     return;
@@ -138,18 +119,22 @@ BAMWriter::BAMWriter(const std::string& fname, const std::string& refname, dnapo
   bb.write(magic, 4);
 
   string header("@HD\tVN:1.0\tSO:unsorted\n");
-  header.append("@SQ\tSN:");
-  header.append(refname.c_str());
-  header.append("\tLN:");
-  header.append(lexical_cast<string>(reflen));
-  header.append("\n@PG\tID:antonie\tPN:antonie\tVN:0.0.0\n");  
+  for(const auto& contig : d_contigs) {
+    header.append("@SQ\tSN:");
+    header.append(contig.name);
+    header.append("\tLN:");
+    header.append(lexical_cast<string>(contig.length));
+    header.append("\n");
+  }
+  header.append("@PG\tID:antonie\tPN:antonie\tVN:0.0.0\n");  
 
   bb.writeBAMString(header);
 
-  bb.write32(1);
-
-  bb.writeBAMString(refname);  
-  bb.write32(reflen);
+  bb.write32(d_contigs.size());
+  for(const auto& contig : d_contigs) {
+    bb.writeBAMString(contig.name);  
+    bb.write32(contig.length);
+  }
 
   d_zw.write(block.c_str(), block.size());
 }
@@ -185,38 +170,116 @@ string bamCompress(const std::string& dna)
   return ret;
 }
 
-void BAMWriter::qwrite(dnapos_t pos, const FastQRead& fqfrag, int indel, int flags, const std::string& rnext, dnapos_t pnext, int32_t tlen)
+void BAMQueue::qwrite(dnapos_t pos, const FastQRead& fqfrag, const Cigar& cigar, int flags, const std::string& rnext, dnapos_t pnext, int32_t tlen)
+{
+  d_queue.push_back(Write{pos, fqfrag.position, fqfrag.reversed, d_cigars.size(), (uint32_t)cigar.size(), flags, pnext, tlen});
+  d_cigars.insert(d_cigars.end(), cigar.begin(), cigar.end());
+}
+
+void BAMQueue::merge(BAMQueue& rhs)
+{
+  if(d_queue.empty()) {
+    d_queue.swap(rhs.d_queue);
+    d_cigars.swap(rhs.d_cigars);
+    return;
+  }
+  uint64_t offset = d_cigars.size();
+  for(auto& w : rhs.d_queue)
+    w.cigarOffset += offset;
+  d_queue.insert(d_queue.end(), rhs.d_queue.begin(), rhs.d_queue.end());
+  d_cigars.insert(d_cigars.end(), rhs.d_cigars.begin(), rhs.d_cigars.end());
+  rhs.d_queue.clear();
+  rhs.d_cigars.clear();
+}
+
+void BAMQueue::reserve(size_t writes, size_t cigarOps)
+{
+  d_queue.reserve(writes);
+  d_cigars.reserve(cigarOps);
+}
+
+void BAMWriter::qwrite(dnapos_t pos, const FastQRead& fqfrag, const Cigar& cigar, int flags, const std::string& rnext, dnapos_t pnext, int32_t tlen)
+{
+  if(d_fname.empty())
+    return;
+  d_queue.qwrite(pos, fqfrag, cigar, flags, rnext, pnext, tlen);
+}
+
+void BAMWriter::mergeQueue(BAMQueue& queue)
 {
   if(d_fname.empty())
     return;
-  Write w{pos, fqfrag.position, fqfrag.reversed, indel, flags, rnext, pnext, tlen};
-  d_queue.push_back(w);
+  d_queue.merge(queue);
+}
+
+void BAMWriter::locate(dnapos_t pos, int32_t* refID, dnapos_t* contigPos) const
+{
+  auto iter = std::upper_bound(d_contigs.begin(), d_contigs.end(), pos, [](dnapos_t p, const BAMContig& c) { return p < c.start; });
+  if(iter != d_contigs.begin())
+    --iter;
+  *refID = iter - d_contigs.begin();
+  *contigPos = pos - iter->start + 1;
 }
 
 void BAMWriter::runQueue(StereoFASTQReader& sfq)
 {
   if(d_fname.empty())
     return;
-  sort(d_queue.begin(), d_queue.end());
+  auto& queue = d_queue.d_queue;
+  sort(queue.begin(), queue.end()); // which also sorts them by contig
   FastQRead fqfrag;
-  std::map<unsigned int, std::vector<std::vector<Write>::iterator>> bins;
+  Cigar cigar;
 
-  boost::progress_display show_progress(d_queue.size(), std::cerr);
+  boost::progress_display show_progress(queue.size(), std::cerr);
 
-  for(auto iter = d_queue.begin() ; iter != d_queue.end(); ++iter) {
+  for(auto iter = queue.begin() ; iter != queue.end(); ++iter) {
     ++show_progress;
     sfq.getRead(iter->fpos, &fqfrag);
     if(iter->reversed)
       fqfrag.reverse();
-    iter->voffset = write(iter->pos, fqfrag, iter->indel, iter->flags, iter->rnext, iter->pnext, iter->tlen);
-    iter->bin=reg2bin(iter->pos, iter->pos +fqfrag.d_nucleotides.length());
-    bins[iter->bin].push_back(iter);
+    auto ops = d_queue.d_cigars.begin() + iter->cigarOffset;
+    cigar.assign(ops, ops + iter->cigarLength);
+    iter->voffset = write(iter->pos, fqfrag, cigar, iter->flags, "*", iter->pnext, iter->tlen);
+    locate(iter->pos, &iter->refID, &iter->pos); // from here on, the index wants positions on the contig
+    iter->bin=reg2bin(iter->pos, iter->pos + cigarReferenceLength(cigar, fqfrag.d_nucleotides.length()));
   }
 
   string index;
   BAMBuilder bb(&index);
   bb.write("BAI\1",4);
-  bb.write32(1);
+  bb.write32(d_contigs.size());
+  auto begin = queue.begin();
+  for(int32_t refID = 0; refID < (int32_t)d_contigs.size(); ++refID) {
+    auto end = begin;
+    while(end != queue.end() && end->refID == refID)
+      ++end;
+    writeIndex(&index, begin, end);
+    begin = end;
+  }
+
+  string fname=d_fname+".bai";
+  d_baifp=fopen(fname.c_str(), "w");
+  if(!d_baifp)
+    throw std::runtime_error("Unable to open '"+fname+"' for writing BAM index file"+strerror(errno));
+  fwrite(index.c_str(), 1, index.size(), d_baifp);
+  fclose(d_baifp);
+  queue.clear();
+}
+
+//! the bins and linear index of the reads on one contig, begin up to end
+void BAMWriter::writeIndex(std::string* index, std::vector<BAMQueue::Write>::iterator begin, std::vector<BAMQueue::Write>::iterator end) const
+{
+  typedef BAMQueue::Write Write;
+  BAMBuilder bb(index);
+  if(begin == end) {
+    bb.write32(0); // no bins
+    bb.write32(0); // no linear index
+    return;
+  }
+  std::map<unsigned int, std::vector<std::vector<Write>::iterator>> bins;
+  for(auto iter = begin; iter != end; ++iter)
+    bins[iter->bin].push_back(iter);
+
   bb.write32(bins.size()+1); // +1 is for magic stats
 
   for(const auto& bin: bins) {
@@ -269,73 +332,55 @@ void BAMWriter::runQueue(StereoFASTQReader& sfq)
   bb.write32(2);
   bb.write64(0);
   bb.write64(0);
-  bb.write64(d_queue.size());
+  bb.write64(end - begin);
   bb.write64(0);
 
   // linear index
-  int numWindows = d_queue.rbegin()->pos/16384;
+  int numWindows = prev(end)->pos/16384 + 1;
   bb.write32(numWindows);
   vector<uint64_t> lims(numWindows);
   for(auto& lim : lims) {
     lim = std::numeric_limits<uint64_t>::max();
   }
 
-  for(const auto& w : d_queue) {
-    lims[w.pos/16384] = std::min(lims[w.pos/16384], w.voffset);
+  for(auto iter = begin; iter != end; ++iter) {
+    lims[iter->pos/16384] = std::min(lims[iter->pos/16384], iter->voffset);
   }
   
   for(const auto& lim : lims)
     bb.write64(lim);
-
-  string fname=d_fname+".bai";
-  d_baifp=fopen(fname.c_str(), "w");
-  if(!d_baifp)
-    throw std::runtime_error("Unable to open '"+fname+"' for writing BAM index file"+strerror(errno));
-  fwrite(index.c_str(), 1, index.size(), d_baifp);
-  fclose(d_baifp);
-  d_queue.clear();
 }
 
-uint64_t BAMWriter::write(dnapos_t pos, const FastQRead& fqfrag, int indel, int flags, const std::string& rnext, dnapos_t pnext, int32_t tlen)
+uint64_t BAMWriter::write(dnapos_t pos, const FastQRead& fqfrag, const Cigar& cigarOps, int flags, const std::string& rnext, dnapos_t pnext, int32_t tlen)
 {
   string block;
 
   string cigar;
   uint32_t i;
-  if(!indel) {
+  if(cigarOps.empty()) {
     i=fqfrag.d_nucleotides.length()<<4;
     cigar.assign((char*)&i, 4); // "150M"
   }
-  else if(indel < 0) {
-    i=(-indel)<<4;
-    cigar.assign((char*)&i, 4); // first part M
-    i= (1<<4) | 2;              // 1D
-    cigar.append((char*)&i, 4); 
-    i=(fqfrag.d_nucleotides.length()+indel)<<4; // restM
-    cigar.append((char*)&i, 4); 
-  }
-  else if(indel > 0) {
-    i = indel <<4;
-    cigar.assign((char*)&i, 4); // "150M"
-    i= (1<<4) | 1;              // 1I
-    cigar.append((char*)&i, 4); 
-    
-    i=(fqfrag.d_nucleotides.length()-1-indel)<<4; // restM
-    cigar.append((char*)&i, 4); 
-  }
+  else 
+    cigar.assign((const char*)cigarOps.data(), 4*cigarOps.size());
+
+  int32_t refID, nextRefID = -1;
+  locate(pos, &refID, &pos);
+  if(pnext)
+    locate(pnext, &nextRefID, &pnext);
 
   BAMBuilder bb(&block);
   bb.write32(0); // length, placeholder
-  bb.write32(0); // reference sequence ID
+  bb.write32(refID); // reference sequence ID
   bb.write32(pos-1); // 0-based!
-  auto bin = reg2bin(pos-1, pos+fqfrag.d_nucleotides.length()-1); // 0-based!
+  auto bin = reg2bin(pos-1, pos+cigarReferenceLength(cigarOps, fqfrag.d_nucleotides.length())-1); // 0-based!
   int mapq=0;
   string name = fqfrag.getNameFromHeader();
   bb.write32((bin<<16) | (mapq<<8) | (name.length()+1));
   flags += (fqfrag.reversed ? 0x10: 0);
   bb.write32((flags << 16) | (cigar.length()/4)); // cigar ops
   bb.write32(fqfrag.d_nucleotides.length());
-  bb.write32(0); // next reference sequence ID
+  bb.write32(nextRefID); // next reference sequence ID
   bb.write32(pnext - 1);
   bb.write32(tlen);
 
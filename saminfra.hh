@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include "fastq.hh"
 #include "zstuff.hh"
+#include "aligner.hh"
 
 //! Write SAM files, with support for paired-end read mappings
 class SAMWriter
@@ -12,7 +13,7 @@ class SAMWriter
 public:
   SAMWriter(const std::string& fname, const std::string& genome, dnapos_t len);
   ~SAMWriter();
-  void write(dnapos_t pos, const FastQRead& fqfrag, int indel=0, int flags=0, const std::string& rnext="*", dnapos_t pnext=0, int32_t tlen=0 );
+  void write(dnapos_t pos, const FastQRead& fqfrag, const Cigar& cigar=Cigar(), int flags=0, const std::string& rnext="*", dnapos_t pnext=0, int32_t tlen=0 );
 private:
   FILE* d_fp;
   std::string d_fname;
@@ -20,39 +21,70 @@ private:
 };
 
 
-//! Write BAM files, with support for paired-end read mappings
-class BAMWriter
+//! A reference sequence in the header of a BAM file
+struct BAMContig
+{
+  std::string name;
+  dnapos_t start; //!< position of its first nucleotide, in the positions that get queued
+  dnapos_t length;
+};
+
+/** Reads waiting to be written to a BAMWriter, which happens sorted once mapping is done. Mapping threads each fill their own queue.
+    Positions are those of all BAMContig s back to back, the BAMWriter turns them into a contig and a position on it.
+    The cigars of all writes share one vector, so queueing a read only allocates when that or the queue has to grow */
+class BAMQueue
 {
 public:
-  BAMWriter(const std::string& fname, const std::string& genome, dnapos_t len);
-  ~BAMWriter();
-  uint64_t write(dnapos_t pos, const FastQRead& fqfrag, int indel=0, int flags=0, const std::string& rnext="*", dnapos_t pnext=0, int32_t tlen=0 );
-  void qwrite(dnapos_t pos, const FastQRead& fqfrag, int indel=0, int flags=0, const std::string& rnext="*", dnapos_t pnext=0, int32_t tlen=0 );
-  void runQueue(StereoFASTQReader& sfq);
+  //! rnext is not kept, in BAM the contig of the mate follows from pnext
+  void qwrite(dnapos_t pos, const FastQRead& fqfrag, const Cigar& cigar=Cigar(), int flags=0, const std::string& rnext="*", dnapos_t pnext=0, int32_t tlen=0 );
+  void merge(BAMQueue& rhs); //!< moves all queued writes of rhs to us
+  void reserve(size_t writes, size_t cigarOps); //!< room for this many writes and cigar operations in all
 private:
-
-  std::string d_fname;
-  std::string d_genomeName;
-  BGZFWriter d_zw;
-  FILE* d_baifp;
+  friend class BAMWriter;
   struct Write
   {
     bool operator<(const Write& rhs) const
     {
-      return pos < rhs.pos;
+      return std::tie(pos, fpos) < std::tie(rhs.pos, rhs.fpos);
     }
     dnapos_t pos;
     uint64_t fpos;
     bool reversed;
-    int indel;
+    uint64_t cigarOffset; //!< in d_cigars
+    uint32_t cigarLength; //!< no operations if the read matches straight
     int flags;
-    std::string rnext;
     dnapos_t pnext;
     int tlen;
     uint64_t voffset;
     unsigned int bin;
+    int32_t refID;
   };
   std::vector<Write> d_queue;
+  std::vector<uint32_t> d_cigars;
+};
+
+//! Write BAM files, with support for paired-end read mappings
+class BAMWriter
+{
+public:
+  BAMWriter(const std::string& fname, const std::vector<BAMContig>& contigs);
+  ~BAMWriter();
+  bool enabled() const { return !d_fname.empty(); }
+  //! pos and pnext as in a BAMQueue
+  uint64_t write(dnapos_t pos, const FastQRead& fqfrag, const Cigar& cigar=Cigar(), int flags=0, const std::string& rnext="*", dnapos_t pnext=0, int32_t tlen=0 );
+  void qwrite(dnapos_t pos, const FastQRead& fqfrag, const Cigar& cigar=Cigar(), int flags=0, const std::string& rnext="*", dnapos_t pnext=0, int32_t tlen=0 );
+  void mergeQueue(BAMQueue& queue);
+  void runQueue(StereoFASTQReader& sfq);
+private:
+  //! which of d_contigs pos is on, and where on it
+  void locate(dnapos_t pos, int32_t* refID, dnapos_t* contigPos) const;
+  void writeIndex(std::string* index, std::vector<BAMQueue::Write>::iterator begin, std::vector<BAMQueue::Write>::iterator end) const;
+
+  std::string d_fname;
+  std::vector<BAMContig> d_contigs;
+  BGZFWriter d_zw;
+  FILE* d_baifp;
+  BAMQueue d_queue;
 };
 
 std::string bamCompress(const std::string& dna);
@@ -0,0 +1,63 @@
+#include "seeding.hh"
+#include "dnakernels.hh"
+#include <algorithm>
+#include <tuple>
+
+using namespace std;
+
+DiagonalVoter::DiagonalVoter(const ReferencePanel& panel, unsigned int keylen, unsigned int stride, unsigned int band, unsigned int maxHits) :
+  d_panel(panel), d_keylen(keylen), d_stride(max(1U, stride)), d_band(band), d_maxHits(maxHits)
+{
+}
+
+void DiagonalVoter::vote(const string& nucleotides, unsigned int maxCandidates, unsigned int minVotes, vector<SeedCandidate>* ret)
+{
+  ret->clear();
+  voteStrand(nucleotides.c_str(), nucleotides.length(), false, minVotes, ret);
+  d_reversed.assign(nucleotides);
+  reverseComplement(&d_reversed[0], d_reversed.length());
+  voteStrand(d_reversed.c_str(), d_reversed.length(), true, minVotes, ret);
+
+  // ties go to the forward strand and then to the lowest position, so the outcome is the same every time
+  sort(ret->begin(), ret->end(), [](const SeedCandidate& a, const SeedCandidate& b) {
+      return std::make_tuple(b.votes, a.reverse, a.diagonal) < std::make_tuple(a.votes, b.reverse, b.diagonal);
+    });
+  if(ret->size() > maxCandidates)
+    ret->resize(maxCandidates);
+}
+
+void DiagonalVoter::voteStrand(const char* nucleotides, unsigned int len, bool reverse, unsigned int minVotes, vector<SeedCandidate>* ret)
+{
+  d_diagonals.clear();
+  for(unsigned int offset = 0; offset + d_keylen <= len; offset += d_stride) {
+    d_hits.clear();
+    d_panel.getPositions(nucleotides + offset, d_keylen, &d_hits);
+    if(d_hits.size() > d_maxHits)
+      continue;
+    for(auto pos : d_hits)
+      if(pos >= offset)
+	d_diagonals.push_back(pos - offset);
+  }
+  sort(d_diagonals.begin(), d_diagonals.end());
+
+  // runs of diagonals no more than d_band apart form one candidate, on the diagonal most of them agree on
+  for(auto begin = d_diagonals.begin(); begin != d_diagonals.end(); ) {
+    auto end = begin + 1;
+    while(end != d_diagonals.end() && *end - *(end - 1) <= d_band)
+      ++end;
+    if((unsigned int)(end - begin) >= minVotes) {
+      dnapos_t best = *begin;
+      unsigned int bestCount = 0;
+      for(auto iter = begin; iter != end; ) {
+	auto same = upper_bound(iter, end, *iter);
+	if((unsigned int)(same - iter) > bestCount) {
+	  best = *iter;
+	  bestCount = same - iter;
+	}
+	iter = same;
+      }
+      ret->push_back({best, (unsigned int)(end - begin), reverse});
+    }
+    begin = end;
+  }
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "refgenome.hh"
+
+//! Where a read might map, as voted for by the k-mers it shares with the reference there
+struct SeedCandidate
+{
+  dnapos_t diagonal; //!< panel position the read would start at
+  unsigned int votes;
+  bool reverse; //!< voted for by the reverse complement of the read
+};
+
+/** Finds where a read might map in spite of differences. Looks up k-mers of the read, every stride nucleotides, on
+    both strands, and counts the hits per diagonal: reference position minus offset in the read. Diagonals a few
+    positions apart, as an indel makes them, count together. K-mers that occur more than maxHits times are skipped,
+    repeats vote for everything. Keeps its buffers from read to read, so have one per thread */
+class DiagonalVoter
+{
+public:
+  DiagonalVoter(const ReferencePanel& panel, unsigned int keylen, unsigned int stride=3, unsigned int band=4, unsigned int maxHits=128);
+  //! the candidates with at least minVotes, most votes first, at most maxCandidates of them
+  void vote(const std::string& nucleotides, unsigned int maxCandidates, unsigned int minVotes, std::vector<SeedCandidate>* ret);
+private:
+  void voteStrand(const char* nucleotides, unsigned int len, bool reverse, unsigned int minVotes, std::vector<SeedCandidate>* ret);
+  const ReferencePanel& d_panel;
+  unsigned int d_keylen, d_stride, d_band, d_maxHits;
+  std::vector<dnapos_t> d_hits, d_diagonals;
+  std::string d_reversed;
+};
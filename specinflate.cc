@@ -0,0 +1,473 @@
+#include "specinflate.hh"
+#include <string.h>
+#include <zlib.h>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+static const uint16_t s_lbase[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const uint8_t s_lext[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const uint16_t s_dbase[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,
+				     6145,8193,12289,16385,24577};
+static const uint8_t s_dext[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+//! what we accept as literals when guessing, text files like FASTQ only have these
+static inline bool isText(unsigned int c)
+{
+  return (c >= 32 && c < 127) || c=='\n' || c=='\r' || c=='\t';
+}
+
+//! up to 57 bits of input starting at bitpos, zeroes beyond the end
+uint64_t SpeculativeInflater::peek(uint64_t bitpos) const
+{
+  uint64_t byte = bitpos >> 3, ret = 0;
+  if(byte + 8 <= d_size)
+    memcpy(&ret, d_data + byte, 8); // little endian only, like the BAM writer
+  else
+    for(unsigned int n = 0; byte + n < d_size; ++n)
+      ret |= (uint64_t)d_data[byte + n] << (8*n);
+  return ret >> (bitpos & 7);
+}
+
+/* Canonical Huffman decoding table, with the same rules as zlib: no oversubscribed codes, and
+   incomplete codes only for a single code of length 1, and never for the code length code */
+bool SpeculativeInflater::buildHuffman(const uint8_t* lengths, unsigned int num, Huffman* h, bool isCodes)
+{
+  unsigned int count[16]={0}, maxLen=0;
+  for(unsigned int n = 0; n < num; ++n) {
+    count[lengths[n]]++;
+    maxLen = max(maxLen, (unsigned int)lengths[n]);
+  }
+  if(!maxLen) { // no codes at all, decoding anything will fail
+    h->bits = 1;
+    h->table.assign(2, 0);
+    return !isCodes;
+  }
+  int left = 1;
+  for(unsigned int len = 1; len < 16; ++len) {
+    left <<= 1;
+    left -= count[len];
+    if(left < 0)
+      return false;
+  }
+  if(left > 0 && (isCodes || maxLen != 1))
+    return false;
+
+  unsigned int next[16];
+  count[0] = 0;
+  unsigned int code = 0;
+  for(unsigned int len = 1; len < 16; ++len) {
+    code = (code + count[len-1]) << 1;
+    next[len] = code;
+  }
+  h->bits = maxLen;
+  h->table.assign(1U << maxLen, 0);
+  for(unsigned int sym = 0; sym < num; ++sym) {
+    unsigned int len = lengths[sym];
+    if(!len)
+      continue;
+    unsigned int c = next[len]++, rev = 0;
+    for(unsigned int b = 0; b < len; ++b)
+      rev |= ((c >> b) & 1) << (len - 1 - b);
+    for(unsigned int idx = rev; idx < h->table.size(); idx += 1U << len)
+      h->table[idx] = sym | (len << 16);
+  }
+  return true;
+}
+
+const SpeculativeInflater::Huffman& SpeculativeInflater::fixedLit()
+{
+  static const Huffman h = []() {
+    uint8_t lengths[288];
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    Huffman ret;
+    buildHuffman(lengths, 288, &ret, false);
+    return ret;
+  }();
+  return h;
+}
+
+const SpeculativeInflater::Huffman& SpeculativeInflater::fixedDist()
+{
+  static const Huffman h = []() {
+    uint8_t lengths[30];
+    memset(lengths, 5, 30);
+    Huffman ret;
+    buildHuffman(lengths, 30, &ret, false);
+    return ret;
+  }();
+  return h;
+}
+
+bool SpeculativeInflater::decodeSymbols(uint64_t* bitpos, const Huffman& lit, const Huffman& dist, bool textOnly)
+{
+  const uint64_t limit = d_size * 8;
+  const uint64_t lmask = (1ULL << lit.bits) - 1, dmask = (1ULL << dist.bits) - 1;
+  const uint32_t* ltable = &lit.table[0];
+  const uint32_t* dtable = &dist.table[0];
+  // we work on a raw pointer, and make sure there is always room for the longest match
+  size_t pos = d_outLen;
+  uint16_t* o = &d_out[0];
+  uint64_t bit = *bitpos;
+  bool ret = false;
+  for(;;) {
+    if(bit > limit)
+      break;
+    if(pos + 258 > d_out.size()) {
+      d_out.resize(2 * d_out.size());
+      o = &d_out[0];
+    }
+    uint64_t v = peek(bit); // 57 bits is enough for 15+5+15+13
+    uint32_t e = ltable[v & lmask];
+    unsigned int len = e >> 16, sym = e & 0xffff;
+    if(!len)
+      break;
+    v >>= len;
+    bit += len;
+    if(sym < 256) {
+      if(textOnly && !isText(sym))
+	break;
+      o[pos++] = sym;
+      continue;
+    }
+    if(sym == 256) {
+      ret = true;
+      break;
+    }
+    sym -= 257;
+    if(sym >= 29)
+      break;
+    unsigned int length = s_lbase[sym] + (v & ((1U << s_lext[sym]) - 1));
+    v >>= s_lext[sym];
+    bit += s_lext[sym];
+
+    e = dtable[v & dmask];
+    len = e >> 16;
+    sym = e & 0xffff;
+    if(!len || sym >= 30)
+      break;
+    v >>= len;
+    unsigned int distance = s_dbase[sym] + (v & ((1U << s_dext[sym]) - 1));
+    bit += len + s_dext[sym];
+
+    if(distance <= pos) {
+      const uint16_t* src = o + pos - distance;
+      uint16_t* dst = o + pos;
+      for(unsigned int n = 0; n < length; ++n)
+	dst[n] = src[n];
+    }
+    else { // copies from before our start become markers, which copy on as they are
+      for(int64_t n = pos; n < (int64_t)(pos + length); ++n) {
+	int64_t src = n - distance;
+	o[n] = src >= 0 ? o[src] : s_marker + 32768 + src;
+      }
+    }
+    pos += length;
+  }
+  d_outLen = pos;
+  *bitpos = bit;
+  return ret;
+}
+
+bool SpeculativeInflater::decodeBlock(uint64_t* bitpos, bool* final, bool textOnly)
+{
+  uint64_t v = peek(*bitpos);
+  *final = v & 1;
+  unsigned int type = (v >> 1) & 3;
+  *bitpos += 3;
+  if(type == 0) {
+    uint64_t byte = (*bitpos + 7) >> 3;
+    if(byte + 4 > d_size)
+      return false;
+    unsigned int len = d_data[byte] | (d_data[byte+1] << 8), nlen = d_data[byte+2] | (d_data[byte+3] << 8);
+    if(len != (~nlen & 0xffff))
+      return false;
+    byte += 4;
+    if(byte + len > d_size)
+      return false;
+    if(d_outLen + len > d_out.size())
+      d_out.resize(2 * d_out.size() + len);
+    for(unsigned int n = 0; n < len; ++n) {
+      if(textOnly && !isText(d_data[byte + n]))
+	return false;
+      d_out[d_outLen++] = d_data[byte + n];
+    }
+    *bitpos = (byte + len) * 8;
+    return true;
+  }
+  if(type == 1)
+    return decodeSymbols(bitpos, fixedLit(), fixedDist(), textOnly);
+  if(type == 3)
+    return false;
+
+  v = peek(*bitpos);
+  unsigned int hlit = (v & 31) + 257, hdist = ((v >> 5) & 31) + 1, hclen = ((v >> 10) & 15) + 4;
+  *bitpos += 14;
+  if(hlit > 286 || hdist > 30)
+    return false;
+  static const uint8_t order[19] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+  uint8_t cl[19] = {0};
+  v = peek(*bitpos);
+  for(unsigned int n = 0; n < hclen; ++n)
+    cl[order[n]] = (v >> (3*n)) & 7;
+  *bitpos += 3*hclen;
+  if(!buildHuffman(cl, 19, &d_codes, true))
+    return false;
+
+  uint8_t lengths[286+30];
+  const uint64_t cmask = (1ULL << d_codes.bits) - 1;
+  for(unsigned int n = 0; n < hlit + hdist; ) {
+    v = peek(*bitpos);
+    uint32_t e = d_codes.table[v & cmask];
+    unsigned int len = e >> 16, sym = e & 0xffff;
+    if(!len)
+      return false;
+    v >>= len;
+    *bitpos += len;
+    if(sym < 16) {
+      lengths[n++] = sym;
+      continue;
+    }
+    unsigned int rep, val = 0;
+    if(sym == 16) {
+      if(!n)
+	return false;
+      val = lengths[n-1];
+      rep = 3 + (v & 3);
+      *bitpos += 2;
+    }
+    else if(sym == 17) {
+      rep = 3 + (v & 7);
+      *bitpos += 3;
+    }
+    else {
+      rep = 11 + (v & 127);
+      *bitpos += 7;
+    }
+    if(n + rep > hlit + hdist)
+      return false;
+    memset(lengths + n, val, rep);
+    n += rep;
+  }
+  if(*bitpos > d_size * 8 || !lengths[256])
+    return false;
+  if(!buildHuffman(lengths, hlit, &d_lit, false) || !buildHuffman(lengths + hlit, hdist, &d_dist, false))
+    return false;
+  return decodeSymbols(bitpos, d_lit, d_dist, textOnly);
+}
+
+bool SpeculativeInflater::decode(uint64_t startBit, uint64_t stopBit, bool textOnly)
+{
+  if(d_out.size() < 65536)
+    d_out.resize(65536);
+  d_outLen = 0;
+  d_boundaries.clear();
+  d_startBit = startBit;
+  d_final = false;
+  uint64_t bit = startBit;
+  bool ret;
+  for(;;) {
+    d_boundaries.push_back({bit, d_outLen});
+    bool final;
+    if(!decodeBlock(&bit, &final, textOnly) || bit > d_size * 8) {
+      ret = false;
+      break;
+    }
+    if(final || bit >= stopBit) {
+      d_final = final;
+      d_endBit = bit;
+      ret = true;
+      break;
+    }
+  }
+  return ret;
+}
+
+bool SpeculativeInflater::findStart(uint64_t from, uint64_t to, uint64_t stopBit)
+{
+  if(d_out.size() < 4 * (stopBit - from) / 8) // FASTQ compresses about 4 times
+    d_out.resize(4 * (stopBit - from) / 8);
+  for(uint64_t bit = from; bit < to; ++bit) {
+    uint64_t v = peek(bit);
+    // not final, dynamic Huffman, sane HLIT and HDIST. Fixed and stored blocks are rare enough not to look for
+    if((v & 7) != 4 || ((v >> 3) & 31) > 29 || ((v >> 8) & 31) > 29)
+      continue;
+    if(decode(bit, stopBit, true))
+      return true;
+  }
+  return false;
+}
+
+void SpeculativeInflater::resolve(const std::string& window, std::string* out) const
+{
+  out->resize(d_outLen);
+  const unsigned int offset = 32768 - window.size();
+  char* o = &(*out)[0];
+  for(size_t n = 0; n < d_outLen; ++n) {
+    uint16_t v = d_out[n];
+    if(v < s_marker)
+      o[n] = v;
+    else {
+      v -= s_marker;
+      if(v < offset)
+	throw runtime_error("Deflate data refers to before the start of the stream");
+      o[n] = window[v - offset];
+    }
+  }
+}
+
+ParallelInflater::ParallelInflater(const unsigned char* data, uint64_t size, uint64_t startBit, const std::string& window,
+				   unsigned int numThreads, uint64_t chunkSize)
+  : d_data(data), d_size(size), d_chunkSize(chunkSize), d_bit(startBit), d_endBit(0), d_done(false),
+    d_window(window), d_numThreads(numThreads)
+{
+  d_nextTask = (startBit / (8*d_chunkSize) + 1) * 8*d_chunkSize;
+  for(unsigned int n = 0; n < d_numThreads; ++n) {
+    d_threads.push_back(std::thread([this]() {
+	  Task* t;
+	  while(d_work.pop(&t)) {
+	    try {
+	      t->ok = t->spec.findStart(t->from, min(t->to, d_size * 8), t->to);
+	    }
+	    catch(...) {
+	      t->ok = false;
+	    }
+	    {
+	      std::lock_guard<std::mutex> lock(d_doneLock);
+	      t->done = true;
+	    }
+	    d_doneCond.notify_all();
+	  }
+	}));
+  }
+  issue();
+}
+
+ParallelInflater::~ParallelInflater()
+{
+  d_work.close();
+  for(auto& t : d_threads)
+    t.join();
+}
+
+//! keeps twice as many chunks in flight as we have threads
+void ParallelInflater::issue()
+{
+  while(d_tasks.size() < 2 * d_numThreads && d_nextTask < d_size * 8) {
+    std::unique_ptr<Task> t(new Task(d_data, d_size));
+    t->from = d_nextTask;
+    t->to = d_nextTask + 8 * d_chunkSize;
+    t->ok = t->done = false;
+    d_nextTask = t->to;
+    d_work.push(t.get());
+    d_tasks.push_back(std::move(t));
+  }
+}
+
+//! inflates with zlib from d_bit up to the first block boundary at or beyond stopBit, and moves d_bit there
+void ParallelInflater::inflateExact(uint64_t stopBit, std::string* out, std::vector<SpeculativeInflater::Boundary>* boundaries)
+{
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if(inflateInit2(&zs, -15) != Z_OK)
+    throw runtime_error("Unable to initialize inflate");
+  std::shared_ptr<z_stream> guard(&zs, inflateEnd);
+
+  uint64_t byte = d_bit >> 3;
+  if(d_bit & 7) {
+    inflatePrime(&zs, 8 - (d_bit & 7), d_data[byte] >> (d_bit & 7));
+    byte++;
+  }
+  if(!d_window.empty())
+    inflateSetDictionary(&zs, (const Bytef*)d_window.c_str(), d_window.size());
+  zs.next_in = (Bytef*)d_data + byte;
+
+  out->clear();
+  boundaries->clear();
+  boundaries->push_back({d_bit, 0});
+  size_t have = 0;
+  for(;;) {
+    if(!zs.avail_in) {
+      uint64_t consumed = zs.next_in - d_data;
+      if(consumed == d_size)
+	throw runtime_error("Compressed data ends in the middle of a deflate stream");
+      zs.avail_in = min(d_size - consumed, (uint64_t)1<<30);
+    }
+    if(out->size() - have < 65536)
+      out->resize(have + 262144);
+    zs.next_out = (Bytef*)&(*out)[have];
+    zs.avail_out = out->size() - have;
+    auto res = inflate(&zs, Z_BLOCK);
+    have = (char*)zs.next_out - &(*out)[0];
+    if(res == Z_STREAM_END) {
+      d_done = true;
+      d_endBit = (zs.next_in - d_data) * 8;
+      break;
+    }
+    if(res != Z_OK && res != Z_BUF_ERROR)
+      throw runtime_error("Error inflating: "+ string(zs.msg ? zs.msg : "no error message"));
+    if((zs.data_type & 128) && !(zs.data_type & 64)) {
+      uint64_t bit = (zs.next_in - d_data) * 8 - (zs.data_type & 7);
+      if(bit >= stopBit) {
+	d_bit = bit;
+	break;
+      }
+      boundaries->push_back({bit, have});
+    }
+  }
+  out->resize(have);
+}
+
+void ParallelInflater::updateWindow(const std::string& out)
+{
+  if(out.size() >= 32768)
+    d_window.assign(out, out.size() - 32768, 32768);
+  else {
+    d_window.append(out);
+    if(d_window.size() > 32768)
+      d_window.erase(0, d_window.size() - 32768);
+  }
+}
+
+bool ParallelInflater::next(std::string* out, std::vector<SpeculativeInflater::Boundary>* boundaries)
+{
+  if(d_done)
+    return false;
+
+  std::unique_lock<std::mutex> lock(d_doneLock);
+  // chunks we are already past are of no use, but we can only let go of them once they are done
+  while(!d_tasks.empty() && d_tasks.front()->to <= d_bit) {
+    Task* t = d_tasks.front().get();
+    d_doneCond.wait(lock, [t]() { return t->done; });
+    d_tasks.pop_front();
+  }
+  if(!d_tasks.empty() && d_tasks.front()->from <= d_bit) {
+    Task* t = d_tasks.front().get();
+    d_doneCond.wait(lock, [t]() { return t->done; });
+    lock.unlock();
+    if(t->ok && t->spec.d_startBit == d_bit) { // our guess was right
+      t->spec.resolve(d_window, out);
+      *boundaries = t->spec.d_boundaries;
+      if(t->spec.d_final) {
+	d_done = true;
+	d_endBit = t->spec.d_endBit;
+      }
+      else
+	d_bit = t->spec.d_endBit;
+    }
+    else
+      inflateExact(t->to, out, boundaries);
+    d_tasks.pop_front();
+  }
+  else {
+    lock.unlock();
+    inflateExact(d_tasks.empty() ? (d_bit / (8*d_chunkSize) + 1) * 8*d_chunkSize : d_tasks.front()->from, out, boundaries);
+  }
+  updateWindow(*out);
+  issue();
+  return true;
+}
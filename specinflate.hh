@@ -0,0 +1,107 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <deque>
+#include "misc.hh"
+
+/** A deflate decoder that can start at a block boundary without knowing the 32KB window before it.
+    Bytes copied from that unknown window come out as markers, and resolve() fills them in once
+    the window is known. Where the block boundaries are is a guess, see findStart(). */
+class SpeculativeInflater
+{
+public:
+  //! output values from here on are markers, value - s_marker indexes a 32KB window
+  static const uint16_t s_marker = 0x8000;
+  //! a deflate block boundary: bit offset in the input, offset in the output
+  struct Boundary
+  {
+    uint64_t bit;
+    uint64_t outPos;
+  };
+
+  SpeculativeInflater(const unsigned char* data, uint64_t size) : d_data(data), d_size(size) {}
+
+  /** Decodes whole blocks from startBit on, until the first block boundary at or beyond stopBit,
+      or until the final block. With textOnly, literals that are not printable text fail the decode.
+      Returns false on invalid data */
+  bool decode(uint64_t startBit, uint64_t stopBit, bool textOnly);
+  //! tries decode() from every bit in [from, to) until one works, false if none does
+  bool findStart(uint64_t from, uint64_t to, uint64_t stopBit);
+  //! fills out with our output, markers replaced from window, which holds the bytes just before us
+  void resolve(const std::string& window, std::string* out) const;
+
+  std::vector<uint16_t> d_out; //!< our buffer, only the first d_outLen entries are output
+  size_t d_outLen;
+  std::vector<Boundary> d_boundaries; //!< including the one we started from
+  uint64_t d_startBit, d_endBit;
+  bool d_final; //!< d_endBit is the end of the final block, so of the deflate stream
+private:
+  struct Huffman
+  {
+    std::vector<uint32_t> table; //!< symbol | length<<16, indexed by the next 'bits' bits of input
+    unsigned int bits;
+  };
+  static bool buildHuffman(const uint8_t* lengths, unsigned int num, Huffman* h, bool isCodes);
+  static const Huffman& fixedLit();
+  static const Huffman& fixedDist();
+  uint64_t peek(uint64_t bitpos) const;
+  bool decodeBlock(uint64_t* bitpos, bool* final, bool textOnly);
+  bool decodeSymbols(uint64_t* bitpos, const Huffman& lit, const Huffman& dist, bool textOnly);
+
+  const unsigned char* d_data;
+  uint64_t d_size;
+  Huffman d_codes, d_lit, d_dist; //!< kept around so we don't allocate for each block
+};
+
+/** Decodes a deflate stream from a known block boundary onwards, on several threads. The input
+    gets cut into chunks, and each worker guesses where the first block in its chunk starts
+    and decodes speculatively. Chunks come out in order, and a chunk is only used if it
+    started exactly where the previous chunk ended. Otherwise, or if a guess failed, that chunk gets
+    decoded again with zlib. The output is therefore always the same as that of plain inflate */
+class ParallelInflater
+{
+public:
+  //! window is the output preceding startBit, up to 32KB of it
+  ParallelInflater(const unsigned char* data, uint64_t size, uint64_t startBit, const std::string& window,
+		   unsigned int numThreads, uint64_t chunkSize=1048576);
+  ~ParallelInflater();
+  /** Gets the next piece of output, in order, and the block boundaries in it.
+      Returns false once the deflate stream has ended, after which endBit() says where */
+  bool next(std::string* out, std::vector<SpeculativeInflater::Boundary>* boundaries);
+  uint64_t endBit() const
+  {
+    return d_endBit;
+  }
+private:
+  struct Task
+  {
+    Task(const unsigned char* data, uint64_t size) : spec(data, size) {}
+    uint64_t from, to; //!< the chunk, in bits
+    SpeculativeInflater spec;
+    bool ok, done;
+    std::exception_ptr error;
+  };
+  void issue();
+  void inflateExact(uint64_t stopBit, std::string* out, std::vector<SpeculativeInflater::Boundary>* boundaries);
+  void updateWindow(const std::string& out);
+
+  const unsigned char* d_data;
+  uint64_t d_size, d_chunkSize;
+  uint64_t d_bit;      //!< where the next output starts in the input, always a block boundary
+  uint64_t d_nextTask; //!< bit offset of the next chunk to hand out
+  uint64_t d_endBit;
+  bool d_done;
+  std::string d_window;
+  std::deque<std::unique_ptr<Task>> d_tasks; //!< in flight, in order
+  unsigned int d_numThreads;
+  std::vector<std::thread> d_threads;
+  BlockingQueue<Task*> d_work;
+  std::mutex d_doneLock;
+  std::condition_variable d_doneCond;
+};
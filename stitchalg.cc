@@ -103,21 +103,24 @@ string doStitch(const map<FASTQReader*, unique_ptr<vector<HashedPos> > >& fhpos,
   ofstream coverage("stitch.cov");
   uint64_t matchesConsidered=0, matchesUsed=0;
   vector<unsigned int> totcoverage;
+  ReadBatch matches;
   for(;;) {
     vector<pair<string,string> > story;
     story.push_back(make_pair(startseed, string(startseed.size(), (char)40)));
 
     for(unsigned int n=0; n < startseed.size() - chunklen;++n) {
       string part=startseed.substr(n, chunklen);
-      auto matches = getConsensusMatches(part, fhpos, chunklen);
-      for(auto& match : matches) {
-	int diff = dnaDiff(startseed.substr(n), match.d_nucleotides);
+      getConsensusMatches(part, fhpos, chunklen, &matches);
+      for(size_t i = 0; i < matches.size(); ++i) {
+	auto match = matches[i];
+	string nucleotides = match.getNucleotides();
+	int diff = dnaDiff(startseed.substr(n), nucleotides);
 	matchesConsidered++;
 	if(diff < 5) {
 	  if(verbose)
-	    cout << string(offset,'-')<<string(n, ' ') << match.d_nucleotides<<endl;
-	  story.push_back({string(n, ' ')+match.d_nucleotides,
-		string(n, ' ')+match.d_quality});
+	    cout << string(offset,'-')<<string(n, ' ') << nucleotides<<endl;
+	  story.push_back({string(n, ' ')+nucleotides,
+		string(n, ' ')+string(match.quality, match.len)});
 	  matchesUsed++;
 	}
       }
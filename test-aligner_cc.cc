@@ -0,0 +1,118 @@
+#include <boost/test/unit_test.hpp>
+#include "aligner.hh"
+#include "testutil.hh"
+#include <string>
+#include <vector>
+#include <algorithm>
+BOOST_AUTO_TEST_SUITE(aligner_cc)
+using std::string;
+using std::vector;
+
+static uint32_t s_state = 11;
+static unsigned int nextRandom()
+{
+  return ::nextRandom(&s_state);
+}
+
+//! continues from where the last one left off, unlike the one in testutil.hh
+static string makeSequence(unsigned int size)
+{
+  string ret;
+  for(unsigned int n = 0; n < size; ++n)
+    ret.append(1, "ACGT"[nextRandom() & 3]);
+  return ret;
+}
+
+//! the textbook dynamic programming version: all of read, any part of ref
+static unsigned int bruteForce(const string& read, const string& ref)
+{
+  vector<unsigned int> prev(ref.size() + 1, 0), cur(ref.size() + 1);
+  for(unsigned int i = 1; i <= read.size(); ++i) {
+    cur[0] = i;
+    for(unsigned int j = 1; j <= ref.size(); ++j)
+      cur[j] = std::min({prev[j - 1] + (read[i - 1] == ref[j - 1] && read[i - 1] != 'N' ? 0 : 1), prev[j] + 1, cur[j - 1] + 1});
+    prev.swap(cur);
+  }
+  return *std::min_element(prev.begin(), prev.end());
+}
+
+//! checks the cigar really turns read into that part of ref with that many edits
+static void checkAlignment(const Alignment& al, const string& read, const string& ref)
+{
+  unsigned int i = 0, j = al.refStart, edits = 0, mismatches = 0;
+  for(auto op : al.cigar) {
+    for(unsigned int n = 0; n < (op >> 4); ++n) {
+      switch(op & 0xf) {
+      case CigarMatch:
+	BOOST_REQUIRE(i < read.size() && j < ref.size());
+	if(read[i] != ref[j] || read[i] == 'N') {
+	  ++edits;
+	  ++mismatches;
+	}
+	++i;
+	++j;
+	break;
+      case CigarInsert:
+	++i;
+	++edits;
+	break;
+      case CigarDelete:
+	++j;
+	++edits;
+	break;
+      }
+    }
+  }
+  BOOST_CHECK_EQUAL(i, read.size());
+  BOOST_CHECK_EQUAL(j - al.refStart, al.refLength);
+  BOOST_CHECK_EQUAL(cigarReferenceLength(al.cigar, read.size()), al.refLength);
+  BOOST_CHECK_EQUAL(edits, al.distance);
+  BOOST_CHECK_EQUAL(mismatches, al.mismatches);
+}
+
+BOOST_AUTO_TEST_CASE(test_BandedAligner) {
+  BandedAligner ba;
+  string ref = makeSequence(190);
+  string read = ref.substr(20, 150);
+  const Alignment& exact = ba.align(read.c_str(), read.size(), ref.c_str(), ref.size(), 20);
+  BOOST_CHECK_EQUAL(exact.distance, 0U);
+  BOOST_CHECK_EQUAL(exact.refStart, 20U);
+  BOOST_CHECK_EQUAL(cigarString(exact.cigar, read.size()), "150M");
+
+  // an insert, a delete and a mismatch
+  read = ref.substr(20, 40) + "GATTACA" + ref.substr(60, 30) + ref.substr(93, 60);
+  read[120] = read[120] == 'A' ? 'C' : 'A';
+  const Alignment& al = ba.align(read.c_str(), read.size(), ref.c_str(), ref.size(), 20);
+  BOOST_CHECK_EQUAL(al.distance, 11U);
+  BOOST_CHECK_EQUAL(al.refStart, 20U);
+  BOOST_CHECK_EQUAL(al.indels, 2U);
+  BOOST_CHECK_EQUAL(al.mismatches, 1U);
+  BOOST_CHECK_EQUAL(cigarString(al.cigar, read.size()), "40M7I30M3D60M");
+  checkAlignment(al, read, ref);
+
+  BOOST_CHECK_EQUAL(cigarString(Cigar(), 150), "150M");
+  BOOST_CHECK_EQUAL(cigarReferenceLength(Cigar(), 150), 150U);
+}
+
+BOOST_AUTO_TEST_CASE(test_BandedAlignerRandom) {
+  BandedAligner ba;
+  for(unsigned int round = 0; round < 300; ++round) {
+    unsigned int len = 1 + nextRandom() % 300; // one, two, three and more words
+    string ref = makeSequence(len + 40);
+    string read = ref.substr(20, len);
+    for(unsigned int edits = nextRandom() % 12; edits; --edits) {
+      unsigned int pos = nextRandom() % read.size();
+      switch(nextRandom() % 4) {
+      case 0: read[pos] = "ACGTN"[nextRandom() % 5]; break;
+      case 1: read.insert(pos, 1, "ACGT"[nextRandom() & 3]); break;
+      case 2: if(read.size() > 1) read.erase(pos, 1); break;
+      case 3: read.insert(pos, makeSequence(1 + nextRandom() % 4)); break;
+      }
+    }
+    const Alignment& al = ba.align(read.c_str(), read.size(), ref.c_str(), ref.size(), 20);
+    BOOST_REQUIRE_EQUAL(al.distance, bruteForce(read, ref));
+    checkAlignment(al, read, ref);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
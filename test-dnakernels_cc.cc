@@ -0,0 +1,137 @@
+#include <boost/test/unit_test.hpp>
+#include "dnakernels.hh"
+#include "testutil.hh"
+#include "dnamisc.hh"
+#include "misc.hh"
+#include "fastq.hh"
+#include <algorithm>
+#include <string>
+#include <vector>
+BOOST_AUTO_TEST_SUITE(dnakernels_cc)
+using std::string;
+using std::vector;
+
+// what the kernels replaced, they have to agree exactly
+static double oldGCContent(const string& str)
+{
+  dnapos_t aCount{0}, cCount{0}, gCount{0}, tCount{0}, nCount{0};
+  for(auto c : str) {
+    if(c=='A') ++aCount;
+    else if(c=='C') ++cCount;
+    else if(c=='G') ++gCount;
+    else if(c=='T') ++tCount;
+    else if(c=='N') ++nCount;
+  }
+  dnapos_t total = cCount + gCount + aCount + tCount + nCount;
+  if(!total)
+    return 0.0;
+  return 1.0*(cCount + gCount)/(1.0*total);
+}
+
+static void oldReverseNucleotides(string* nucleotides)
+{
+  std::reverse(nucleotides->begin(), nucleotides->end());
+  for(auto& c : *nucleotides) {
+    if(c == 'C') c = 'G';
+    else if(c == 'G') c = 'C';
+    else if(c == 'A') c = 'T';
+    else if(c == 'T') c = 'A';
+  }
+}
+
+static uint32_t oldKmerMapper(const string& str, int offset, unsigned int len)
+{
+  uint32_t ret=0;
+  const char *c=str.c_str() + offset;
+  for(unsigned int i = 0; i != len; ++i, ++c) {
+    ret<<=2;
+    if(*c=='A') ;
+    else if(*c=='C') ret |= 1;
+    else if(*c=='G') ret |= 2;
+    else if(*c=='T') ret |= 3;
+  }
+  return ret;
+}
+
+//! mostly ACGT, with the odd N, lower case or high byte mixed in
+static vector<string> makeSequences()
+{
+  vector<string> ret;
+  uint32_t state = 17;
+  for(unsigned int len = 0; len < 300; len += (len < 70 ? 1 : 13)) {
+    string str;
+    for(unsigned int i = 0; i < len; ++i) {
+      unsigned int r = nextRandom(&state) % 100;
+      str.append(1, r < 90 ? "ACGT"[r % 4] : (r < 95 ? 'N' : "acgt-\x80\xff"[r % 7]));
+    }
+    ret.push_back(str);
+  }
+  ret.push_back(string(70000, 'C')+"AT"); // beyond the 255 rounds a byte counter lasts
+  return ret;
+}
+
+static vector<SIMDLevel> levels()
+{
+  vector<SIMDLevel> ret{SIMDLevel::Scalar};
+  setSIMDLevel(SIMDLevel::AVX2);
+  if(getSIMDLevel() == SIMDLevel::AVX2)
+    ret.push_back(SIMDLevel::AVX2);
+  return ret;
+}
+
+BOOST_AUTO_TEST_CASE(test_nucleotides) {
+  auto seqs = makeSequences();
+  for(auto level : levels()) {
+    setSIMDLevel(level);
+    BOOST_TEST_MESSAGE("Testing "<<SIMDLevelName(level));
+    for(const auto& seq : seqs) {
+      BOOST_CHECK_EQUAL(getGCContent(seq), oldGCContent(seq));
+      NucleotideCounts counts = countNucleotides(seq.c_str(), seq.size());
+      BOOST_CHECK_EQUAL(counts.n, std::count(seq.begin(), seq.end(), 'N'));
+      BOOST_CHECK_EQUAL(counts.a + counts.c + counts.g + counts.t + counts.n + counts.other, seq.size());
+
+      string ours(seq), theirs(seq);
+      reverseNucleotides(&ours);
+      oldReverseNucleotides(&theirs);
+      BOOST_CHECK_EQUAL(ours, theirs);
+
+      for(unsigned int len : {4U, 8U, 16U})
+	if(seq.size() >= len)
+	  BOOST_CHECK_EQUAL(kmerMapper(seq, seq.size() - len, len), oldKmerMapper(seq, seq.size() - len, len));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_qualities) {
+  for(auto level : levels()) {
+    setSIMDLevel(level);
+    for(unsigned int len = 0; len < 200; len += 7) {
+      string quality;
+      for(unsigned int i = 0; i < len; ++i)
+	quality.append(1, 33 + (i * 13) % 42);
+      string converted(quality);
+      BOOST_CHECK(!subtractQualityOffset(&converted[0], converted.size(), 33));
+      for(unsigned int i = 0; i < len; ++i)
+	BOOST_REQUIRE_EQUAL(converted[i], quality[i] - 33);
+
+      FastQRead fqr;
+      fqr.d_quality = converted;
+      uint8_t lowest = len ? *std::min_element(converted.begin(), converted.end()) : 255;
+      BOOST_CHECK_EQUAL(minQuality(converted.c_str(), converted.size()), lowest);
+      BOOST_CHECK(fqr.exceedsQuality(lowest));
+      BOOST_CHECK_EQUAL(fqr.exceedsQuality(lowest + 1), !len);
+
+      if(len) {
+	// the first offending byte is reported, as it was
+	quality[len / 2] = 20;
+	quality[len - 1] = 10;
+	const char* bad = subtractQualityOffset(&quality[0], quality.size(), 33);
+	BOOST_REQUIRE(bad);
+	BOOST_CHECK_EQUAL(bad - quality.c_str(), len / 2 < len - 1 ? len / 2 : len - 1);
+	BOOST_CHECK_EQUAL(*bad, len / 2 < len - 1 ? 20 : 10);
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
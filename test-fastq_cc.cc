@@ -0,0 +1,83 @@
+#include <boost/test/unit_test.hpp>
+#include "fastq.hh"
+#include "misc.hh"
+#include <unistd.h>
+#include <stdexcept>
+#include <vector>
+#include <string>
+BOOST_AUTO_TEST_SUITE(fastq_cc)
+using std::string;
+using std::vector;
+
+//! writes numReads reads of varying length, returns the filename
+static string writeFastq(unsigned int numReads)
+{
+  char fname[]="/tmp/test-fastqXXXXXX";
+  int fd = mkstemp(fname);
+  if(fd < 0)
+    throw std::runtime_error("Unable to create temporary file");
+  FILE* fp = fdopen(fd, "w");
+  for(unsigned int n = 0; n < numReads; ++n) {
+    string nucs, quals;
+    for(unsigned int i = 0; i < 20 + n % 80; ++i) {
+      nucs.append(1, "ACGT"[(n*7 + i*i) % 4]);
+      quals.append(1, 33 + (n + i) % 40);
+    }
+    fprintf(fp, "@read%u some comment\n%s\n+\n%s\n", n, nucs.c_str(), quals.c_str());
+  }
+  fclose(fp);
+  return fname;
+}
+
+BOOST_AUTO_TEST_CASE(test_ReadBatch) {
+  const unsigned int numReads = 2500;
+  string fname = writeFastq(numReads);
+  vector<FastQRead> reads;
+  {
+    FASTQReader fq(fname, 33);
+    fq.setTrim(2, 3);
+    FastQRead fqr;
+    while(fq.getRead(&fqr))
+      reads.push_back(fqr);
+  }
+  BOOST_REQUIRE_EQUAL(reads.size(), numReads);
+
+  FASTQReader fq(fname, 33);
+  fq.setTrim(2, 3);
+  ReadBatch rb;
+  FastQRead fqr;
+  unsigned int n = 0;
+  uint64_t bytes = 0;
+  while(fq.getReads(&rb, 1000)) {
+    bytes += rb.bytes();
+    for(size_t i = 0; i < rb.size(); ++i, ++n) {
+      rb[i].copyTo(&fqr);
+      BOOST_REQUIRE_EQUAL(fqr.d_header, reads[n].d_header);
+      BOOST_REQUIRE_EQUAL(fqr.d_nucleotides, reads[n].d_nucleotides);
+      BOOST_REQUIRE_EQUAL(fqr.d_quality, reads[n].d_quality);
+      BOOST_REQUIRE_EQUAL(rb[i].position, reads[n].position);
+      BOOST_CHECK(!(rb[i] < rb[i]));
+    }
+  }
+  BOOST_CHECK_EQUAL(n, numReads);
+  BOOST_CHECK_EQUAL(bytes, filesize(fname.c_str()));
+
+  // a batch built by hand orders its reads just like FastQRead does
+  reads.resize(50);
+  rb.clear();
+  for(const auto& r : reads)
+    rb.add(r);
+  for(unsigned int a = 0; a < reads.size(); ++a)
+    for(unsigned int b = 0; b < reads.size(); ++b)
+      BOOST_REQUIRE_EQUAL(rb[a] < rb[b], reads[a] < reads[b]);
+  rb.add(rb[7]);
+  BOOST_CHECK_EQUAL(rb[50].getNucleotides(), reads[7].d_nucleotides);
+
+  StereoFASTQReader sfq(fname, fname, 33);
+  ReadBatch rb2;
+  BOOST_REQUIRE_EQUAL(sfq.getReadPairs(&rb, &rb2, 10), 10U);
+  BOOST_CHECK_EQUAL(rb2[3].position, rb[3].position | (1ULL<<63));
+  unlink(fname.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,70 @@
+#include <boost/test/unit_test.hpp>
+#include "geneannotated.hh"
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+BOOST_AUTO_TEST_SUITE(geneannotated_cc)
+using std::string;
+using std::vector;
+
+struct Feature
+{
+  uint64_t start, stop;
+};
+
+//! writes features as a GFF3 file, named after their position in features, returns the filename
+static string writeGFF(const vector<Feature>& features)
+{
+  char fname[]="/tmp/test-geneannotatedXXXXXX.gff";
+  int fd = mkstemps(fname, 4);
+  if(fd < 0)
+    throw std::runtime_error("Unable to create temporary file");
+  FILE* fp = fdopen(fd, "w");
+  fprintf(fp, "##gff-version 3\n");
+  for(unsigned int n = 0; n < features.size(); ++n)
+    fprintf(fp, "ref\ttest\t%s\t%lu\t%lu\t.\t%c\t.\tName=f%u\n", n % 3 ? "gene" : "repeat_region",
+	    (unsigned long)features[n].start, (unsigned long)features[n].stop, n % 2 ? '+' : '-', n);
+  fclose(fp);
+  return fname;
+}
+
+BOOST_AUTO_TEST_CASE(test_lookup) {
+  vector<Feature> features;
+  uint32_t state = 1;
+  for(unsigned int n = 0; n < 2000; ++n) {
+    state = state * 1103515245 + 12345;
+    uint64_t start = (state >> 8) % 100000;
+    state = state * 1103515245 + 12345;
+    uint64_t length = n % 50 ? (state >> 8) % 2000 : (state >> 8) % 40000; // some long ones hide short ones
+    features.push_back({start, start + length});
+  }
+  features.push_back({5000, 5000});
+  string fname = writeGFF(features);
+  GeneAnnotationReader gar(fname);
+  unlink(fname.c_str());
+  BOOST_REQUIRE_EQUAL(gar.size(), features.size());
+
+  vector<const GeneAnnotation*> found;
+  for(uint64_t pos = 0; pos < 110000; pos += 37) {
+    gar.lookup(pos, &found);
+    vector<string> expected, got;
+    for(unsigned int n = 0; n < features.size(); ++n)
+      if(features[n].start <= pos && pos <= features[n].stop)
+	expected.push_back((n % 3 ? "gene: f" : "repeat_region: f") + std::to_string(n) + " ");
+    for(auto ga : found) {
+      BOOST_CHECK(ga->startPos <= pos && pos <= ga->stopPos);
+      got.push_back(ga->tag);
+    }
+    BOOST_REQUIRE(got == expected); // and in the order of the file
+  }
+
+  gar.lookup(5000, &found);
+  BOOST_CHECK_EQUAL(found.back()->tag, "gene: f2000 ");
+  gar.lookup(200000, &found);
+  BOOST_CHECK(found.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,121 @@
+#include <boost/test/unit_test.hpp>
+#include "kmerindex.hh"
+#include "testutil.hh"
+#include <unistd.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+BOOST_AUTO_TEST_SUITE(kmerindex_cc)
+using std::string;
+using std::vector;
+
+static vector<dnapos_t> bruteForce(const string& genome, const string& str)
+{
+  vector<dnapos_t> ret;
+  for(string::size_type pos = genome.find(str); pos != string::npos; pos = genome.find(str, pos + 1))
+    ret.push_back(pos);
+  return ret;
+}
+
+static string makeGenome(unsigned int size)
+{
+  return "*" + makeSequence(size, 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_KmerIndex) {
+  string genome = makeGenome(20000);
+  genome.replace(5000, 3, "NNN");
+  genome.replace(7000, 40, genome.substr(100, 40)); // some repeats
+  genome.replace(9000, 40, genome.substr(100, 40));
+  genome.replace(genome.size() - 30, 30, genome.substr(100, 30));
+
+  KmerIndex ki(genome, 11);
+  BOOST_CHECK_EQUAL(ki.k(), 11U);
+  vector<string> queries{genome.substr(100, 40), genome.substr(100, 11), genome.substr(100, 30), genome.substr(4995, 20),
+      genome.substr(genome.size() - 11), genome.substr(1, 150), genome.substr(12345, 100), "ACGTACGTACGT", "ACGTNACGTACGT"};
+  for(const auto& q : queries) {
+    vector<dnapos_t> found;
+    ki.lookup(genome, q.c_str(), q.size(), &found);
+    vector<dnapos_t> expected = bruteForce(genome, q);
+    if(q.find_first_not_of("ACGT", 0) < 11)
+      expected.clear(); // not indexed
+    BOOST_CHECK_EQUAL_COLLECTIONS(found.begin(), found.end(), expected.begin(), expected.end());
+  }
+  vector<dnapos_t> found;
+  ki.lookup(genome, genome.c_str() + 100, 40, &found);
+  BOOST_CHECK_EQUAL(found.size(), 3U);
+  BOOST_CHECK_THROW(ki.lookup(genome, "ACGT", 4, &found), std::runtime_error);
+}
+
+static string slurp(const string& fname)
+{
+  string ret;
+  FILE* fp = fopen(fname.c_str(), "rb");
+  if(!fp)
+    return ret;
+  char buf[65536];
+  size_t len;
+  while((len = fread(buf, 1, sizeof(buf), fp)))
+    ret.append(buf, len);
+  fclose(fp);
+  return ret;
+}
+
+BOOST_AUTO_TEST_CASE(test_KmerIndexThreads) {
+  string genome = makeGenome(30000);
+  genome.replace(10000, 5, "NNNNN");
+  char tmpl1[]="/tmp/test-kmerindexXXXXXX", tmpl2[]="/tmp/test-kmerindexXXXXXX";
+  for(char* tmpl : {tmpl1, tmpl2}) {
+    int fd = mkstemp(tmpl);
+    BOOST_REQUIRE(fd >= 0);
+    close(fd);
+  }
+  string fname1 = tmpl1, fname2 = tmpl2;
+  KmerIndex(genome, 8).save(fname1, genome);
+  for(unsigned int threads : {2U, 3U, 7U}) {
+    KmerIndex(genome, 8, threads).save(fname2, genome);
+    string one = slurp(fname1), more = slurp(fname2);
+    BOOST_CHECK(!one.empty());
+    BOOST_CHECK(one == more);
+  }
+  unlink(fname1.c_str());
+  unlink(fname2.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_KmerIndexFile) {
+  string genome = makeGenome(50000);
+  char fname[]="/tmp/test-kmerindexXXXXXX";
+  int fd = mkstemp(fname);
+  BOOST_REQUIRE(fd >= 0);
+  close(fd);
+  unlink(fname);
+  BOOST_CHECK(!KmerIndex::load(fname, genome, 10)); // not there
+
+  KmerIndex built(genome, 10);
+  built.save(fname, genome);
+  auto loaded = KmerIndex::load(fname, genome, 10);
+  BOOST_REQUIRE(loaded);
+  for(unsigned int pos : {1U, 777U, 25000U, 49900U}) {
+    vector<dnapos_t> a, b;
+    built.lookup(genome, genome.c_str() + pos, 100, &a);
+    loaded->lookup(genome, genome.c_str() + pos, 100, &b);
+    BOOST_CHECK_EQUAL_COLLECTIONS(a.begin(), a.end(), b.begin(), b.end());
+    BOOST_CHECK(!b.empty());
+  }
+  loaded.reset();
+
+  BOOST_CHECK(!KmerIndex::load(fname, genome, 9)); // different k
+  string other(genome);
+  other[100] = other[100] == 'A' ? 'C' : 'A';
+  BOOST_CHECK(!KmerIndex::load(fname, other, 10)); // different genome
+
+  FILE* fp = fopen(fname, "r+b");
+  BOOST_REQUIRE(fp);
+  fseek(fp, -10, SEEK_END);
+  fputc(0x55, fp);
+  fclose(fp);
+  BOOST_CHECK(!KmerIndex::load(fname, genome, 10)); // damaged
+  unlink(fname);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -14,6 +14,34 @@ BOOST_AUTO_TEST_CASE(test_VarMeanEstimator) {
 	BOOST_CHECK_CLOSE(variance(vme), 2.0, 0.001);
 
 }
+BOOST_AUTO_TEST_CASE(test_VarMeanEstimatorMerge) {
+	VarMeanEstimator a, b, all;
+	for(auto d : {1,2}) {
+		a(d);
+		all(d);
+	}
+	for(auto d : {3,4}) {
+		b(d);
+		all(d);
+	}
+	a.merge(b);
+	BOOST_CHECK_CLOSE(mean(a), mean(all), 0.001);
+	BOOST_CHECK_CLOSE(variance(a), variance(all), 0.001);
+}
+
+BOOST_AUTO_TEST_CASE(test_BlockingQueue) {
+	BlockingQueue<int> bq;
+	bq.push(1);
+	bq.push(2);
+	bq.close();
+	int i;
+	BOOST_CHECK(bq.pop(&i));
+	BOOST_CHECK_EQUAL(i, 1);
+	BOOST_CHECK(bq.pop(&i));
+	BOOST_CHECK_EQUAL(i, 2);
+	BOOST_CHECK(!bq.pop(&i));
+}
+
 BOOST_AUTO_TEST_CASE(test_reverseNucleotides) {
 	std::string tst{"TTTTGGGCCA"};
 	reverseNucleotides(&tst);
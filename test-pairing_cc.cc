@@ -0,0 +1,98 @@
+#include <boost/test/unit_test.hpp>
+#include "pairing.hh"
+#include "testutil.hh"
+#include <string>
+#include <vector>
+BOOST_AUTO_TEST_SUITE(pairing_cc)
+using std::string;
+using std::vector;
+
+BOOST_AUTO_TEST_CASE(test_InsertSizeModel) {
+  InsertSizeModel ism;
+  for(unsigned int n = 0; n < 50; ++n)
+    ism.add(400);
+  BOOST_CHECK_EQUAL(ism.median(), 400U);
+  BOOST_CHECK_EQUAL(ism.mad(), 0U);
+  BOOST_CHECK_EQUAL(ism.window(0, 1400), 1400U); // too few to go by
+  BOOST_CHECK_EQUAL(ism.window(100, 1400, 50), 480U);
+
+  InsertSizeModel other;
+  for(unsigned int n = 0; n < 41*24; ++n)
+    other.add(380 + n % 41);
+  BOOST_CHECK_EQUAL(other.median(), 400U);
+  BOOST_CHECK_EQUAL(other.mad(), 10U);
+  BOOST_CHECK_EQUAL(other.window(0, 1400), 518U);
+  BOOST_CHECK_EQUAL(other.window(1400, 1400), 1400U);
+
+  ism.merge(other);
+  BOOST_CHECK_EQUAL(ism.samples(), 50U + 41*24);
+  BOOST_CHECK_EQUAL(ism.median(), 400U);
+  BOOST_CHECK_EQUAL(ism.mad(), 10U);
+  BOOST_CHECK_EQUAL(ism.histogram()[400], 50U + 24);
+
+  InsertSizeModel wild;
+  for(unsigned int n = 0; n < 100; ++n)
+    wild.add(n * 37);
+  BOOST_CHECK_EQUAL(wild.median(), 49U * 37); // however wide the inserts get
+  BOOST_CHECK_GT(wild.window(1400, 1400, 50), 99U * 37);
+}
+
+BOOST_AUTO_TEST_CASE(test_exactPairDistance) {
+  string one = makeSequence(3000, 4), two = makeSequence(3000, 5);
+  vector<unique_ptr<ReferenceGenome> > refs;
+  refs.emplace_back(ReferenceGenome::makeFromString(">one\n"+one+"\n>two\n"+two+"\n"));
+  ReferencePanel panel(refs);
+  panel.index({11, 100});
+  vector<ReferenceGenome::MatchDescriptor> found;
+  vector<dnapos_t> positions;
+
+  auto pair = [&](const string& a, const string& b) {
+    FastQRead fq1, fq2;
+    fq1.d_nucleotides = a;
+    fq1.d_quality = string(a.size(), 30);
+    fq2.d_nucleotides = b;
+    fq2.d_quality = string(b.size(), 30);
+    fq2.reverse();
+    return exactPairDistance(panel, &fq1, &fq2, &found, &positions);
+  };
+  BOOST_CHECK_EQUAL(pair(one.substr(500, 100), one.substr(800, 100)), 400);
+  BOOST_CHECK_EQUAL(pair(one.substr(100, 100), one.substr(2800, 100)), 2800); // no window
+  BOOST_CHECK_EQUAL(pair(one.substr(800, 100), one.substr(500, 100)), -1);    // facing away
+  BOOST_CHECK_EQUAL(pair(one.substr(500, 100), two.substr(800, 100)), -1);    // other contig
+  BOOST_CHECK_EQUAL(pair(one.substr(500, 100), one.substr(800, 90) + "A" + one.substr(891, 9)), -1); // not exact
+}
+
+BOOST_AUTO_TEST_CASE(test_bestPairs) {
+  vector<unique_ptr<ReferenceGenome> > refs;
+  refs.emplace_back(ReferenceGenome::makeFromString(">a\n"+makeSequence(1000, 1)+"\n>b\n"+makeSequence(1000, 2)+"\n"));
+  refs.emplace_back(ReferenceGenome::makeFromString(">c\n"+makeSequence(2000, 3)+"\n"));
+  ReferencePanel panel(refs);
+  ReferenceGenome* one = refs[0].get();
+  ReferenceGenome* two = refs[1].get();
+
+  vector<ReferenceGenome::MatchDescriptor> first{{one, 900, false, 0}, {one, 100, false, 2}, {two, 100, false, 0}};
+  vector<ReferenceGenome::MatchDescriptor> second{
+    {one, 1100, true, 0}, // other contig
+    {one, 150, false, 0}, // same strand
+    {one, 300, true, 0},
+    {two, 1500, true, 0}, // too far
+    {two, 400, true, 1},
+    {two, 50, true, 1}};
+  vector<MatchPair> pairs;
+  BOOST_CHECK_EQUAL(bestPairs(first, second, 500, &pairs), 1);
+  BOOST_REQUIRE_EQUAL(pairs.size(), 2U);
+  for(const auto& p : pairs) {
+    BOOST_CHECK(p.first.rg == two && p.second.rg == two);
+    BOOST_CHECK_EQUAL(p.first.pos, 100U);
+    BOOST_CHECK(p.second.pos == 400 || p.second.pos == 50);
+  }
+
+  BOOST_CHECK_EQUAL(bestPairs(first, second, 150, &pairs), 1);
+  BOOST_CHECK_EQUAL(pairs.size(), 1U);
+  BOOST_CHECK_EQUAL(bestPairs(first, second, 50, &pairs), -1);
+  BOOST_CHECK(pairs.empty());
+  second.clear();
+  BOOST_CHECK_EQUAL(bestPairs(first, second, 500, &pairs), -1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
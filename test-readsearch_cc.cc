@@ -0,0 +1,130 @@
+#include <boost/test/unit_test.hpp>
+#include "readsearch.hh"
+#include "mappingworker.hh"
+#include "dnakernels.hh"
+#include "testutil.hh"
+#include <string>
+#include <vector>
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+//! counts every allocation in the testrunner, so we can tell whether a stretch of code made any
+static std::atomic<uint64_t> s_allocations(0);
+
+void* operator new(size_t size)
+{
+  s_allocations++;
+  if(void* ret = malloc(size ? size : 1))
+    return ret;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+  free(ptr);
+}
+
+BOOST_AUTO_TEST_SUITE(readsearch_cc)
+using std::string;
+using std::vector;
+
+BOOST_AUTO_TEST_CASE(test_mateSearch) {
+  string one = makeSequence(20000, 17), two = makeSequence(10000, 18);
+  vector<unique_ptr<ReferenceGenome> > refs;
+  refs.emplace_back(ReferenceGenome::makeFromString(">one\n"+one+"\n"));
+  refs.emplace_back(ReferenceGenome::makeFromString(">two\n"+two+"\n"));
+  ReferencePanel panel(refs);
+  panel.index({11, 150});
+  SearchScratch scratch;
+  vector<ReferenceGenome::MatchDescriptor> anchors, found;
+
+  FastQRead fq1, fq2;
+  fq1.d_nucleotides = two.substr(3000, 150);
+  fq1.d_quality = string(150, 30);
+  panel.getAllReadPosBoth(&fq1, &anchors, &scratch.positions);
+  BOOST_REQUIRE_EQUAL(anchors.size(), 1U);
+
+  // the mate, with a deletion and a mismatch, on the other strand
+  fq2.d_nucleotides = two.substr(3300, 70) + two.substr(3373, 80);
+  fq2.d_nucleotides[100] = fq2.d_nucleotides[100] == 'A' ? 'C' : 'A';
+  fq2.d_quality = string(150, 30);
+  fq2.reverse(); // sequenced off the other strand
+  fq2.reversed = false;
+  panel.getAllReadPosBoth(&fq2, &found, &scratch.positions);
+  BOOST_CHECK(found.empty());
+  mateSearch(&fq2, anchors, 1400, scratch, 0, &found);
+  BOOST_REQUIRE_EQUAL(found.size(), 1U);
+  BOOST_CHECK(found[0].rg == refs[1].get());
+  BOOST_CHECK_EQUAL(found[0].pos, 3301U);
+  BOOST_CHECK(found[0].reverse);
+  BOOST_CHECK_EQUAL(found[0].score, 2);
+
+  // too far away
+  mateSearch(&fq2, anchors, 250, scratch, 0, &found);
+  BOOST_CHECK(found.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_noAllocations) {
+  string one = makeSequence(20000, 7), two = makeSequence(10000, 8);
+  vector<unique_ptr<ReferenceGenome> > refs;
+  refs.emplace_back(ReferenceGenome::makeFromString(">one\n"+one+"\n"));
+  refs.emplace_back(ReferenceGenome::makeFromString(">two\n"+two+"\n"));
+  ReferencePanel panel(refs);
+  panel.index({11, 150});
+  MappingWorker worker(refs, panel, 11, 0, 150, 1, true, true, 1400, 1400);
+
+  ReadPair rp;
+  // a pair from start on, the second read with two deletions, an insert and some mismatches
+  auto makePair = [&](dnapos_t start) {
+    FastQRead& fq1 = rp.fqfrag[0];
+    FastQRead& fq2 = rp.fqfrag[1];
+    fq1.d_nucleotides.assign(one, start, 150);
+    fq1.d_quality.assign(150, 30);
+    fq1.reversed = false;
+    fq1.position = fq2.position = start;
+    fq2.d_nucleotides.assign(one, start + 250, 60);
+    fq2.d_nucleotides.append(one, start + 312, 40);
+    fq2.d_nucleotides.append("GTA");
+    fq2.d_nucleotides.append(one, start + 352, 47);
+    for(unsigned int pos : {10, 80, 120})
+      fq2.d_nucleotides[pos] = fq2.d_nucleotides[pos] == 'A' ? 'C' : 'A';
+    fq2.d_quality.assign(150, 30);
+    fq2.reverse(); // sequenced off the other strand
+    fq2.reversed = false;
+    rp.dup[0] = rp.dup[1] = false;
+  };
+
+  makePair(5000);
+  worker.mapPair(rp); // buffers grow to fit here
+  BOOST_CHECK_EQUAL(worker.d_goodPairMatches, 1U);
+  BOOST_CHECK_EQUAL(worker.d_mateSearchMatches, 1U); // the second read got aligned near the first
+  BOOST_CHECK_EQUAL(worker.d_found, 2U);
+  BOOST_CHECK_EQUAL(worker.d_insertSizes.samples(), 1U);
+  BOOST_REQUIRE(refs[0]->d_locimap.find(5352) != refs[0]->d_locimap.end()); // the insert got tallied
+  BOOST_CHECK_EQUAL(refs[0]->d_locimap.find(5352)->second.totalInserts(), 1U);
+  BOOST_CHECK_EQUAL(refs[0]->d_locimap.find(5311)->second.counts[MappingStats::LociStats::X], 1U); // and a deletion
+
+  // the queue and the placement log grow with every read, just not per read
+  worker.d_bamqueue.reserve(1000, 10000);
+  refs[0]->d_placements.reserve(1000);
+  uint64_t before = s_allocations;
+  for(unsigned int n = 0; n < 100; ++n) {
+    makePair(5000);
+    worker.mapPair(rp);
+  }
+  BOOST_CHECK_EQUAL(s_allocations - before, 0U);
+  BOOST_CHECK_EQUAL(worker.d_goodPairMatches, 101U);
+
+  // loci we have not seen before only make buffers grow now and then, 300 pairs here tally some 1800 of them
+  before = s_allocations;
+  for(unsigned int n = 0; n < 300; ++n) {
+    makePair(6000 + 41 * n);
+    worker.mapPair(rp);
+  }
+  BOOST_CHECK_LT(s_allocations - before, 30U);
+  BOOST_CHECK_EQUAL(worker.d_goodPairMatches, 401U);
+  BOOST_CHECK_EQUAL(worker.d_mateSearchMatches, 401U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
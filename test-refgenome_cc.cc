@@ -0,0 +1,298 @@
+#include <boost/test/unit_test.hpp>
+#include "refgenome.hh"
+#include "dnamisc.hh"
+#include "testutil.hh"
+#include <string>
+#include <vector>
+#include <numeric>
+#include <stdexcept>
+#include <stdio.h>
+#include <unistd.h>
+#include <boost/algorithm/string.hpp>
+BOOST_AUTO_TEST_SUITE(refgenome_cc)
+using std::string;
+using std::vector;
+
+BOOST_AUTO_TEST_CASE(test_contigs) {
+  string one = makeSequence(1000, 1), two = makeSequence(500, 2);
+  auto rg = ReferenceGenome::makeFromString(">one first contig\n"+one.substr(0, 600)+"\n"+one.substr(600)+"\n>two\n"+two+"\n");
+  BOOST_CHECK_EQUAL(rg->d_name, "one");
+  BOOST_CHECK_EQUAL(rg->d_fullname, "one first contig");
+  BOOST_REQUIRE_EQUAL(rg->d_contigs.size(), 2U);
+  BOOST_CHECK_EQUAL(rg->d_contigs[0].name, "one");
+  BOOST_CHECK_EQUAL(rg->d_contigs[0].start, 1U);
+  BOOST_CHECK_EQUAL(rg->d_contigs[0].length, 1000U);
+  BOOST_CHECK_EQUAL(rg->d_contigs[1].name, "two");
+  BOOST_CHECK_EQUAL(rg->d_contigs[1].start, 1002U);
+  BOOST_CHECK_EQUAL(rg->d_contigs[1].length, 500U);
+  BOOST_CHECK_EQUAL(rg->size(), 1501U);
+  BOOST_CHECK_EQUAL(rg->snippet(1002, 1012), two.substr(0, 10));
+  BOOST_CHECK_EQUAL(rg->contigIndex(1000), 0U);
+  BOOST_CHECK_EQUAL(rg->contigIndex(1001), 0U);
+  BOOST_CHECK_EQUAL(rg->contigIndex(1002), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(test_view) {
+  string one = makeSequence(1000, 3);
+  auto rg = ReferenceGenome::makeFromString(">one\n"+one+"\n");
+  auto view = rg->view(11, 21);
+  BOOST_CHECK_EQUAL(view.to_string(), one.substr(10, 10));
+  BOOST_CHECK_EQUAL(rg->nucleotide(11), one[10]);
+  BOOST_CHECK_EQUAL(rg->nucleotide(2000), 0);
+
+  // clamped to the genome
+  BOOST_CHECK_EQUAL(rg->view(991, 2000).to_string(), one.substr(990));
+  BOOST_CHECK(rg->view(1500, 2000).empty());
+  BOOST_CHECK(rg->view(30, 20).empty());
+  BOOST_CHECK_EQUAL(rg->snippet(995, 1200), one.substr(994));
+  BOOST_CHECK(rg->view(1, 1001).data() == rg->view(500, 501).data() - 499); // not copied
+}
+
+BOOST_AUTO_TEST_CASE(test_MappingStats) {
+  auto rg = ReferenceGenome::makeFromString(">one\n"+makeSequence(1000, 4)+"\n");
+  MappingStats ms, other;
+  ms.sizeLike(*rg);
+  other.sizeLike(*rg);
+  BOOST_CHECK_EQUAL(ms.d_coverage.size(), 1001U);
+
+  FastQRead fq;
+  fq.d_nucleotides = string(10, 'A');
+  fq.d_quality = string(10, 30);
+  fq.d_quality[3] = 2;
+  fq.position = 7;
+  ms.cover(500, 10, fq.d_quality, 20);
+  ms.mapFastQ(500, fq);
+  fq.position = 3;
+  fq.reverse();
+  other.cover(495, 10, fq.d_quality, 20);
+  other.mapFastQ(495, fq, -4);
+  fq.position = 1;
+  other.mapFastQ(500, fq);
+  ms.merge(other);
+  BOOST_CHECK(other.d_placements.empty());
+  BOOST_CHECK_EQUAL(ms.d_coverage[494], 0U);
+  BOOST_CHECK_EQUAL(ms.d_coverage[499], 1U);
+  BOOST_CHECK_EQUAL(ms.d_coverage[500], 2U);
+  BOOST_CHECK_EQUAL(ms.d_coverage[501], 1U); // a low quality nucleotide in either read
+  BOOST_CHECK_EQUAL(ms.d_coverage[503], 1U);
+  BOOST_CHECK_EQUAL(ms.d_coverage[509], 1U);
+  BOOST_CHECK_EQUAL(ms.d_coverage[510], 0U);
+
+  ms.sortPlacements();
+  auto range = ms.placements(496, 501);
+  BOOST_REQUIRE_EQUAL(range.second - range.first, 2);
+  BOOST_CHECK_EQUAL((dnapos_t)range.first->locus, 500U);
+  BOOST_CHECK_EQUAL(range.first->pos(), 1U);
+  BOOST_CHECK_EQUAL((range.first + 1)->pos(), 7U);
+  BOOST_CHECK(!(range.first + 1)->reverse());
+  range = ms.placements(490, 500);
+  BOOST_REQUIRE_EQUAL(range.second - range.first, 1);
+  BOOST_CHECK_EQUAL(range.first->indel(), -4);
+  BOOST_CHECK(range.first->reverse());
+  range = ms.placements(501, 1000);
+  BOOST_CHECK(range.first == range.second);
+
+  // the second file of a pair and the largest indels fit as well
+  FASTQMapping fqm((1ULL<<63) | 123456789, 0xffffffff, 8191, true);
+  BOOST_CHECK_EQUAL(sizeof(fqm), 12U);
+  BOOST_CHECK_EQUAL(fqm.pos(), (1ULL<<63) | 123456789);
+  BOOST_CHECK_EQUAL((dnapos_t)fqm.locus, 0xffffffffU);
+  BOOST_CHECK_EQUAL(fqm.indel(), 8191);
+  BOOST_CHECK(fqm.reverse());
+  BOOST_CHECK_EQUAL(FASTQMapping(5, 1, -8192, false).indel(), -8192);
+  BOOST_CHECK_THROW(FASTQMapping(5, 1, 8192, false), std::runtime_error);
+  BOOST_CHECK_THROW(FASTQMapping(1ULL<<48, 1, 0, false), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_getMatchingFastQs) {
+  string one = makeSequence(1000, 5);
+  auto rg = ReferenceGenome::makeFromString(">one\n"+one+"\n");
+  char fname[]="/tmp/test-refgenomeXXXXXX";
+  int fd = mkstemp(fname);
+  BOOST_REQUIRE(fd >= 0);
+  FILE* fp = fdopen(fd, "w");
+  string read1 = one.substr(499, 20), read2 = one.substr(504, 20);
+  read2[3] = read2[3] == 'A' ? 'C' : 'A';
+  long second = fprintf(fp, "@read1\n%s\n+\n%s\n", read1.c_str(), string(20, 'I').c_str());
+  fprintf(fp, "@read2\n%s\n+\n%s\n", read2.c_str(), string(20, 'I').c_str());
+  fclose(fp);
+
+  FastQRead fq;
+  fq.position = second; // in the order the log sorts them, not the order they come in
+  rg->mapFastQ(505, fq);
+  fq.position = 0;
+  rg->mapFastQ(500, fq);
+  rg->sortPlacements();
+
+  StereoFASTQReader sfq(fname, fname, 33);
+  vector<string> lines;
+  boost::split(lines, rg->getMatchingFastQs(490, 530, sfq), boost::is_any_of("\n"));
+  BOOST_REQUIRE_EQUAL(lines.size(), 4U); // a line per read, the reference in the middle
+  BOOST_CHECK_EQUAL(lines[0], string(10, ' ') + string(20, '.') + string(17, ' ') + ' ');
+  BOOST_CHECK_EQUAL(lines[1], string(15, ' ') + "..." + read2[3] + string(16, '.') + string(17, ' ') + ' ');
+  BOOST_CHECK_EQUAL(lines[2], one.substr(489, 40));
+  unlink(fname);
+}
+
+BOOST_AUTO_TEST_CASE(test_getCoverageStats) {
+  string genome = makeSequence(3000, 6);
+  auto rg = ReferenceGenome::makeFromString(">one\n"+genome+"\n");
+  for(dnapos_t pos = 0; pos < rg->d_coverage.size(); ++pos)
+    rg->d_coverage[pos] = 10 + pos % 7;
+  for(dnapos_t pos = 20; pos < 30; ++pos) // too close to the start to show
+    rg->d_coverage[pos] = 0;
+  for(dnapos_t pos = 850; pos < 865; ++pos)
+    rg->d_coverage[pos] = 2;
+  rg->d_coverage[1500] = 4;
+
+  auto one = rg->getCoverageStats(1);
+  BOOST_CHECK_EQUAL(one.undercovered, 10U + 15 + 1);
+  BOOST_REQUIRE_EQUAL(one.lowRuns.size(), 2U);
+  BOOST_CHECK_EQUAL(one.lowRuns[0].pos, 850U);
+  BOOST_CHECK_EQUAL(one.lowRuns[0].stop, 865U);
+  BOOST_CHECK_EQUAL(one.lowRuns[1].pos, 1500U);
+  BOOST_CHECK_EQUAL(one.histo[2], 15U);
+  BOOST_CHECK_CLOSE(mean(one.depth), 1.0*std::accumulate(rg->d_coverage.begin(), rg->d_coverage.end(), 0ULL)/rg->d_coverage.size(), 0.0001);
+
+  // the same as taking every window one by one
+  map<double, VarMeanEstimator> gc;
+  for(dnapos_t pos = 21; pos + 20 <= rg->d_coverage.size(); ++pos)
+    gc[getGCContent(rg->snippet(pos - 20, pos + 20))](rg->d_coverage[pos]);
+  auto table = one.gcTable();
+  BOOST_REQUIRE_EQUAL(table.size(), gc.size());
+  for(auto a = table.begin(), b = gc.begin(); a != table.end(); ++a, ++b) {
+    BOOST_CHECK_EQUAL(a->first, b->first);
+    BOOST_CHECK_EQUAL(mean(a->second), mean(b->second));
+  }
+
+  // chunks, some of which end inside a run, give the same
+  auto seven = rg->getCoverageStats(7);
+  BOOST_CHECK(seven.histo == one.histo);
+  BOOST_CHECK_EQUAL(seven.undercovered, one.undercovered);
+  BOOST_REQUIRE_EQUAL(seven.lowRuns.size(), 2U);
+  BOOST_CHECK_EQUAL(seven.lowRuns[0].stop, 865U);
+  auto table7 = seven.gcTable();
+  BOOST_REQUIRE_EQUAL(table7.size(), table.size());
+  for(auto a = table.begin(), b = table7.begin(); a != table.end(); ++a, ++b)
+    BOOST_CHECK_EQUAL(variance(a->second), variance(b->second));
+}
+
+BOOST_AUTO_TEST_CASE(test_LociStats) {
+  auto rg = ReferenceGenome::makeFromString(">one\n"+makeSequence(1000, 5)+"\n");
+  MappingStats ms, other;
+  ms.sizeLike(*rg);
+  other.sizeLike(*rg);
+  typedef MappingStats::LociStats LS;
+
+  auto& locus = ms.d_locimap[100];
+  for(unsigned int n = 0; n < 1000; ++n)
+    locus.add('C', 30, n % 4 == 0);
+  locus.add('X', 40, false);
+  locus.add('N', 2, true);
+  BOOST_CHECK_EQUAL(locus.counts[LS::C], 1000U);
+  BOOST_CHECK_EQUAL(locus.qualities[LS::C], 30000U);
+  BOOST_CHECK_EQUAL(locus.heads[LS::C], 250U);
+  BOOST_CHECK_EQUAL(locus.counts[LS::X], 1U);
+  BOOST_CHECK_EQUAL(locus.total(), 1002U);
+  BOOST_CHECK_EQUAL(locus.totalHeads(), 251U);
+
+  for(const char* insert : {"AC", "GGT", "AC", "T", "TT", "TTT"})
+    locus.addInsert(ms.internInsert(insert));
+  BOOST_CHECK_EQUAL(ms.d_inserts.size(), 5U);
+  BOOST_CHECK_EQUAL(locus.inserts[0].count, 2U);
+  BOOST_CHECK_EQUAL(locus.otherInserts, 1U); // no slot left for TTT
+
+  // other interns its inserts in another order, merging translates them
+  auto& theirs = other.d_locimap[100];
+  theirs.add('A', 20, true);
+  theirs.addInsert(other.internInsert("GGT"), 3);
+  other.d_locimap[200].addInsert(other.internInsert("AC"));
+  ms.merge(other);
+  BOOST_CHECK(other.d_locimap.empty());
+  const auto& merged = ms.d_locimap[100];
+  BOOST_CHECK_EQUAL(merged.counts[LS::A], 1U);
+  BOOST_CHECK_EQUAL(merged.total(), 1003U);
+  BOOST_CHECK_EQUAL(ms.d_inserts[merged.inserts[1].id], "GGT");
+  BOOST_CHECK_EQUAL(merged.inserts[1].count, 4U);
+  BOOST_CHECK_EQUAL(ms.d_inserts[ms.d_locimap[200].inserts[0].id], "AC");
+  BOOST_CHECK_EQUAL(ms.d_inserts.size(), 5U);
+}
+
+BOOST_AUTO_TEST_CASE(test_settleInserts) {
+  auto rg = ReferenceGenome::makeFromString(">one\n"+makeSequence(1000, 6)+"\n");
+  // the same inserts at one locus, mapped by one worker or split over two in another order
+  vector<string> inserts;
+  for(const char* insert : {"A", "C", "G", "T", "AA", "CC"})
+    for(unsigned int n = 0; n < 6; ++n)
+      inserts.push_back(insert);
+  inserts.push_back("TT");
+  inserts.push_back("GG");
+  inserts.insert(inserts.end(), 6, "AA");
+  inserts.insert(inserts.end(), 5, "CC");
+
+  MappingStats one, two, three;
+  one.sizeLike(*rg);
+  two.sizeLike(*rg);
+  three.sizeLike(*rg);
+  for(const auto& insert : inserts)
+    one.addInsert(100, insert);
+  for(unsigned int n = inserts.size(); n-- > 0; )
+    (n % 2 ? two : three).addInsert(100, inserts[n]);
+  BOOST_CHECK(!two.d_otherInserts.empty());
+  two.merge(three);
+
+  auto report = [](MappingStats& ms) {
+    ms.settleInserts();
+    BOOST_CHECK(ms.d_otherInserts.empty());
+    const auto& ls = ms.d_locimap[100];
+    string ret;
+    for(const auto& ic : ls.inserts)
+      ret += ms.d_inserts[ic.id] + ":" + std::to_string(ic.count) + " ";
+    return ret + "other:" + std::to_string(ls.otherInserts);
+  };
+  BOOST_CHECK_EQUAL(report(one), "AA:12 CC:11 A:6 C:6 other:14"); // A and C beat G and T by sequence
+  BOOST_CHECK_EQUAL(report(two), report(one));
+  BOOST_CHECK_EQUAL(one.d_locimap[100].totalInserts(), inserts.size());
+}
+
+BOOST_AUTO_TEST_CASE(test_ReferencePanel) {
+  string one = makeSequence(3000, 3), two = makeSequence(2000, 4), three = makeSequence(4000, 5);
+  vector<unique_ptr<ReferenceGenome> > refs;
+  refs.emplace_back(ReferenceGenome::makeFromString(">one\n"+one+"\n>two\n"+two+"\n"));
+  refs.emplace_back(ReferenceGenome::makeFromString(">three\n"+three+"\n"));
+  ReferencePanel panel(refs);
+  panel.index({11, 100});
+  BOOST_CHECK_EQUAL(refs[0]->d_panelOffset, 0U);
+  BOOST_CHECK_EQUAL(refs[1]->d_panelOffset, refs[0]->size() + 1);
+
+  FastQRead fq;
+  fq.d_nucleotides = three.substr(1234, 100);
+  fq.d_quality = string(100, 30);
+  auto matches = panel.getAllReadPosBoth(&fq);
+  BOOST_REQUIRE_EQUAL(matches.size(), 1U);
+  BOOST_CHECK(matches[0].rg == refs[1].get());
+  BOOST_CHECK_EQUAL(matches[0].pos, 1235U);
+  BOOST_CHECK(!matches[0].reverse);
+
+  fq.d_nucleotides = two.substr(10, 100);
+  fq.reverse();
+  matches = panel.getAllReadPosBoth(&fq);
+  BOOST_REQUIRE_EQUAL(matches.size(), 1U);
+  BOOST_CHECK(matches[0].rg == refs[0].get());
+  BOOST_CHECK_EQUAL(matches[0].pos, 3002U + 10);
+  BOOST_CHECK(matches[0].reverse);
+
+  // the panel holds these nucleotides, but they straddle two contigs
+  vector<dnapos_t> positions;
+  panel.getPositions((one.substr(2950)+"N"+two.substr(0, 49)).c_str(), 100, &positions);
+  BOOST_REQUIRE_EQUAL(positions.size(), 1U);
+  ReferenceGenome* rg;
+  dnapos_t pos;
+  BOOST_CHECK(!panel.locate(positions[0], 100, &rg, &pos));
+  BOOST_CHECK(panel.locate(positions[0], 50, &rg, &pos));
+  BOOST_CHECK(rg == refs[0].get());
+  BOOST_CHECK_EQUAL(pos, 2951U);
+  BOOST_CHECK(!panel.locate(refs[1]->d_panelOffset, 1, &rg, &pos)); // the padding in front of a genome
+}
+
+BOOST_AUTO_TEST_SUITE_END()
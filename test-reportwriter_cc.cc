@@ -0,0 +1,89 @@
+#include <boost/test/unit_test.hpp>
+#include "reportwriter.hh"
+#include <string>
+#include <vector>
+#include <sstream>
+#include <limits>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+BOOST_AUTO_TEST_SUITE(reportwriter_cc)
+using std::string;
+using std::vector;
+
+static string printfed(const char* fmt, double val)
+{
+  char buffer[512];
+  snprintf(buffer, sizeof(buffer), fmt, val);
+  return buffer;
+}
+
+BOOST_AUTO_TEST_CASE(test_formatting) {
+  ReportWriter rw;
+  rw << 0 << ' ' << -1 << ' ' << std::numeric_limits<int64_t>::min() << ' ' << std::numeric_limits<uint64_t>::max() << ' ' << (uint8_t)200;
+  BOOST_CHECK_EQUAL(rw.str(), "0 -1 -9223372036854775808 18446744073709551615 200");
+  rw.clear();
+  rw << 'x' << "y" << string("z") << boost::string_ref("abc", 2);
+  BOOST_CHECK_EQUAL(rw.str(), "xyzab");
+
+  vector<double> vals{0, -0.0, 1, -7, 0.5, 1.0/3, 999999, 1000000, 1234567, 1e-5, -2.5e10, 1e300, 123.456789};
+  for(auto val : vals) {
+    std::ostringstream os;
+    os << val;
+    rw.clear();
+    rw << val;
+    BOOST_CHECK_EQUAL(rw.str(), os.str());
+    rw.clear();
+    rw << fixed(val);
+    BOOST_CHECK_EQUAL(rw.str(), printfed("%f", val));
+    rw.clear();
+    rw << fixed(val, 2);
+    BOOST_CHECK_EQUAL(rw.str(), printfed("%.2f", val));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_json) {
+  ReportWriter rw;
+  writeJSONVector(rw, "var v", vector<uint32_t>{3, 4}, [](dnapos_t d){return d/2.0;}, [](int i){return 10.0*i;});
+  writeJSONPairs(rw, vector<double>{0.25, 1}, [](int i){return i+100;});
+  writeJSONPairs(rw, vector<std::pair<double, double> >{{1.5, 2}});
+  BOOST_CHECK_EQUAL(rw.str(), "var v=[[0,1.5],[10,2]];\n[[100,0.25],[101,1]][[1.5,2]]");
+}
+
+BOOST_AUTO_TEST_CASE(test_sinks) {
+  char plain[]="/tmp/test-reportwriterXXXXXX";
+  int fd = mkstemp(plain);
+  BOOST_REQUIRE(fd >= 0);
+  close(fd);
+  string gzname = string(plain)+"-z";
+
+  string expected;
+  {
+    ReportWriter rw(plain);
+    rw.addSink(gzname, true);
+    for(int n = 0; n < 20000; ++n) { // more than one buffer full
+      rw << n << ',';
+      expected += std::to_string(n) + ",";
+    }
+    rw.close();
+  }
+
+  for(const auto& fname : {string(plain), gzname+".gz"}) {
+    gzFile gz = gzopen(fname.c_str(), "rb"); // also reads files that are not compressed
+    BOOST_REQUIRE(gz);
+    string got;
+    char buffer[4096];
+    int len;
+    while((len = gzread(gz, buffer, sizeof(buffer))) > 0)
+      got.append(buffer, len);
+    gzclose(gz);
+    unlink(fname.c_str());
+    BOOST_CHECK(got == expected);
+  }
+
+  BOOST_CHECK_THROW(ReportWriter("/nonexistent/report.js"), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
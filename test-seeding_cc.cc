@@ -0,0 +1,47 @@
+#include <boost/test/unit_test.hpp>
+#include "seeding.hh"
+#include "dnakernels.hh"
+#include "testutil.hh"
+#include <string>
+#include <vector>
+BOOST_AUTO_TEST_SUITE(seeding_cc)
+using std::string;
+using std::vector;
+
+BOOST_AUTO_TEST_CASE(test_DiagonalVoter) {
+  string one = makeSequence(20000, 7), two = makeSequence(10000, 8);
+  vector<unique_ptr<ReferenceGenome> > refs;
+  refs.emplace_back(ReferenceGenome::makeFromString(">one\n"+one+"\n"));
+  refs.emplace_back(ReferenceGenome::makeFromString(">two\n"+two+"\n"));
+  ReferencePanel panel(refs);
+  panel.index({11, 150});
+  DiagonalVoter voter(panel, 11);
+  vector<SeedCandidate> candidates;
+
+  // a few mismatches
+  string read = two.substr(4000, 150);
+  for(unsigned int pos : {20, 61, 99, 140})
+    read[pos] = read[pos] == 'A' ? 'C' : 'A';
+  voter.vote(read, 8, 3, &candidates);
+  BOOST_REQUIRE(!candidates.empty());
+  BOOST_CHECK_EQUAL(candidates[0].diagonal, refs[1]->d_panelOffset + 4001);
+  BOOST_CHECK(!candidates[0].reverse);
+  BOOST_CHECK(candidates[0].votes > 20);
+
+  // a deletion moves half of the votes one diagonal along, they still count for the same candidate
+  read = one.substr(12345, 75) + one.substr(12345 + 76, 75);
+  reverseComplement(&read[0], read.size());
+  voter.vote(read, 8, 3, &candidates);
+  BOOST_REQUIRE(!candidates.empty());
+  BOOST_CHECK(candidates[0].reverse);
+  BOOST_CHECK(candidates[0].diagonal == 12346U || candidates[0].diagonal == 12347U);
+  BOOST_CHECK(candidates[0].votes > 30);
+  BOOST_CHECK(candidates.size() == 1 || candidates[1].votes < candidates[0].votes);
+
+  voter.vote(makeSequence(150, 9), 8, 3, &candidates);
+  BOOST_CHECK(candidates.empty());
+  voter.vote(read, 0, 3, &candidates);
+  BOOST_CHECK(candidates.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,253 @@
+#include <boost/test/unit_test.hpp>
+#include "zstuff.hh"
+#include "testutil.hh"
+#include <zlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdexcept>
+#include <vector>
+#include <string>
+BOOST_AUTO_TEST_SUITE(zstuff_cc)
+using std::string;
+using std::vector;
+
+static string makeLine(unsigned int n)
+{
+  return "line "+std::to_string(n)+" "+string(n % 97, 'A' + n % 26);
+}
+
+//! writes numLines lines as two concatenated gzip members, returns the filename
+static string writeGz(unsigned int numLines)
+{
+  char fname[]="/tmp/test-zstuffXXXXXX";
+  int fd = mkstemp(fname);
+  if(fd < 0)
+    throw std::runtime_error("Unable to create temporary file");
+  close(fd);
+  for(int member = 0; member < 2; ++member) {
+    gzFile gz = gzopen(fname, member ? "ab" : "wb");
+    for(unsigned int n = member ? numLines/2 : 0; n < (member ? numLines : numLines/2); ++n) {
+      string line = makeLine(n)+"\n";
+      gzwrite(gz, line.c_str(), line.size());
+    }
+    gzclose(gz);
+  }
+  return fname;
+}
+
+BOOST_AUTO_TEST_CASE(test_ZLineReader) {
+  const unsigned int numLines = 100000; // several MB, so the background thread kicks in
+  string fname = writeGz(numLines);
+  for(bool background : {false, true}) {
+    ZLineReader zlr(fname, background);
+    vector<uint64_t> offsets;
+    const char* line;
+    size_t len;
+    unsigned int n = 0;
+    for(;;) {
+      uint64_t pos = zlr.getUncPos();
+      if(!zlr.getLine(&line, &len))
+        break;
+      offsets.push_back(pos);
+      BOOST_REQUIRE_EQUAL(string(line, len), makeLine(n));
+      ++n;
+    }
+    BOOST_CHECK_EQUAL(n, numLines);
+
+    for(unsigned int target : {numLines - 1, 0U, numLines / 2, 17U, numLines / 2 + 1}) {
+      zlr.seek(offsets[target]);
+      BOOST_REQUIRE(zlr.getLine(&line, &len));
+      BOOST_CHECK_EQUAL(string(line, len), makeLine(target));
+    }
+    char buf[256];
+    BOOST_REQUIRE(zlr.fgets(buf, sizeof(buf)));
+    BOOST_CHECK_EQUAL(string(buf), makeLine(numLines / 2 + 2)+"\n");
+  }
+  unlink(ZLineReader::indexName(fname).c_str());
+  unlink(fname.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_ZLineReaderIndex) {
+  const unsigned int numLines = 50000;
+  string fname = writeGz(numLines);
+  uint64_t total = 0;
+  for(unsigned int n = 0; n < numLines; ++n)
+    total += makeLine(n).size() + 1;
+
+  {
+    ZLineReader zlr(fname, false, 65536);
+    const char* line;
+    size_t len;
+    for(unsigned int n = 0; n < numLines / 3; ++n)
+      BOOST_REQUIRE(zlr.getLine(&line, &len));
+    uint64_t estimate = zlr.estimatedSize();
+    BOOST_CHECK_GT(estimate, total * 0.8);
+    BOOST_CHECK_LT(estimate, total * 1.2);
+  }
+  FILE* fp = fopen(ZLineReader::indexName(fname).c_str(), "rb");
+  BOOST_CHECK(!fp); // estimating took no pass over the whole file
+  if(fp)
+    fclose(fp);
+
+  vector<uint64_t> offsets;
+  {
+    ZLineReader zlr(fname, true, 65536);
+    BOOST_CHECK_EQUAL(zlr.uncompressedSize(), total); // has to go through the whole file for this
+    const char* line;
+    size_t len;
+    for(uint64_t pos = zlr.getUncPos(); zlr.getLine(&line, &len); pos = zlr.getUncPos())
+      offsets.push_back(pos);
+    BOOST_CHECK_EQUAL(offsets.size(), numLines);
+  }
+
+  fp = fopen(ZLineReader::indexName(fname).c_str(), "rb");
+  BOOST_REQUIRE(fp);
+  fclose(fp);
+
+  ZLineReader zlr(fname, false);
+  BOOST_CHECK_EQUAL(zlr.uncompressedSize(), total);
+  const char* line;
+  size_t len;
+  for(unsigned int target : {numLines - 1, 12345U, 0U, numLines / 2, numLines / 2 - 1, 40000U}) {
+    zlr.seek(offsets[target]);
+    BOOST_REQUIRE(zlr.getLine(&line, &len));
+    BOOST_CHECK_EQUAL(string(line, len), makeLine(target));
+  }
+  // restarting mid-stream, we have to get past the end of the first gzip member by ourselves
+  zlr.seek(offsets[numLines / 2 - 1000]);
+  for(unsigned int n = numLines / 2 - 1000; n < numLines; ++n) {
+    BOOST_REQUIRE(zlr.getLine(&line, &len));
+    BOOST_REQUIRE_EQUAL(string(line, len), makeLine(n));
+  }
+  BOOST_CHECK(!zlr.getLine(&line, &len));
+  unlink(ZLineReader::indexName(fname).c_str());
+  unlink(fname.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_ZLineReaderParallel) {
+  // needs to compress badly enough to span several 1MB chunks
+  vector<string> lines;
+  uint32_t state = 1;
+  for(unsigned int n = 0; n < 150000; ++n) {
+    string line;
+    for(unsigned int i = 0; i < 100; ++i)
+      line.append(1, "ACGT"[nextRandom(&state) & 3]);
+    lines.push_back(line);
+  }
+  char fname[]="/tmp/test-zstuffXXXXXX";
+  int fd = mkstemp(fname);
+  BOOST_REQUIRE(fd >= 0);
+  close(fd);
+  for(int member = 0; member < 2; ++member) {
+    gzFile gz = gzopen(fname, member ? "ab" : "wb");
+    for(unsigned int n = member ? lines.size()/2 : 0; n < (member ? lines.size() : lines.size()/2); ++n) 
+      gzprintf(gz, "%s\n", lines[n].c_str());
+    gzclose(gz);
+  }
+
+  for(unsigned int threads : {1, 3}) {
+    unlink(ZLineReader::indexName(fname).c_str());
+    ZLineReader zlr(fname, true, 1048576, threads);
+    vector<uint64_t> offsets;
+    const char* line;
+    size_t len;
+    unsigned int n = 0;
+    for(uint64_t pos = zlr.getUncPos(); zlr.getLine(&line, &len); pos = zlr.getUncPos()) {
+      offsets.push_back(pos);
+      BOOST_REQUIRE_EQUAL(string(line, len), lines[n]);
+      ++n;
+    }
+    BOOST_CHECK_EQUAL(n, lines.size());
+    // the access points recorded in parallel mode have to work too
+    for(unsigned int target : {149999U, 3U, 75000U, 100000U, 74999U}) {
+      zlr.seek(offsets[target]);
+      BOOST_REQUIRE(zlr.getLine(&line, &len));
+      BOOST_CHECK_EQUAL(string(line, len), lines[target]);
+    }
+  }
+  unlink(ZLineReader::indexName(fname).c_str());
+  unlink(fname);
+}
+
+BOOST_AUTO_TEST_CASE(test_BGZFLineReader) {
+  const unsigned int numLines = 100000;
+  char fname[]="/tmp/test-zstuffXXXXXX";
+  int fd = mkstemp(fname);
+  BOOST_REQUIRE(fd >= 0);
+  close(fd);
+  uint64_t total = 0;
+  {
+    BGZFWriter bw(fname);
+    for(unsigned int n = 0; n < numLines; ++n) {
+      string line = makeLine(n)+"\n";
+      bw.write(line.c_str(), line.size());
+      total += line.size();
+    }
+  }
+  BOOST_CHECK(BGZFLineReader::isBGZF(fname));
+  string gzname = writeGz(10);
+  BOOST_CHECK(!BGZFLineReader::isBGZF(gzname));
+  FILE* fp = fopen(gzname.c_str(), "wb");
+  BOOST_REQUIRE(fp);
+  const unsigned char emptyExtra[]={0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 0, 0}; // extra field of length 0
+  fwrite(emptyExtra, 1, sizeof(emptyExtra), fp);
+  fclose(fp);
+  BOOST_CHECK(!BGZFLineReader::isBGZF(gzname));
+  unlink(gzname.c_str());
+
+  for(unsigned int threads : {1, 3}) {
+    BGZFLineReader blr(fname, threads);
+    BOOST_CHECK_EQUAL(blr.uncompressedSize(), total);
+    vector<uint64_t> offsets;
+    const char* line;
+    size_t len;
+    unsigned int n = 0;
+    for(uint64_t pos = blr.getUncPos(); blr.getLine(&line, &len); pos = blr.getUncPos()) {
+      offsets.push_back(pos);
+      BOOST_REQUIRE_EQUAL(string(line, len), makeLine(n));
+      ++n;
+    }
+    BOOST_CHECK_EQUAL(n, numLines);
+    BOOST_CHECK_EQUAL(blr.getUncPos(), total);
+
+    for(unsigned int target : {numLines - 1, 0U, numLines / 2, 17U, 18U, 5000U}) {
+      blr.seek(offsets[target]);
+      BOOST_REQUIRE(blr.getLine(&line, &len));
+      BOOST_CHECK_EQUAL(string(line, len), makeLine(target));
+    }
+    // seeking while blocks are still being inflated ahead of us
+    blr.seek(0);
+    for(unsigned int n = 0; n < 20000; ++n)
+      BOOST_REQUIRE(blr.getLine(&line, &len));
+    blr.seek(offsets[21000]);
+    BOOST_REQUIRE(blr.getLine(&line, &len));
+    BOOST_CHECK_EQUAL(string(line, len), makeLine(21000));
+    blr.seek(total);
+    BOOST_CHECK(!blr.getLine(&line, &len));
+  }
+  unlink(fname);
+}
+
+BOOST_AUTO_TEST_CASE(test_BGZFEmpty) {
+  char fname[]="/tmp/test-zstuffXXXXXX";
+  int fd = mkstemp(fname);
+  BOOST_REQUIRE(fd >= 0);
+  // what 'bgzip < /dev/null' writes: just the EOF marker block
+  const unsigned char eofBlock[]={0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0x1b, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  BOOST_REQUIRE(write(fd, eofBlock, sizeof(eofBlock)) == (ssize_t)sizeof(eofBlock));
+  close(fd);
+  BOOST_CHECK(BGZFLineReader::isBGZF(fname));
+
+  BGZFLineReader blr(fname);
+  BOOST_CHECK_EQUAL(blr.uncompressedSize(), 0U);
+  const char* line;
+  size_t len;
+  BOOST_CHECK(!blr.getLine(&line, &len));
+  blr.seek(0);
+  BOOST_CHECK_EQUAL(blr.getUncPos(), 0U);
+  BOOST_CHECK(!blr.getLine(&line, &len));
+  BOOST_CHECK_THROW(blr.seek(1), std::runtime_error);
+  unlink(fname);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
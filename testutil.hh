@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+#include <stdint.h>
+
+//! next number of a linear congruential generator, so tests get the same 'random' data on every run
+inline uint32_t nextRandom(uint32_t* state)
+{
+  *state = *state * 1103515245 + 12345;
+  return *state >> 16;
+}
+
+//! size nucleotides of ACGT, the same ones for the same state
+inline std::string makeSequence(unsigned int size, uint32_t state)
+{
+  std::string ret;
+  for(unsigned int n = 0; n < size; ++n)
+    ret.append(1, "ACGT"[nextRandom(&state) & 3]);
+  return ret;
+}
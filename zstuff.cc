@@ -4,124 +4,522 @@
 #include <string.h>
 #include "zstuff.hh"
 #include <stdexcept>
+#include <algorithm>
+#include <limits>
 #include <iostream>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "compat.hh"
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
 
 using namespace std;
 
-ZLineReader::ZState::ZState()
+ZLineReader::ZLineReader(const std::string& fname, bool background, uint64_t spacing, unsigned int numThreads) 
+  : d_raw(false), d_inbuffer(262144), d_fname(fname), d_spacing(spacing), d_indexComplete(false), d_totalSize(0), d_seenUncPos(0), d_seenInPos(0), 
+    d_zPos(0), d_zDone(false), d_atBoundary(false), d_numThreads(numThreads), d_map(0), d_mapSize(0), d_parPos(0),
+    d_produced(0), d_consumed(0), d_blockPos(0), d_haveBlock(false), 
+    d_seqBlocks(0), d_background(background), d_stop(false), d_uncPos(0)
 {
-  fpos=0;
-  memset(&s, 0, sizeof(s));
-  inflateInit2(&s, 31);
+  d_fp=fopen(fname.c_str(), "rb");
+  if(!d_fp)
+    throw runtime_error("Unable to open '"+fname+"' for reading on ZLineReader: "+ string(strerror(errno)));
+
+  unsigned char magic[2];
+  if(fread(magic, 1, 2, d_fp) != 2 || magic[0] != 0x1f || magic[1] != 0x8b) {
+    fclose(d_fp);
+    throw runtime_error("File '"+fname+"' does not look gzip compressed");
+  }
+  rewind(d_fp);
+  memset(&d_zs, 0, sizeof(d_zs));
+  if(inflateInit2(&d_zs, 31) != Z_OK) {
+    fclose(d_fp);
+    throw runtime_error("Unable to initialize inflate for '"+fname+"'");
+  }
+  d_zs.next_in = (Bytef*)&d_inbuffer[0];
+  d_zs.avail_in = 0;
+  if(!loadIndex()) {
+    d_points.clear();
+    d_points[0]=AccessPoint{0, 0, string()};
+  }
+  for(auto& block : d_blocks)
+    block.data.resize(1048576);
+
+  if(!d_numThreads)
+    d_numThreads = min(4U, max(1U, std::thread::hardware_concurrency()));
+#ifndef _WIN32
+  struct stat buf;
+  if(d_background && d_numThreads > 1 && !fstat(fileno(d_fp), &buf) && buf.st_size) {
+    void* p = mmap(0, buf.st_size, PROT_READ, MAP_PRIVATE, fileno(d_fp), 0);
+    if(p != MAP_FAILED) { // if it does fail, we inflate on one thread
+      d_map = (const unsigned char*)p;
+      d_mapSize = buf.st_size;
+    }
+  }
+#endif
 }
-ZLineReader::ZState::~ZState()
+
+//! reads more compressed data if we ran out, false on EOF
+bool ZLineReader::refill()
 {
-  inflateEnd(&s);
+  if(!d_zs.avail_in) {
+    d_zs.next_in = (Bytef*)&d_inbuffer[0];
+    d_zs.avail_in = fread(&d_inbuffer[0], 1, d_inbuffer.size(), d_fp);
+  }
+  return d_zs.avail_in > 0;
 }
 
-ZLineReader::ZState::ZState(const ZLineReader::ZState& orig)
+//! records an access point at uncPos, starting from input bit 'bit', unless we have one nearby already
+void ZLineReader::storePoint(uint64_t uncPos, uint64_t bit, const char* window, size_t len)
 {
-  memset(&s, 0, sizeof(s));
-  fpos = orig.fpos;
+  std::lock_guard<std::mutex> lock(d_pointLock);
+  if(d_indexComplete)
+    return;
+  if(uncPos > d_seenUncPos) {
+    d_seenUncPos = uncPos;
+    d_seenInPos = bit / 8;
+  }
+  auto iter = d_points.upper_bound(uncPos);
+  if(uncPos - (--iter)->first < d_spacing)
+    return;
+  
+  AccessPoint ap;
+  ap.inPos = bit / 8;
+  ap.bits = (8 - bit % 8) % 8; // we need the top bits of the byte we are in the middle of
+  if(len) {
+    uLongf clen = compressBound(len);
+    ap.window.resize(clen);
+    if(compress2((Bytef*)&ap.window[0], &clen, (const Bytef*)window, len, 1) != Z_OK)
+      return;
+    ap.window.resize(clen);
+  }
+  d_points[uncPos]=ap;
+}
 
-  auto res=inflateCopy(&s, (z_stream*)&orig.s);
-  if(res != Z_OK)  {
-    throw std::runtime_error("Unable to copy Z state");
-  } 
+//! called on a deflate block boundary
+void ZLineReader::addPoint()
+{
+  if(d_indexComplete) // no need to take the lock on every block boundary
+    return;
+  {
+    std::lock_guard<std::mutex> lock(d_pointLock);
+    if(d_indexComplete)
+      return;
+    if(d_zPos > d_seenUncPos) {
+      d_seenUncPos = d_zPos;
+      d_seenInPos = ftell(d_fp) - d_zs.avail_in;
+    }
+    auto iter = d_points.upper_bound(d_zPos);
+    if(d_zPos - (--iter)->first < d_spacing)
+      return;
+  }
+  Bytef window[32768];
+  uInt len = sizeof(window);
+  if(inflateGetDictionary(&d_zs, window, &len) == Z_OK)
+    storePoint(d_zPos, (ftell(d_fp) - d_zs.avail_in) * 8 - (d_zs.data_type & 7), (const char*)window, len);
 }
 
-ZLineReader::ZState& ZLineReader::ZState::operator=(const ZLineReader::ZState& orig)
+/* fill block with up to size bytes of inflated data, recording access points as we go.
+   With toBoundary, we stop at the first deflate block boundary, which might be before we inflated anything */
+void ZLineReader::inflateBlock(Block* block, size_t size, bool toBoundary)
 {
-  inflateEnd(&s);
-  memset(&s, 0, sizeof(s));
-  fpos = orig.fpos;
+  const size_t step = 65536;
+  block->uncPos = d_zPos;
+  block->len = 0;
+  block->error = nullptr;
+  d_atBoundary = false;
 
-  auto res=inflateCopy(&s, (z_stream*)&orig.s);
-  if(res != Z_OK)  {
-    throw std::runtime_error("Unable to copy Z state");
+  while(block->len < size && !d_zDone && !d_atBoundary) {
+    d_zs.next_out = (Bytef*)&block->data[block->len];
+    d_zs.avail_out = min(step, size - block->len);
+    while(d_zs.avail_out) {
+      if(!refill()) { // truncated files end here too
+	d_zDone = true;
+	break;
+      }
+      auto before = d_zs.avail_out;
+      auto res = inflate(&d_zs, Z_BLOCK);
+      auto got = before - d_zs.avail_out;
+      block->len += got;
+      d_zPos += got;
+      if(res == Z_STREAM_END) {
+	if(d_raw) { // we have to skip the gzip trailer ourselves
+	  for(int n = 0; n < 8; ++n) {
+	    if(!refill())
+	      break;
+	    d_zs.next_in++;
+	    d_zs.avail_in--;
+	  }
+	}
+	// there might be another gzip member concatenated to this one
+	if(!refill()) {
+	  d_zDone = true;
+	  break;
+	}
+	inflateReset2(&d_zs, 31);
+	d_raw = false;
+      }
+      else if(res != Z_OK && res != Z_BUF_ERROR)
+	throw runtime_error("Error inflating: "+ string(d_zs.msg ? d_zs.msg : "no error message"));
+      else if((d_zs.data_type & 128) && !(d_zs.data_type & 64)) {
+	addPoint();
+	if(toBoundary) {
+	  d_atBoundary = true;
+	  break;
+	}
+      }
+    }
   }
-  return *this;
+  if(d_zDone)
+    finish();
 }
 
-ZLineReader::ZLineReader(const std::string& fname)
+//! we are at the end of the file, so our index is complete
+void ZLineReader::finish()
 {
-  d_fp=fopen(fname.c_str(), "rb");
-  if(!d_fp)
-    throw runtime_error("Unable to open '"+fname+"' for reading on ZLineReader: "+ string(strerror(errno)));
-  
-  int ret = fread(d_inbuffer, 1, sizeof(d_inbuffer), d_fp);
-  d_zs.s.avail_in=ret;
-  d_zs.s.next_in = (Bytef*)d_inbuffer;
-  //  cerr<<"Got ret "<<ret<<endl;
-  d_zs.s.next_out=(Bytef*)d_outbuffer;
-  d_zs.s.avail_out=sizeof(d_outbuffer);
-  d_datapos=0;
-  if(inflate(&d_zs.s, Z_NO_FLUSH) != Z_OK)
-    throw runtime_error("Error inflating after open: "+string(d_zs.s.msg ? d_zs.s.msg : "no error message"));
-  
-  d_have = d_zs.s.next_out - (Bytef*)d_outbuffer;
-  d_uncPos=0;
-  d_haveSeeked=0;
-}
-
-bool ZLineReader::getChar(char* c)
-{
-  if(!d_have) {
-    //    cerr<<"Nothing available.."<<endl;
-    d_zs.s.next_out=(Bytef*)d_outbuffer;
-    d_zs.s.avail_out=sizeof(d_outbuffer);
-    d_datapos=0;
-     
-    if(d_zs.s.avail_in) {
-      //      cerr<<"zlib has a bit more to chew on"<<endl;
-      auto res=inflate(&d_zs.s, Z_NO_FLUSH);
-      if(res!= Z_OK) {
-        if(res == Z_STREAM_END) {
-          if(d_zs.s.next_out == (Bytef*)d_outbuffer)
-            return false;
-        }
-        else
-          throw runtime_error("Error inflating 1: "+ string(d_zs.s.msg ? d_zs.s.msg : "no error message"));
-      }
-      d_have = d_zs.s.next_out - (Bytef*)d_outbuffer;
+  {
+    std::lock_guard<std::mutex> lock(d_pointLock);
+    if(d_indexComplete)
+      return;
+    d_totalSize = d_zPos;
+    d_indexComplete = true;
+  }
+  saveIndex();
+}
+
+//! what the background thread does to fill a block
+void ZLineReader::fillBlock(Block* block)
+{
+  if(d_par) 
+    fillFromParallel(block);
+  else if(d_map && !d_zDone) {
+    inflateBlock(block, block->data.size(), true);
+    if(d_atBoundary) {
+      startParallel();
+      if(!block->len)
+	fillFromParallel(block);
     }
-    if(!d_have) {
-      //      cerr<<"Still no output, getting more input.. "<<d_zs.s.avail_in<<endl;
-      d_zs.s.next_in = (Bytef*)d_inbuffer;
-      d_zs.s.avail_in = fread(d_zs.s.next_in, 1, sizeof(d_inbuffer) - d_zs.s.avail_in, d_fp);
-      //      cerr<<"d_zs.s.avail_in: "<<d_zs.s.avail_in<<endl;
-      if(!d_zs.s.avail_in)
-        return false;
-      auto res = inflate(&d_zs.s, Z_NO_FLUSH);
-      if(res == Z_STREAM_END) {
-        if(d_zs.s.next_out == (Bytef*)d_outbuffer)
-          return false;
+  }
+  else
+    inflateBlock(block, block->data.size());
+}
+
+//! from the deflate block boundary zlib is at, the rest of this gzip member gets inflated in parallel
+void ZLineReader::startParallel()
+{
+  Bytef window[32768];
+  uInt len = sizeof(window);
+  if(inflateGetDictionary(&d_zs, window, &len) != Z_OK)
+    return;
+  d_parWindow.assign((const char*)window, len);
+  uint64_t bit = (ftell(d_fp) - d_zs.avail_in) * 8 - (d_zs.data_type & 7);
+  d_par.reset(new ParallelInflater(d_map, d_mapSize, bit, d_parWindow, d_numThreads));
+  d_parOut.clear();
+  d_parPos = 0;
+}
+
+void ZLineReader::fillFromParallel(Block* block)
+{
+  block->uncPos = d_zPos;
+  block->len = 0;
+  block->error = nullptr;
+  while(block->len < block->data.size()) {
+    if(d_parPos == d_parOut.size()) {
+      if(d_parOut.size() >= 32768)
+	d_parWindow.assign(d_parOut, d_parOut.size() - 32768, 32768);
+      else {
+	d_parWindow.append(d_parOut);
+	if(d_parWindow.size() > 32768)
+	  d_parWindow.erase(0, d_parWindow.size() - 32768);
+      }
+      if(!d_par->next(&d_parOut, &d_parBounds)) {
+	endParallel();
+	break;
+      }
+      d_parPos = 0;
+      for(const auto& b : d_parBounds) {
+	string window;
+	if(b.outPos >= 32768)
+	  window.assign(d_parOut, b.outPos - 32768, 32768);
+	else
+	  window = d_parWindow.substr(d_parWindow.size() - min(d_parWindow.size(), (size_t)(32768 - b.outPos))) + 
+	    d_parOut.substr(0, b.outPos);
+	storePoint(d_zPos + b.outPos, b.bit, window.c_str(), window.size());
       }
-      else if(res != Z_OK)
-        throw runtime_error("Error inflating 2: "+ string(d_zs.s.msg ? d_zs.s.msg : "no error message"));
-      d_have = d_zs.s.next_out - (Bytef*)d_outbuffer;
     }
+    size_t take = min(d_parOut.size() - d_parPos, block->data.size() - block->len);
+    memcpy(&block->data[block->len], &d_parOut[d_parPos], take);
+    d_parPos += take;
+    block->len += take;
+    d_zPos += take;
   }
-  
-  if(c)
-    *c = d_outbuffer[d_datapos];
-  //  cerr<<"Returning: '"<<*c<<"', d_zs.s.avail_out: "<<d_have<<"\n";
-  d_datapos++;
-  d_have--;
-  d_uncPos++;
+  if(!block->len) // member ended right here, don't signal EOF if there is more
+    fillBlock(block);
+}
+
+//! the ParallelInflater is at the end of a gzip member, zlib continues with the next one, if any
+void ZLineReader::endParallel()
+{
+  uint64_t next = (d_par->endBit() + 7) / 8 + 8; // skip the trailer
+  d_par.reset();
+  d_parOut.clear();
+  d_parPos = 0;
+  if(next >= d_mapSize) {
+    d_zDone = true;
+    finish();
+    return;
+  }
+  fseek(d_fp, next, SEEK_SET);
+  inflateReset2(&d_zs, 31);
+  d_raw = false;
+  d_zs.next_in = (Bytef*)&d_inbuffer[0];
+  d_zs.avail_in = 0;
+}
+
+//! reposition the inflater to an access point
+void ZLineReader::restart(uint64_t uncPos, const AccessPoint& ap)
+{
+  if(fseek(d_fp, ap.inPos, SEEK_SET) < 0)
+    throw runtime_error("Unable to seek in '"+d_fname+"': "+string(strerror(errno)));
+  d_zs.next_in = (Bytef*)&d_inbuffer[0];
+  d_zs.avail_in = 0;
+  if(!uncPos) {
+    inflateReset2(&d_zs, 31);
+    d_raw = false;
+  }
+  else {
+    inflateReset2(&d_zs, -15);
+    d_raw = true;
+    if(ap.bits) {
+      int c = fgetc(d_fp);
+      if(c == EOF)
+	throw runtime_error("Unexpected EOF in '"+d_fname+"' while seeking");
+      inflatePrime(&d_zs, ap.bits, c >> (8 - ap.bits));
+    }
+    if(!ap.window.empty()) {
+      Bytef window[32768];
+      uLongf len = sizeof(window);
+      if(uncompress(window, &len, (const Bytef*)ap.window.c_str(), ap.window.size()) != Z_OK)
+	throw runtime_error("Corrupt access point in index of '"+d_fname+"'");
+      inflateSetDictionary(&d_zs, window, len);
+    }
+  }
+  d_zPos = uncPos;
+  d_zDone = false;
+}
+
+namespace {
+struct ZIndexHeader
+{
+  char magic[8];
+  uint64_t fileSize, mtime, totalSize, numPoints;
+};
+}
+
+static bool statFile(const std::string& fname, uint64_t* size, uint64_t* mtime)
+{
+  struct stat buf;
+  if(stat(fname.c_str(), &buf) < 0)
+    return false;
+  *size = buf.st_size;
+  *mtime = buf.st_mtime;
+  return true;
+}
+
+//! false if there is no (valid, fresh) index, which is fine
+bool ZLineReader::loadIndex()
+{
+  ZIndexHeader zih;
+  uint64_t size, mtime;
+  if(!statFile(d_fname, &size, &mtime))
+    return false;
+  FILE* fp = fopen(indexName(d_fname).c_str(), "rb");
+  if(!fp)
+    return false;
+  std::shared_ptr<FILE> guard(fp, fclose);
+  if(fread(&zih, sizeof(zih), 1, fp) != 1 || memcmp(zih.magic, "AZIDX001", 8) || 
+     zih.fileSize != size || zih.mtime != mtime)
+    return false;
+
+  for(uint64_t n = 0; n < zih.numPoints; ++n) {
+    uint64_t uncPos;
+    uint32_t wlen;
+    AccessPoint ap;
+    if(fread(&uncPos, sizeof(uncPos), 1, fp) != 1 || fread(&ap.inPos, sizeof(ap.inPos), 1, fp) != 1 ||
+       fread(&ap.bits, 1, 1, fp) != 1 || fread(&wlen, sizeof(wlen), 1, fp) != 1 || wlen > 65536)
+      return false;
+    ap.window.resize(wlen);
+    if(wlen && fread(&ap.window[0], 1, wlen, fp) != wlen)
+      return false;
+    d_points[uncPos]=ap;
+  }
+  if(d_points.empty() || d_points.begin()->first)
+    return false;
+  d_totalSize = zih.totalSize;
+  d_indexComplete = true;
   return true;
 }
 
+//! best effort, we might well not be allowed to write next to our input
+void ZLineReader::saveIndex()
+{
+  ZIndexHeader zih;
+  memcpy(zih.magic, "AZIDX001", 8);
+  if(!statFile(d_fname, &zih.fileSize, &zih.mtime))
+    return;
+  string tmpname = indexName(d_fname)+".tmp";
+  FILE* fp = fopen(tmpname.c_str(), "wb");
+  if(!fp)
+    return;
+  bool ok;
+  {
+    std::lock_guard<std::mutex> lock(d_pointLock);
+    zih.totalSize = d_totalSize;
+    zih.numPoints = d_points.size();
+    ok = fwrite(&zih, sizeof(zih), 1, fp) == 1;
+    for(const auto& p : d_points) {
+      uint32_t wlen = p.second.window.size();
+      ok = ok && fwrite(&p.first, sizeof(p.first), 1, fp) == 1 && fwrite(&p.second.inPos, sizeof(p.second.inPos), 1, fp) == 1 &&
+	fwrite(&p.second.bits, 1, 1, fp) == 1 && fwrite(&wlen, sizeof(wlen), 1, fp) == 1 && 
+	(!wlen || fwrite(p.second.window.c_str(), 1, wlen, fp) == wlen);
+    }
+  }
+  ok = !fclose(fp) && ok;
+  if(!ok || rename(tmpname.c_str(), indexName(d_fname).c_str()) < 0)
+    unlink(tmpname.c_str());
+}
+
+static void backOff(unsigned int* rounds)
+{
+  if(++*rounds < 100)
+    std::this_thread::yield();
+  else
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+void ZLineReader::startThread()
+{
+  d_stop = false;
+  d_thread = std::thread([this]() {
+      for(;;) {
+	unsigned int rounds=0;
+	while(d_produced - d_consumed.load(std::memory_order_acquire) == s_numBlocks) {
+	  if(d_stop)
+	    return;
+	  backOff(&rounds);
+	}
+	if(d_stop)
+	  return;
+	Block& block = d_blocks[d_produced % s_numBlocks];
+	try {
+	  fillBlock(&block);
+	}
+	catch(...) {
+	  block.len = 0;
+	  block.error = std::current_exception();
+	}
+	d_produced.fetch_add(1, std::memory_order_release);
+	if(!block.len) // EOF or error
+	  return;
+      }
+    });
+}
+
+void ZLineReader::stopThread()
+{
+  if(!d_thread.joinable())
+    return;
+  d_stop = true;
+  d_thread.join();
+  d_stop = false;
+  // whoever stops us repositions zlib, any parallel work in progress is moot
+  d_par.reset();
+  d_parOut.clear();
+  d_parPos = 0;
+}
+
+//! makes sure the current block has something left for us, false on EOF
+bool ZLineReader::haveData()
+{
+  if(d_haveBlock) {
+    const Block& cur = d_blocks[d_consumed % s_numBlocks];
+    if(d_blockPos < cur.len)
+      return true;
+    if(!cur.len) 
+      return false;
+    d_consumed.fetch_add(1, std::memory_order_release); // producer can now reuse this block
+    d_haveBlock = false;
+    d_seqBlocks++;
+  }
+  
+  if(d_background && !d_thread.joinable() && d_seqBlocks >= 16) // ~1MB of reading, so not seeking
+    startThread();
+
+  if(d_thread.joinable()) {
+    unsigned int rounds=0;
+    while(d_produced.load(std::memory_order_acquire) == d_consumed)
+      backOff(&rounds);
+  }
+  else if(d_produced == d_consumed) {
+    inflateBlock(&d_blocks[d_produced % s_numBlocks], 65536); // small, so seeking stays cheap
+    d_produced++;
+  }
+  
+  Block& cur = d_blocks[d_consumed % s_numBlocks];
+  if(cur.error) {
+    auto error = cur.error;
+    cur.error = nullptr;
+    std::rethrow_exception(error);
+  }
+  d_haveBlock = true;
+  d_blockPos = 0;
+  return cur.len > 0;
+}
+
 void ZLineReader::unget(char* line)
 {
   d_stash=line;
 }
 
+bool ZLineReader::getLine(const char** line, size_t* len)
+{
+  if(!d_stash.empty())
+    return LineReader::getLine(line, len); // goes through our fgets
+
+  d_line.clear();
+  while(haveData()) {
+    const Block& cur = d_blocks[d_consumed % s_numBlocks];
+    const char* begin = &cur.data[d_blockPos];
+    size_t avail = cur.len - d_blockPos;
+    const char* nl = (const char*)memchr(begin, '\n', avail);
+    size_t take = nl ? (nl - begin + 1) : avail;
+    d_blockPos += take;
+    d_uncPos += take;
+    if(nl && d_line.empty()) { // whole line is in this block, no need to copy
+      *line = begin;
+      *len = take - 1;
+      if(*len && begin[*len-1]=='\r')
+	--*len;
+      return true;
+    }
+    d_line.append(begin, take);
+    if(nl)
+      break;
+  }
+  if(d_line.empty())
+    return false;
+  *len = d_line.size();
+  if(d_line[*len-1]=='\n')
+    --*len;
+  if(*len && d_line[*len-1]=='\r')
+    --*len;
+  *line = d_line.c_str();
+  return true;
+}
 
 char* ZLineReader::fgets(char* line, int num)
 {
@@ -130,80 +528,230 @@ char* ZLineReader::fgets(char* line, int num)
     d_stash.clear();
     return line;
   }
-  if(!d_haveSeeked && (d_restarts.empty() || d_uncPos - d_restarts.rbegin()->first > 400000)) {
-    d_zs.fpos = ftell(d_fp) - d_zs.s.avail_in;
-    d_restarts[d_uncPos + d_have]=d_zs;
-  }
 
   int i=0;
-  char c;
-  for(i=0; i<num;++i) {
-    if(!getChar(&c))
-      break;
-    *line++=c;
-    if(c=='\n')
+  while(i < num - 1 && haveData()) {
+    const Block& cur = d_blocks[d_consumed % s_numBlocks];
+    const char* begin = &cur.data[d_blockPos];
+    size_t avail = min(cur.len - d_blockPos, (size_t)(num - 1 - i));
+    const char* nl = (const char*)memchr(begin, '\n', avail);
+    size_t take = nl ? (nl - begin + 1) : avail;
+    memcpy(line + i, begin, take);
+    i += take;
+    d_blockPos += take;
+    d_uncPos += take;
+    if(nl)
       break;
   }
-  *line=0;
+  line[i]=0;
 
   return i ? line : 0;
 }
 
 void ZLineReader::skip(uint64_t bytes)
 {
-  for(unsigned int i = 0 ; i < bytes; ++i) {
-    if(!getChar(0)) {
+  while(bytes) {
+    if(!haveData()) 
       throw runtime_error("Had EOF while seeking?!");
-    }
+    uint64_t take = min(bytes, (uint64_t)(d_blocks[d_consumed % s_numBlocks].len - d_blockPos));
+    d_blockPos += take;
+    d_uncPos += take;
+    bytes -= take;
   }
 }
 
 uint64_t ZLineReader::uncompressedSize()
 {
-  throw runtime_error("Can't yet estimate size of compressed files, sorry");
+  {
+    std::lock_guard<std::mutex> lock(d_pointLock);
+    if(d_indexComplete)
+      return d_totalSize;
+  }
+  // inflate the rest of the file on the side, starting from the furthest access point we know about
+  ZLineReader scan(d_fname, true, d_spacing, d_numThreads);
+  uint64_t from;
+  {
+    std::lock_guard<std::mutex> lock(d_pointLock);
+    scan.d_points = d_points;
+    from = d_points.rbegin()->first;
+  }
+  scan.seek(from);
+  while(scan.haveData()) {
+    const Block& cur = scan.d_blocks[scan.d_consumed % s_numBlocks];
+    scan.d_uncPos += cur.len - scan.d_blockPos;
+    scan.d_blockPos = cur.len;
+  }
+
+  std::lock_guard<std::mutex> lock(d_pointLock);
+  d_points.insert(scan.d_points.begin(), scan.d_points.end());
+  d_totalSize = scan.d_totalSize;
+  d_indexComplete = true;
+  return d_totalSize;
 }
 
-void ZLineReader::seek(uint64_t pos)
+uint64_t ZLineReader::estimatedSize()
 {
-  d_haveSeeked=1;
-  
-  auto iter = d_restarts.lower_bound(pos);
-  if(iter == d_restarts.begin()) {
-    throw runtime_error("Found nothing for pos = "+boost::lexical_cast<string>(pos));
+  uint64_t uncPos, inPos;
+  {
+    std::lock_guard<std::mutex> lock(d_pointLock);
+    if(d_indexComplete)
+      return d_totalSize;
+    uncPos = d_seenUncPos;
+    inPos = d_seenInPos;
   }
-  if(iter != d_restarts.begin())
-    --iter;
-  //cerr<<"Want to seek to uncompressed pos: "<<pos<<", seeking to fpos: "<<iter->second.fpos;
-  //cerr<<", giving us uncompressed pos "<<iter->first<<endl;
+  uint64_t size, mtime;
+  if(!uncPos || !inPos || !statFile(d_fname, &size, &mtime))
+    return uncompressedSize(); // not even a single deflate block to go by
+  return 1.0 * uncPos / inPos * size;
+}
 
+void ZLineReader::seek(uint64_t pos)
+{
+  d_stash.clear();
+  uint64_t apPos;
+  AccessPoint ap;
+  {
+    std::lock_guard<std::mutex> lock(d_pointLock);
+    auto iter = d_points.upper_bound(pos);
+    --iter; // there is always one at 0
+    apPos = iter->first;
+    ap = iter->second;
+  }
 
-  if(pos > d_uncPos && (pos - d_uncPos) < (pos - iter->first)) {
-    //    cerr<<"Skipping, "<< (pos - d_uncPos) << " < " << (pos - iter ->first)<<endl;
+  if(pos >= d_uncPos && (pos - d_uncPos) <= (pos - apPos)) {
     skip(pos - d_uncPos);
+    d_seqBlocks = 0;
     return;
   }
 
-  fseek(d_fp, iter->second.fpos, SEEK_SET);
-  d_zs = iter->second;
-  d_uncPos = iter->first;
-
-  d_have=0;
-  d_datapos=0;
-  d_zs.s.next_in=(Bytef*)d_inbuffer;
-  d_zs.s.avail_in=0;
-  d_zs.s.next_out=(Bytef*)d_outbuffer;
-  d_zs.s.avail_out=sizeof(d_outbuffer);
-  //cerr<<"Now need to skip "<<pos - iter->first<<" bytes!"<<endl;
-  skip(pos - iter->first);
-
+  stopThread();
+  restart(apPos, ap);
+  d_produced = 0;
+  d_consumed = 0;
+  d_haveBlock = false;
+  d_blockPos = 0;
+  d_uncPos = apPos;
+  skip(pos - apPos);
+  d_seqBlocks = 0; // what we skipped over does not count as sequential reading
 }
 
 ZLineReader::~ZLineReader()
 {
-  inflateEnd(&d_zs.s);
+  stopThread();
+  inflateEnd(&d_zs);
+#ifndef _WIN32
+  if(d_map)
+    munmap((void*)d_map, d_mapSize);
+#endif
   fclose(d_fp);
 }
 
+bool LineReader::getLine(const char** line, size_t* len)
+{
+  char buffer[1024];
+  d_line.clear();
+  do {
+    if(!fgets(buffer, sizeof(buffer)))
+      break;
+    d_line.append(buffer);
+  } while(d_line.empty() || d_line[d_line.size()-1] != '\n');
+
+  if(d_line.empty())
+    return false;
+  *len = d_line.size();
+  if(d_line[*len-1]=='\n')
+    --*len;
+  if(*len && d_line[*len-1]=='\r')
+    --*len;
+  *line = d_line.c_str();
+  return true;
+}
+
+#ifndef _WIN32
+MMapLineReader::MMapLineReader(const std::string& fname) : d_data(0), d_pos(0)
+{
+  int fd = open(fname.c_str(), O_RDONLY);
+  if(fd < 0)
+    throw runtime_error("Unable to open '"+fname+"' for reading on MMapLineReader: "+ string(strerror(errno)));
+  struct stat buf;
+  if(fstat(fd, &buf) < 0) {
+    close(fd);
+    throw runtime_error("Unable to determine size of '"+fname+"' in MMapLineReader: "+ string(strerror(errno)));
+  }
+  d_size = buf.st_size;
+  if(d_size) {
+    void* p = mmap(0, d_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(p == MAP_FAILED) {
+      close(fd);
+      throw runtime_error("Unable to map '"+fname+"' in MMapLineReader: "+ string(strerror(errno)));
+    }
+    d_data = (const char*)p;
+    madvise(p, d_size, MADV_SEQUENTIAL);
+  }
+  close(fd); // the mapping stays
+}
+
+MMapLineReader::~MMapLineReader()
+{
+  if(d_data)
+    munmap((void*)d_data, d_size);
+}
+
+bool MMapLineReader::getLine(const char** line, size_t* len)
+{
+  if(!d_stash.empty()) 
+    return LineReader::getLine(line, len);
+
+  if(d_pos >= d_size)
+    return false;
+  const char* begin = d_data + d_pos;
+  const char* end = (const char*)memchr(begin, '\n', d_size - d_pos);
+  if(end) 
+    d_pos = end - d_data + 1;
+  else {
+    end = d_data + d_size;
+    d_pos = d_size;
+  }
+  if(end != begin && end[-1]=='\r')
+    --end;
+  *line = begin;
+  *len = end - begin;
+  return true;
+}
+
+char* MMapLineReader::fgets(char* line, int num)
+{
+  if(!d_stash.empty()) {
+    strncpy(line, d_stash.c_str(), num);
+    d_stash.clear();
+    return line;
+  }
+  if(d_pos >= d_size || num < 1)
+    return 0;
+  uint64_t room = min((uint64_t)num - 1, d_size - d_pos);
+  const char* begin = d_data + d_pos;
+  const char* end = (const char*)memchr(begin, '\n', room);
+  size_t len = end ? (end - begin + 1) : room;
+  memcpy(line, begin, len);
+  line[len]=0;
+  d_pos += len;
+  return line;
+}
+
+void MMapLineReader::unget(char* line)
+{
+  d_stash=line;
+}
+
+void MMapLineReader::seek(uint64_t pos)
+{
+  if(pos > d_size)
+    throw runtime_error("Seeking beyond end of file in MMapLineReader");
+  d_stash.clear();
+  d_pos = pos;
+}
+#endif
+
 PlainLineReader::PlainLineReader(const std::string& fname)
 {
   d_fp=fopen(fname.c_str(), "rb");
@@ -254,12 +802,339 @@ PlainLineReader::~PlainLineReader()
   fclose(d_fp);
 }
 
+static uint32_t getLE32(const unsigned char* p)
+{
+  return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+//! parses a gzip header with extra field, returns BSIZE+1 of the BGZF 'BC' subfield, 0 if there is none
+static uint32_t bgzfBlockSize(FILE* fp)
+{
+  unsigned char header[12];
+  if(fread(header, 1, sizeof(header), fp) != sizeof(header) || header[0] != 0x1f || header[1] != 0x8b ||
+     header[2] != 8 || !(header[3] & 4))
+    return 0;
+  unsigned int xlen = header[10] | (header[11] << 8);
+  if(xlen < 6) // too short for a 'BC' subfield
+    return 0;
+  vector<unsigned char> extra(xlen);
+  if(fread(extra.data(), 1, xlen, fp) != xlen)
+    return 0;
+  for(unsigned int pos = 0; pos + 4 <= xlen; ) {
+    unsigned int slen = extra[pos+2] | (extra[pos+3] << 8);
+    if(extra[pos]=='B' && extra[pos+1]=='C' && slen == 2 && pos + 6 <= xlen)
+      return (extra[pos+4] | (extra[pos+5] << 8)) + 1;
+    pos += 4 + slen;
+  }
+  return 0;
+}
+
+bool BGZFLineReader::isBGZF(const std::string& fname)
+{
+  FILE* fp = fopen(fname.c_str(), "rb");
+  if(!fp)
+    return false;
+  bool ret = bgzfBlockSize(fp) > 0;
+  fclose(fp);
+  return ret;
+}
+
+BGZFLineReader::BGZFLineReader(const std::string& fname, unsigned int numThreads) 
+  : d_fname(fname), d_nextCPos(0), d_haveAllBlocks(false), d_cur(0), d_issued(0), d_haveCur(false), d_blockPos(0), 
+    d_seqBlocks(0), d_numThreads(numThreads), d_uncPos(0)
+{
+  d_fp=fopen(fname.c_str(), "rb");
+  if(!d_fp)
+    throw runtime_error("Unable to open '"+fname+"' for reading on BGZFLineReader: "+ string(strerror(errno)));
+  memset(&d_zs, 0, sizeof(d_zs));
+  inflateInit2(&d_zs, -15);
+  if(!d_numThreads)
+    d_numThreads = min(4U, max(1U, std::thread::hardware_concurrency()));
+  d_slots.resize(4*d_numThreads);
+  for(auto& s : d_slots) {
+    s.block = std::numeric_limits<size_t>::max();
+    s.done = true;
+  }
+}
+
+BGZFLineReader::~BGZFLineReader()
+{
+  d_work.close(); // workers finish what they have, and quit
+  for(auto& t : d_threads)
+    t.join();
+  inflateEnd(&d_zs);
+  fclose(d_fp);
+}
+
+//! extends the block table up to block n, false if there is no such block
+bool BGZFLineReader::haveBlockInfo(size_t n)
+{
+  while(d_blockinfo.size() <= n && !d_haveAllBlocks) {
+    BlockInfo bi;
+    bi.cPos = d_nextCPos;
+    bi.uncPos = d_blockinfo.empty() ? 0 : d_blockinfo.rbegin()->uncPos + d_blockinfo.rbegin()->uncSize;
+    if(fseek(d_fp, bi.cPos, SEEK_SET) < 0)
+      throw runtime_error("Unable to seek in '"+d_fname+"': "+string(strerror(errno)));
+    if(fgetc(d_fp) == EOF) {
+      d_haveAllBlocks = true;
+      break;
+    }
+    fseek(d_fp, bi.cPos, SEEK_SET);
+    bi.cSize = bgzfBlockSize(d_fp);
+    unsigned char isize[4];
+    if(!bi.cSize || fseek(d_fp, bi.cPos + bi.cSize - 4, SEEK_SET) < 0 || fread(isize, 1, 4, d_fp) != 4)
+      throw runtime_error("Block at offset "+std::to_string(bi.cPos)+" of '"+d_fname+"' is not a valid BGZF block");
+    bi.uncSize = getLE32(isize);
+    if(bi.uncSize) // skip empty blocks, like the EOF marker
+      d_blockinfo.push_back(bi);
+    d_nextCPos = bi.cPos + bi.cSize;
+  }
+  return n < d_blockinfo.size();
+}
+
+void BGZFLineReader::inflateSlot(z_stream* zs, Slot* slot)
+{
+  const unsigned char* comp = (const unsigned char*)slot->comp.c_str();
+  size_t headerLen = 12 + (comp[10] | (comp[11] << 8));
+  uint32_t crc = getLE32(comp + slot->comp.size() - 8), isize = getLE32(comp + slot->comp.size() - 4);
+  if(slot->data.size() < isize)
+    slot->data.resize(isize);
+
+  inflateReset(zs);
+  zs->next_in = (Bytef*)comp + headerLen;
+  zs->avail_in = slot->comp.size() - headerLen - 8;
+  zs->next_out = (Bytef*)&slot->data[0];
+  zs->avail_out = isize;
+  if(inflate(zs, Z_FINISH) != Z_STREAM_END || zs->total_out != isize || 
+     crc32(crc32(0, 0, 0), (Bytef*)&slot->data[0], isize) != crc)
+    throw runtime_error("Corrupt BGZF block");
+}
+
+//! reads in block n and hands it out for inflating, or inflates it right here if we have no threads
+void BGZFLineReader::issue(size_t n)
+{
+  Slot& s = slot(n);
+  const BlockInfo& bi = d_blockinfo[n];
+  s.block = n;
+  s.done = false;
+  s.error = nullptr;
+  s.comp.resize(bi.cSize);
+  if(fseek(d_fp, bi.cPos, SEEK_SET) < 0 || fread(&s.comp[0], 1, bi.cSize, d_fp) != bi.cSize)
+    throw runtime_error("Unable to read block at offset "+std::to_string(bi.cPos)+" of '"+d_fname+"'");
+  if(d_threads.empty()) {
+    try {
+      inflateSlot(&d_zs, &s);
+    }
+    catch(...) {
+      s.error = std::current_exception();
+    }
+    s.done = true;
+  }
+  else 
+    d_work.push(&s);
+}
+
+void BGZFLineReader::waitFor(size_t n)
+{
+  Slot& s = slot(n);
+  std::unique_lock<std::mutex> lock(d_doneLock);
+  d_doneCond.wait(lock, [&s]() { return s.done; });
+}
+
+void BGZFLineReader::startThreads()
+{
+  for(unsigned int n = 0; n < d_numThreads; ++n) {
+    d_threads.push_back(std::thread([this]() {
+	  z_stream zs;
+	  memset(&zs, 0, sizeof(zs));
+	  inflateInit2(&zs, -15);
+	  Slot* s;
+	  while(d_work.pop(&s)) {
+	    try {
+	      inflateSlot(&zs, s);
+	    }
+	    catch(...) {
+	      s->error = std::current_exception();
+	    }
+	    {
+	      std::lock_guard<std::mutex> lock(d_doneLock);
+	      s->done = true;
+	    }
+	    d_doneCond.notify_all();
+	  }
+	  inflateEnd(&zs);
+	}));
+  }
+}
+
+//! makes sure the current block has something left for us, false on EOF
+bool BGZFLineReader::haveData()
+{
+  if(d_haveCur) {
+    if(d_blockPos < d_blockinfo[d_cur].uncSize)
+      return true;
+    d_cur++;
+    d_haveCur = false;
+    d_blockPos = 0;
+    d_seqBlocks++;
+  }
+  if(!haveBlockInfo(d_cur))
+    return false;
+
+  if(d_threads.empty() && d_numThreads > 1 && d_seqBlocks >= 2)
+    startThreads();
+
+  if(d_issued <= d_cur) 
+    d_issued = d_cur;
+  // keep all slots busy, when we have threads
+  for(; d_issued < d_cur + (d_threads.empty() ? 1 : d_slots.size()) && haveBlockInfo(d_issued); ++d_issued)
+    issue(d_issued);
+  
+  waitFor(d_cur);
+  Slot& s = slot(d_cur);
+  if(s.error) {
+    auto error = s.error;
+    s.error = nullptr;
+    std::rethrow_exception(error);
+  }
+  d_haveCur = true;
+  return true;
+}
+
+void BGZFLineReader::unget(char* line)
+{
+  d_stash=line;
+}
+
+bool BGZFLineReader::getLine(const char** line, size_t* len)
+{
+  if(!d_stash.empty())
+    return LineReader::getLine(line, len); // goes through our fgets
+
+  d_line.clear();
+  while(haveData()) {
+    const char* begin = &slot(d_cur).data[d_blockPos];
+    size_t avail = d_blockinfo[d_cur].uncSize - d_blockPos;
+    const char* nl = (const char*)memchr(begin, '\n', avail);
+    size_t take = nl ? (nl - begin + 1) : avail;
+    d_blockPos += take;
+    d_uncPos += take;
+    if(nl && d_line.empty()) { // whole line is in this block, no need to copy
+      *line = begin;
+      *len = take - 1;
+      if(*len && begin[*len-1]=='\r')
+	--*len;
+      return true;
+    }
+    d_line.append(begin, take);
+    if(nl)
+      break;
+  }
+  if(d_line.empty())
+    return false;
+  *len = d_line.size();
+  if(d_line[*len-1]=='\n')
+    --*len;
+  if(*len && d_line[*len-1]=='\r')
+    --*len;
+  *line = d_line.c_str();
+  return true;
+}
+
+char* BGZFLineReader::fgets(char* line, int num)
+{
+  if(!d_stash.empty()) {
+    strncpy(line, d_stash.c_str(), num);
+    d_stash.clear();
+    return line;
+  }
+
+  int i=0;
+  while(i < num - 1 && haveData()) {
+    const char* begin = &slot(d_cur).data[d_blockPos];
+    size_t avail = min((size_t)d_blockinfo[d_cur].uncSize - d_blockPos, (size_t)(num - 1 - i));
+    const char* nl = (const char*)memchr(begin, '\n', avail);
+    size_t take = nl ? (nl - begin + 1) : avail;
+    memcpy(line + i, begin, take);
+    i += take;
+    d_blockPos += take;
+    d_uncPos += take;
+    if(nl)
+      break;
+  }
+  line[i]=0;
+
+  return i ? line : 0;
+}
+
+uint64_t BGZFLineReader::uncompressedSize()
+{
+  haveBlockInfo(std::numeric_limits<size_t>::max());
+  if(d_blockinfo.empty())
+    return 0;
+  return d_blockinfo.rbegin()->uncPos + d_blockinfo.rbegin()->uncSize;
+}
+
+void BGZFLineReader::seek(uint64_t pos)
+{
+  d_stash.clear();
+  // make sure the block table reaches pos
+  while((d_blockinfo.empty() || d_blockinfo.rbegin()->uncPos + d_blockinfo.rbegin()->uncSize <= pos) && 
+	haveBlockInfo(d_blockinfo.size()))
+    ;
+  if(d_blockinfo.empty() && !pos) { // only empty blocks, so the start is also the end
+    d_cur = 0;
+    d_haveCur = false;
+    d_blockPos = 0;
+    d_uncPos = 0;
+    return;
+  }
+  auto iter = upper_bound(d_blockinfo.begin(), d_blockinfo.end(), pos, 
+			  [](uint64_t p, const BlockInfo& bi) { return p < bi.uncPos; });
+  size_t n = iter - d_blockinfo.begin();
+  if(n)
+    --n;
+  if(n >= d_blockinfo.size() || pos > d_blockinfo[n].uncPos + d_blockinfo[n].uncSize)
+    throw runtime_error("Had EOF while seeking?!");
+
+  // slots we are about to let go of might still be in flight
+  size_t from = d_cur, to = (n >= d_cur && n < d_issued) ? n : d_issued;
+  for(size_t b = from; b < to; ++b)
+    waitFor(b);
+  if(to == d_issued) {
+    Slot& s = slot(n);
+    d_issued = (s.block == n && !s.error) ? n + 1 : n; // block might still be around from earlier
+  }
+  if(n != d_cur)
+    d_haveCur = false;
+  d_cur = n;
+  d_seqBlocks = 0;
+  if(pos == d_blockinfo[n].uncPos + d_blockinfo[n].uncSize) { // the very end
+    d_cur++;
+    d_haveCur = false;
+    d_blockPos = 0;
+  }
+  else {
+    if(!d_haveCur)
+      haveData();
+    d_blockPos = pos - d_blockinfo[n].uncPos;
+  }
+  d_uncPos = pos;
+}
+
 unique_ptr<LineReader> LineReader::make(const std::string& fname)
 {
-  if(boost::ends_with(fname, ".gz"))
+  if(boost::ends_with(fname, ".gz") || boost::ends_with(fname, ".bgz")) {
+    if(BGZFLineReader::isBGZF(fname))
+      return unique_ptr<LineReader>(new BGZFLineReader(fname));
     return unique_ptr<LineReader>(new ZLineReader(fname));
-  else
-    return unique_ptr<LineReader>(new PlainLineReader(fname));
+  }
+#ifndef _WIN32
+  struct stat buf;
+  if(!stat(fname.c_str(), &buf) && S_ISREG(buf.st_mode))
+    return unique_ptr<LineReader>(new MMapLineReader(fname));
+#endif
+  return unique_ptr<LineReader>(new PlainLineReader(fname));
 }
 
 
@@ -8,19 +8,35 @@
 #include <memory>
 #include <boost/crc.hpp>
 #include <stdint.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <condition_variable>
+#include "misc.hh"
+#include "specinflate.hh"
 
 //! Virtual base for seekable line readers
 class LineReader
 {
 public:
   virtual ~LineReader() {}
-  // virtual bool getLine(std::string* str) = 0;
+  //! Get a line of any length, without line ending. It remains valid until the next call
+  virtual bool getLine(const char** line, size_t* len);
   virtual char* fgets(char* line, int num) = 0;
   virtual void seek(uint64_t pos) = 0;
   virtual uint64_t getUncPos()=0;
   virtual void unget(char *line) = 0;
   virtual uint64_t uncompressedSize() = 0;
+  //! uncompressedSize(), or a guess from what we read so far if knowing it exactly would take another pass over the file
+  virtual uint64_t estimatedSize()
+  {
+    return uncompressedSize();
+  }
   static std::unique_ptr<LineReader> make(const std::string& fname);
+protected:
+  std::string d_line;
 };
 
 //! A plain text seekable line reader
@@ -40,42 +56,206 @@ private:
   std::string d_stash;
 };
 
+#ifndef _WIN32
+//! A plain text line reader that memory maps its file, and hands out lines without copying them
+class MMapLineReader : public LineReader, boost::noncopyable
+{
+public:
+  MMapLineReader(const std::string& fname);
+  ~MMapLineReader();
+  bool getLine(const char** line, size_t* len);
+  char* fgets(char* line, int num);
+  void seek(uint64_t pos);
+  uint64_t getUncPos()
+  {
+    return d_pos;
+  }
+  void unget(char *line);
+  uint64_t uncompressedSize()
+  {
+    return d_size;
+  }
+private:
+  const char* d_data;
+  uint64_t d_size;
+  uint64_t d_pos;
+  std::string d_stash;
+};
+#endif
+
+/** A gzipped compressed seekable line reader. Inflates in large blocks, optionally on a
+    background thread which fills a lock-free ring of blocks while we consume lines from it.
+    The thread only gets started once we read sequentially, so seek-heavy use stays cheap.
+
+    For seeking we record access points on deflate block boundaries, every 'spacing' uncompressed bytes.
+    An access point holds just the 32KB dictionary (itself compressed) and the bit offset in the file.
+    Once we've seen the whole file, the access points and the uncompressed size are saved to fname.zidx,
+    so later runs can seek anywhere straight away.
 
-//! A gzipped compressed seekable line reader
+    When reading sequentially with numThreads > 1, the background thread hands each gzip member
+    to a ParallelInflater from its first deflate block boundary on, which decodes on several threads. */
 class ZLineReader : public LineReader, boost::noncopyable
 {
 public:
-  ZLineReader(const std::string& fname);
+  //! numThreads=0 picks a number based on the number of CPUs
+  ZLineReader(const std::string& fname, bool background=true, uint64_t spacing=1048576, unsigned int numThreads=0);
   ~ZLineReader();
-  //  bool getLine(std::string* str);
+  bool getLine(const char** line, size_t* len);
   char* fgets(char* line, int num);
   void unget(char *line);
   uint64_t getUncPos()
   {
     return d_uncPos;
   }
+  //! Exact, from the index. If we don't have a complete index yet, this inflates the rest of the file to make one
   uint64_t uncompressedSize();
+  //! Exact with a complete index, otherwise scaled up from how well the part we inflated so far compressed
+  uint64_t estimatedSize();
   void seek(uint64_t pos);
+  //! Name of the sidecar index file for fname
+  static std::string indexName(const std::string& fname)
+  {
+    return fname+".zidx";
+  }
 private:
-  bool getChar(char* c);
+  //! A block of inflated data, starting at uncompressed offset uncPos. Empty means EOF
+  struct Block
+  {
+    std::vector<char> data;
+    size_t len;
+    uint64_t uncPos;
+    std::exception_ptr error;
+  };
+  //! Where to restart inflating. The access point at uncompressed offset 0 is the start of the gzip file
+  struct AccessPoint
+  {
+    uint64_t inPos; //!< offset of the first byte in the compressed file that still has bits for us
+    uint8_t bits;   //!< number of bits of that byte we need
+    std::string window; //!< compress()'ed dictionary preceding this point
+  };
+  bool haveData();
+  void inflateBlock(Block* block, size_t size, bool toBoundary=false);
+  void fillBlock(Block* block);
+  void startParallel();
+  void fillFromParallel(Block* block);
+  void endParallel();
+  void finish();
+  void startThread();
+  void stopThread();
   void skip(uint64_t toSkip);
+  bool refill();
+  void addPoint();
+  void storePoint(uint64_t uncPos, uint64_t bit, const char* window, size_t len);
+  void restart(uint64_t uncPos, const AccessPoint& ap);
+  bool loadIndex();
+  void saveIndex();
   FILE* d_fp;
   
-  struct ZState {
-    ZState();
-    ZState(const ZState& orig);
-    ~ZState();
-    ZState& operator=(const ZState& rhs);
-    uint64_t fpos;
-    z_stream s;
-  } d_zs;
-  int d_have;
-  int d_datapos;
-
-  char d_inbuffer[4096], d_outbuffer[32768];
-  std::map<uint64_t, ZState> d_restarts;
+  z_stream d_zs;
+  bool d_raw; //!< inflating raw deflate data after restarting mid-stream, so no gzip header or trailer processing
+  std::vector<char> d_inbuffer;
+  std::string d_fname;
+  uint64_t d_spacing;
+  std::map<uint64_t, AccessPoint> d_points;
+  std::mutex d_pointLock; //!< d_points grows from the inflating thread
+  std::atomic<bool> d_indexComplete; //!< we have access points for the whole file, and know its size. Set under d_pointLock
+  uint64_t d_totalSize;
+  uint64_t d_seenUncPos, d_seenInPos; //!< furthest deflate block boundary we passed, for estimatedSize()
+  uint64_t d_zPos; //!< uncompressed offset the inflater is at
+  bool d_zDone;
+  bool d_atBoundary; //!< inflateBlock() stopped on a deflate block boundary
+
+  unsigned int d_numThreads;
+  const unsigned char* d_map; //!< the whole compressed file, for the ParallelInflater
+  uint64_t d_mapSize;
+  std::unique_ptr<ParallelInflater> d_par;
+  std::string d_parOut, d_parWindow; //!< piece we are handing out, and the 32KB before it
+  size_t d_parPos;
+  std::vector<SpeculativeInflater::Boundary> d_parBounds;
+
+  static const unsigned int s_numBlocks = 4;
+  Block d_blocks[s_numBlocks];
+  //! block d_consumed % s_numBlocks is the one we read from, d_produced % s_numBlocks the one that gets filled next
+  std::atomic<uint64_t> d_produced, d_consumed;
+  size_t d_blockPos; //!< our offset within the current block
+  bool d_haveBlock;
+  unsigned int d_seqBlocks; //!< blocks consumed since last seek
+  bool d_background;
+  std::thread d_thread;
+  std::atomic<bool> d_stop;
+
+  uint64_t d_uncPos;
+  std::string d_stash;
+};
+
+/** Reads BGZF files, as made by bgzip, which are a series of independent gzip blocks of at most 64KB.
+    Because blocks stand on their own, upcoming blocks get inflated on a pool of threads, and
+    seeking to an uncompressed offset only means finding its block and inflating that.
+    The table of blocks is built as needed by hopping from block header to block header. */
+class BGZFLineReader : public LineReader, boost::noncopyable
+{
+public:
+  //! numThreads=0 picks a number based on the number of CPUs
+  BGZFLineReader(const std::string& fname, unsigned int numThreads=0);
+  ~BGZFLineReader();
+  bool getLine(const char** line, size_t* len);
+  char* fgets(char* line, int num);
+  void unget(char *line);
+  uint64_t getUncPos()
+  {
+    return d_uncPos;
+  }
+  uint64_t uncompressedSize();
+  void seek(uint64_t pos);
+  //! true if fname starts with a gzip header carrying the BGZF 'BC' extra field
+  static bool isBGZF(const std::string& fname);
+private:
+  struct BlockInfo
+  {
+    uint64_t cPos;   //!< offset of the block in the file
+    uint64_t uncPos; //!< uncompressed offset of its first byte
+    uint32_t cSize, uncSize;
+  };
+  //! holds block number 'block' while it gets inflated, and after
+  struct Slot
+  {
+    size_t block;
+    std::string comp;
+    std::vector<char> data;
+    bool done;
+    std::exception_ptr error;
+  };
+  bool haveBlockInfo(size_t n);
+  Slot& slot(size_t n)
+  {
+    return d_slots[n % d_slots.size()];
+  }
+  void issue(size_t n);
+  void waitFor(size_t n);
+  bool haveData();
+  void startThreads();
+  static void inflateSlot(z_stream* zs, Slot* slot);
+
+  FILE* d_fp;
+  std::string d_fname;
+  std::vector<BlockInfo> d_blockinfo; //!< only non-empty blocks
+  uint64_t d_nextCPos; //!< where the first block not yet in d_blockinfo starts
+  bool d_haveAllBlocks;
+  z_stream d_zs; //!< for inflating on our own thread
+
+  std::vector<Slot> d_slots; 
+  size_t d_cur;    //!< the block we are reading from
+  size_t d_issued; //!< blocks d_cur up to here have been handed out for inflating
+  bool d_haveCur;
+  size_t d_blockPos;
+  unsigned int d_seqBlocks; //!< blocks consumed since last seek
+  unsigned int d_numThreads;
+  std::vector<std::thread> d_threads;
+  BlockingQueue<Slot*> d_work;
+  std::mutex d_doneLock;
+  std::condition_variable d_doneCond;
+
   uint64_t d_uncPos;
-  bool d_haveSeeked;
   std::string d_stash;
 };
 